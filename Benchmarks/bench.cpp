@@ -2,6 +2,7 @@
 #include "pcg.h"
 #include "main.h"
 #include "cmdline_parser.h"
+#include <algorithm>
 #include <thread>
 
 // dummies to make the linker happy
@@ -10,13 +11,22 @@ void MRT::KeyboardCallback(int keycode, KeyState state, KeyState prev) {}
 void MRT::WindowCallback(WindowEvent e) {}
 
 // NOTE: unfortunately, this cannot be set after dynamic initialization. benchmark runs x times faster.
-uint32 threads = std::thread::hardware_concurrency() / 2;
+uint32 threads = std::max(std::thread::hardware_concurrency() / 2, 1u);
 
 int main(int argc, char *argv[]) {
-    printf("NOTE: use --benchmark_filter=<regex> to select specific benchmarks (e.g. \"Mat4.*\")\n\n");
+    // stderr, so --benchmark_format=json writes nothing but JSON to stdout
+    fprintf(stderr, "NOTE: use --benchmark_filter=<regex> to select specific benchmarks (e.g. \"Mat4.*\")\n");
+    fprintf(stderr, "      use --benchmark_format=json or --benchmark_out=<file> to track the results (e.g. \"Scene_.*\")\n\n");
+
+    // started without arguments (from the IDE or by double click), keep the console open at the end
+    bool wait = (argc <= 1);
+
+    RegisterSceneBenchmarks();
     benchmark::Initialize(&argc, argv);
     benchmark::RunSpecifiedBenchmarks();
-    printf("\npress any key to exit...\n");
-    getchar();
+    if (wait) {
+        printf("\npress any key to exit...\n");
+        getchar();
+    }
     return 0;
 }
\ No newline at end of file
@@ -26,6 +26,8 @@
     // NOTE: run with --benchmark_filter=<regex> to filter at runtime
     #define ENABLE_BENCH_VEC3
     #define ENABLE_BENCH_MAT4
+    #define ENABLE_BENCH_BVH
+    #define ENABLE_BENCH_SCENE
 #else
     #undef IACA_START
     #undef IACA_END
@@ -35,4 +37,6 @@
 
 extern uint32 threads;
 
+void RegisterSceneBenchmarks(); // see bench_scene.cpp
+
 #define BENCHMARK_MRT(name, var) BENCHMARK_TEMPLATE(name, var)->Repetitions(4)->ReportAggregatesOnly()->Threads(threads)
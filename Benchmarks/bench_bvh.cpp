@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "wide_bvh.h"
+#include "obj_loader.h"
+#include "pcg.h"
+
+#define NUM_RAYS (1024)
+
+enum BVH_Variants {
+    BVH_Midpoint,
+    BVH_SAH,
+    BVH_Wide4, // collapsed from the SAH tree
+    BVH_Wide8
+};
+
+template<BVH_Variants I>
+static std::unique_ptr<scene_object> BuildBVH(triangle *mesh, size_t tris, uint32 *node_count) {
+    if constexpr (I == BVH_Wide4 || I == BVH_Wide8) {
+        auto bvh = std::make_unique<wide_bvh<triangle, (I == BVH_Wide4) ? 4 : 8>>(mesh, tris, 0.0f, 1.0f);
+        *node_count = bvh->get_node_count();
+        return bvh;
+    }
+    else {
+        auto bvh = std::make_unique<pod_bvh<triangle>>(mesh, tris, 0.0f, 1.0f, (I == BVH_SAH) ? BVH_BUILD_SAH : BVH_BUILD_MIDPOINT);
+        *node_count = bvh->get_node_count();
+        return bvh;
+    }
+}
+
+// same transform as the bunny in the triangles scene
+static std::unique_ptr<triangle[]> LoadBunny(size_t *tris) {
+    return readObj("../obj/bunny.obj", nullptr, tris, true, Mat4::Scale(2000.0f), Vec3(195, -20, 280));
+}
+
+template<BVH_Variants I>
+static void BVH_Build(benchmark::State& state) {
+    size_t tris = 0;
+    std::unique_ptr<triangle[]> mesh = LoadBunny(&tris);
+    if (!mesh || !tris) {
+        state.SkipWithError("could not load ../obj/bunny.obj");
+        return;
+    }
+    uint32 node_count = 0;
+    for (auto _ : state) {
+        std::unique_ptr<scene_object> bvh = BuildBVH<I>(mesh.get(), tris, &node_count);
+        benchmark::DoNotOptimize(node_count);
+    }
+    state.SetItemsProcessed(state.iterations() * tris);
+}
+
+template<BVH_Variants I>
+static void BVH_Traverse(benchmark::State& state) {
+    Init_Thread_RNG(0x1234567890ABCDEF, 0xFEDCBA0987654321);
+
+    size_t tris = 0;
+    std::unique_ptr<triangle[]> mesh = LoadBunny(&tris);
+    if (!mesh || !tris) {
+        state.SkipWithError("could not load ../obj/bunny.obj");
+        return;
+    }
+    uint32 node_count = 0;
+    std::unique_ptr<scene_object> bvh = BuildBVH<I>(mesh.get(), tris, &node_count);
+    state.counters["nodes"] = node_count;
+
+    aabb box;
+    bvh->bounding_box(&box, 0, 1);
+    Vec3 center = box.center();
+    float radius = 2.0f * box.extent().length();
+
+    // rays from a sphere around the mesh towards random points inside the bounding box, so most of them hit
+    ray *rays = new ray[NUM_RAYS];
+    for (size_t i = 0; i < NUM_RAYS; i++) {
+        Vec3 origin = center + radius * random_on_sphere_uniform();
+        Vec3 target = box.min + Vec3(randf(), randf(), randf()) * (box.max - box.min);
+        rays[i] = ray(origin, target - origin, 0.0f);
+    }
+
+    size_t hits = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < NUM_RAYS; i++) {
+            hit_record rec;
+            hits += bvh->hit(rays[i], 0.001f, std::numeric_limits<float>::max(), &rec);
+        }
+    }
+    benchmark::DoNotOptimize(hits);
+    state.SetItemsProcessed(state.iterations() * NUM_RAYS);
+    delete[] rays;
+}
+
+#if !defined(ENABLE_IACA) || defined(ENABLE_BENCH_BVH)
+BENCHMARK_TEMPLATE(BVH_Build, BVH_Midpoint)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BVH_Build, BVH_SAH)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BVH_Build, BVH_Wide4)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BVH_Build, BVH_Wide8)->Unit(benchmark::kMillisecond);
+BENCHMARK_MRT(BVH_Traverse, BVH_Midpoint);
+BENCHMARK_MRT(BVH_Traverse, BVH_SAH);
+BENCHMARK_MRT(BVH_Traverse, BVH_Wide4);
+BENCHMARK_MRT(BVH_Traverse, BVH_Wide8);
+#endif
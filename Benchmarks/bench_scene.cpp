@@ -0,0 +1,180 @@
+#include "bench.h"
+#include "scene.h"
+#include "compiled_scene.h"
+#include "all_scene_objects.h"
+#include "material.h"
+#include "path.h"
+#include "pcg.h"
+#include "sampler.h"
+#include "platform.h"
+#include "stats.h"
+#include "cmdline_parser.h"
+#include <string>
+
+// Render benchmarks for every scene in the scenes enum, the numbers to track per commit:
+//   Scene_Build   scene generation and BVH builds (the bvh_ms counter, compiled scene included)
+//   Scene_Primary camera rays only, one per pixel
+//   Scene_Path    full paths with trace_path() (path.h), the integrator of main.cpp, at SCENE_SPP samples per pixel
+// All of them render the same pixels with fixed seeds and the benchmark thread count, so only the code changes the results.
+// Run with --benchmark_format=json or --benchmark_out=<file> for machine readable output, e.g. --benchmark_filter="Scene_.*"
+
+#define SCENE_WIDTH  (160)
+#define SCENE_HEIGHT (90)
+#define SCENE_SPP    (4)
+#define NUM_HIT_RAYS (1024)
+
+// the scenes are generated once and shared by the render benchmarks, like render server jobs share them
+static scene scene_cache[ENUM_SCENES_MAX];
+
+static scene generate(scenes choose) {
+    Init_Thread_RNG(11350390909718046443uLL, 6305599193148252115uLL); // same seed as the renderer
+    scene s = select_scene(choose, float(SCENE_WIDTH) / float(SCENE_HEIGHT));
+    s.objects = new compiled_scene(s.objects, s.camera->time0, s.camera->time1);
+    return s;
+}
+
+// runs once before the benchmark threads start
+static void Scene_Setup(const benchmark::State& state) {
+    scenes choose = (scenes) state.range(0);
+    getParams()->sceneSelect = choose; // the integrator takes the background from here
+    Init_Sampler(SAMPLER_SOBOL_OWEN);
+    if (!scene_cache[choose].objects) {
+        scene_cache[choose] = generate(choose);
+    }
+}
+
+static void Scene_Build(benchmark::State& state) {
+    scenes choose = (scenes) state.range(0);
+
+    uint64 bvh_ticks = 0;
+    for (auto _ : state) {
+        uint64 start = G_bvhBuildTicks;
+        scene s = generate(choose); // NOTE: leaks, scenes are never freed in the renderer either
+        bvh_ticks += G_bvhBuildTicks - start;
+        benchmark::DoNotOptimize(s.objects);
+    }
+    state.counters["bvh_ms"] = benchmark::Counter(1000.0 * MRT_TimeDelta(0, bvh_ticks), benchmark::Counter::kAvgIterations);
+}
+
+// each benchmark thread takes every n-th row
+static void Scene_Primary(benchmark::State& state) {
+    const scene& s = scene_cache[state.range(0)];
+
+    size_t rays = 0;
+    size_t hits = 0;
+    for (auto _ : state) {
+        Init_Thread_RNG(0x1234567890ABCDEF, state.thread_index());
+        for (uint32 y = state.thread_index(); y < SCENE_HEIGHT; y += state.threads()) {
+            for (uint32 x = 0; x < SCENE_WIDTH; x++) {
+                start_sample(x + y * SCENE_WIDTH, 0);
+                vec2 offset = sample_2d();
+                ray r = s.camera->get_ray((x + offset.x) / SCENE_WIDTH, (y + offset.y) / SCENE_HEIGHT);
+
+                hit_record rec;
+                hits += s.objects->hit(r, 0.001f, std::numeric_limits<float>::max(), &rec);
+                rays++;
+            }
+        }
+    }
+    benchmark::DoNotOptimize(hits);
+    state.SetItemsProcessed(rays);
+}
+
+static void Scene_Path(benchmark::State& state) {
+    const scene& s = scene_cache[state.range(0)];
+
+    // trace_path() counts its rays in the stats of the thread
+    const thread_stats& stats = get_thread_stats();
+    uint64 rays = stats.ray_count();
+    size_t paths = 0;
+    Vec3 sum(0.0f);
+    for (auto _ : state) {
+        Init_Thread_RNG(0x1234567890ABCDEF, state.thread_index());
+        for (uint32 y = state.thread_index(); y < SCENE_HEIGHT; y += state.threads()) {
+            for (uint32 x = 0; x < SCENE_WIDTH; x++) {
+                for (uint32 i = 0; i < SCENE_SPP; i++) {
+                    start_sample(x + y * SCENE_WIDTH, i);
+                    vec2 offset = sample_2d();
+                    path_state path(s.camera->get_ray((x + offset.x) / SCENE_WIDTH, (y + offset.y) / SCENE_HEIGHT));
+                    sum += trace_path(&path, s);
+                    paths++;
+                }
+            }
+        }
+    }
+    benchmark::DoNotOptimize(sum);
+    rays = stats.ray_count() - rays;
+    state.SetItemsProcessed(rays);
+    state.counters["rays_per_path"] = benchmark::Counter(double(rays) / double(paths), benchmark::Counter::kAvgThreads);
+}
+
+enum Prim_Variants {
+    Prim_Sphere,
+    Prim_MovingSphere,
+    Prim_Rect,
+    Prim_Box,
+    Prim_Triangle,
+};
+
+template<Prim_Variants I>
+static std::unique_ptr<scene_object> BuildPrim(material *mat) {
+    switch (I) {
+    case Prim_Sphere:       return std::make_unique<sphere>(Vec3(0, 0, 0), 1.0f, mat);
+    case Prim_MovingSphere: return std::make_unique<sphere>(Vec3(0, 0, 0), 1.0f, mat, Vec3(0, 0.5f, 0), 0.0f, 1.0f);
+    case Prim_Rect:         return std::make_unique<xy_rect>(-1.0f, 1.0f, -1.0f, 1.0f, 0.0f, mat);
+    case Prim_Box:          return std::make_unique<box>(Vec3(-1.0f), Vec3(1.0f), mat);
+    default:                return std::make_unique<triangle_scene_object>(Vec3(-1, -1, 0), Vec3(1, -1, 0), Vec3(0, 1, 0), mat);
+    }
+}
+
+// hit() of a single primitive, rays from a sphere around it towards random points in its bounding box
+template<Prim_Variants I>
+static void Prim_Hit(benchmark::State& state) {
+    Init_Thread_RNG(0x1234567890ABCDEF, 0xFEDCBA0987654321);
+
+    lambertian mat(nullptr);
+    std::unique_ptr<scene_object> prim = BuildPrim<I>(&mat);
+
+    aabb box;
+    prim->bounding_box(&box, 0, 1);
+    Vec3 center = box.center();
+    float radius = 2.0f * box.extent().length();
+
+    ray *rays = new ray[NUM_HIT_RAYS];
+    for (size_t i = 0; i < NUM_HIT_RAYS; i++) {
+        Vec3 origin = center + radius * random_on_sphere_uniform();
+        Vec3 target = box.min + Vec3(randf(), randf(), randf()) * (box.max - box.min);
+        rays[i] = ray(origin, target - origin, randf());
+    }
+
+    size_t hits = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < NUM_HIT_RAYS; i++) {
+            hit_record rec;
+            hits += prim->hit(rays[i], 0.001f, std::numeric_limits<float>::max(), &rec);
+        }
+    }
+    benchmark::DoNotOptimize(hits);
+    state.SetItemsProcessed(state.iterations() * NUM_HIT_RAYS);
+    delete[] rays;
+}
+
+// registered from main(), threads might not be initialized yet during the static initialization of this file
+void RegisterSceneBenchmarks() {
+#if !defined(ENABLE_IACA) || defined(ENABLE_BENCH_SCENE)
+    for (uint32 i = 0; i < ENUM_SCENES_MAX; i++) {
+        std::string name = scene_name(scenes(i));
+        benchmark::RegisterBenchmark(("Scene_Build/" + name).c_str(), Scene_Build)->Arg(i)->Iterations(1)->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Scene_Primary/" + name).c_str(), Scene_Primary)->Arg(i)->Setup(Scene_Setup)->Threads(threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Scene_Path/" + name).c_str(), Scene_Path)->Arg(i)->Setup(Scene_Setup)->Threads(threads)->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+#endif
+}
+
+#if !defined(ENABLE_IACA) || defined(ENABLE_BENCH_SCENE)
+BENCHMARK_TEMPLATE(Prim_Hit, Prim_Sphere);
+BENCHMARK_TEMPLATE(Prim_Hit, Prim_MovingSphere);
+BENCHMARK_TEMPLATE(Prim_Hit, Prim_Rect);
+BENCHMARK_TEMPLATE(Prim_Hit, Prim_Box);
+BENCHMARK_TEMPLATE(Prim_Hit, Prim_Triangle);
+#endif
@@ -11,11 +11,15 @@ for f in ../*.cpp; do
         fi
     else
         # include all other files except main.cpp
-        if [ "$f" != "main.cpp" ]; then
+        if [ "$f" != "../main.cpp" ]; then
             files="$files $f"
         fi
     fi
 done
+# and the benchmarks themselves
+for f in *.cpp; do
+    files="$files $f"
+done
 
 # more generic alternative with newer bash version?
     # regex='.*platform_(.*)'
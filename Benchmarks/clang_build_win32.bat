@@ -19,6 +19,10 @@ for %%a in (../*.cpp) do (
         )
     )
 )
+REM and the benchmarks themselves
+for %%a in (*.cpp) do (
+    call SET files=%%files%% %%a
+)
 
 
 SET fixVCRT=-D_MT -D_DLL -lmsvcrt -lucrt -lmsvcprt -lvcruntime -Xlinker /NODEFAULTLIB
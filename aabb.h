@@ -3,7 +3,9 @@
 #include "common.h"
 #include "vec3.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include <algorithm> // std::swap, std::min/max
+#include <limits>
 
 
 class aabb {
@@ -16,12 +18,101 @@ public:
     // min must be < max in all dimensions
     aabb(const Vec3& min, const Vec3& max) : min(min), max(max) {}
 
+    // inverted box that any grow() call will overwrite
+    static aabb empty() {
+        constexpr float maxf = std::numeric_limits<float>::max();
+        constexpr float minf = std::numeric_limits<float>::lowest();
+        return aabb(Vec3(maxf, maxf, maxf), Vec3(minf, minf, minf));
+    }
+
     Vec3 center() const {
         return (max + min) * 0.5f;
     }
     Vec3 extent() const {
         return (max - min) * 0.5f;
     }
+    // half the surface area, which is all the SAH needs
+    float half_area() const {
+        Vec3 e = max - min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+    void grow(const Vec3& p) {
+        min = vmin(min, p);
+        max = vmax(max, p);
+    }
+    void grow(const aabb& b) {
+        min = vmin(min, b.min);
+        max = vmax(max, b.max);
+    }
+
+    // returns the distance at which the ray enters the box or FLT_MAX on a miss,
+    // invDir is passed in so traversal kernels only have to compute it once per ray
+    float hit_dist(const Vec3& origin, const Vec3& invDir, float tmin, float tmax) const {
+        m128 t0 = ((min - origin) * invDir).m;
+        m128 t1 = ((max - origin) * invDir).m;
+
+        m128 tnear = _mm_min_ps(t0, t1);
+        m128 tfar  = _mm_max_ps(t0, t1);
+
+        // same reduction as in hit(), tmin/tmax go into the W component
+        tnear = _mm_insert_ps(tnear, _mm_set_ss(tmin), 3 << 4);
+        tfar  = _mm_insert_ps(tfar,  _mm_set_ss(tmax), 3 << 4);
+
+        m128 tnear_zw = _mm_permute_ps(tnear, _MM_SHUFFLE(0, 0, W, Z));
+        m128 tfar_zw  = _mm_permute_ps(tfar,  _MM_SHUFFLE(0, 0, W, Z));
+        tnear = _mm_max_ps(tnear, tnear_zw);
+        tfar  = _mm_min_ps(tfar,  tfar_zw);
+        tnear = _mm_max_ss(tnear, _mm_permute_ps(tnear, _MM_SHUFFLE(0, 0, 0, Y)));
+        tfar  = _mm_min_ss(tfar,  _mm_permute_ps(tfar,  _MM_SHUFFLE(0, 0, 0, Y)));
+
+        // >= instead of > so that flat boxes (e.g. from axis aligned triangles) can still be hit
+        return (tfar.f32[0] >= tnear.f32[0]) ? tnear.f32[0] : std::numeric_limits<float>::max();
+    }
+    // tests the rays in mask against the box, tmax[] holds the closest hit so far of every ray in the packet,
+    // returns the rays that hit and optionally the closest entry distance among them (for front to back traversal)
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, const float tmax[], float *near_dist = nullptr) const {
+        const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+
+        __m128 min_x = _mm_set1_ps(min.x), min_y = _mm_set1_ps(min.y), min_z = _mm_set1_ps(min.z);
+        __m128 max_x = _mm_set1_ps(max.x), max_y = _mm_set1_ps(max.y), max_z = _mm_set1_ps(max.z);
+        __m128 closest = _mm_set1_ps(std::numeric_limits<float>::max());
+
+        uint32 hits = 0;
+        for (int i = 0; i < RAY_PACKET_SIZE; i += 4)
+        {
+            uint32 chunk = (mask >> i) & 0xF;
+            if (!chunk) continue;
+
+            __m128 ox = _mm_load_ps(&rp.ox[i]), oy = _mm_load_ps(&rp.oy[i]), oz = _mm_load_ps(&rp.oz[i]);
+            __m128 ix = _mm_load_ps(&rp.ix[i]), iy = _mm_load_ps(&rp.iy[i]), iz = _mm_load_ps(&rp.iz[i]);
+
+            __m128 t0x = _mm_mul_ps(_mm_sub_ps(min_x, ox), ix);
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(max_x, ox), ix);
+            __m128 t0y = _mm_mul_ps(_mm_sub_ps(min_y, oy), iy);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(max_y, oy), iy);
+            __m128 t0z = _mm_mul_ps(_mm_sub_ps(min_z, oz), iz);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(max_z, oz), iz);
+
+            __m128 tnear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                      _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tmin)));
+            __m128 tfar  = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                      _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_loadu_ps(&tmax[i])));
+
+            // only count active rays, inactive lanes may contain anything
+            __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(chunk), lanes), lanes));
+            __m128 hit = _mm_and_ps(_mm_cmple_ps(tnear, tfar), active);
+
+            hits |= _mm_movemask_ps(hit) << i;
+            closest = _mm_min_ps(closest, _mm_blendv_ps(closest, tnear, hit));
+        }
+
+        if (near_dist) {
+            closest = _mm_min_ps(closest, _mm_permute_ps(closest, _MM_SHUFFLE(1, 0, 3, 2)));
+            closest = _mm_min_ps(closest, _mm_permute_ps(closest, _MM_SHUFFLE(2, 3, 0, 1)));
+            *near_dist = _mm_cvtss_f32(closest);
+        }
+        return hits;
+    }
     bool hit(const ray& r, float tmin, float tmax) const {
 #if 0
         for (size_t axis = 0; axis < 3; axis++) {
@@ -108,4 +199,36 @@ public:
 
 inline aabb surrounding_box(const aabb& a, const aabb& b) {
     return aabb(vmin(a.min, b.min), vmax(a.max, b.max));
-}
\ No newline at end of file
+}
+
+// box at fraction f of the way from a to b, contains everything that moves linearly from inside a to inside b
+inline aabb lerp_box(const aabb& a, const aabb& b, float f) {
+    return aabb(a.min + f * (b.min - a.min), a.max + f * (b.max - a.max));
+}
+
+inline bool same_box(const aabb& a, const aabb& b) {
+    m128 eq = _mm_and_ps(_mm_cmpeq_ps(a.min.m, b.min.m), _mm_cmpeq_ps(a.max.m, b.max.m));
+    return (_mm_movemask_ps(eq) & 0x7) == 0x7;
+}
+
+// Bounds at the start and end of the shutter interval. Moving objects only occupy a small part of the box
+// over the whole interval at any given time, so nodes that move are tested against the box at the ray time.
+struct motion_aabb {
+    aabb box0, box1;
+    float time0;
+    float inv_duration;
+    bool moving = false;
+
+    motion_aabb() {}
+    motion_aabb(const aabb& box0, const aabb& box1, float time0, float time1)
+        : box0(box0), box1(box1), time0(time0), inv_duration(time1 > time0 ? 1.0f / (time1 - time0) : 0.0f) {
+        moving = time1 > time0 && !same_box(box0, box1);
+    }
+
+    aabb at(float time) const {
+        return lerp_box(box0, box1, (time - time0) * inv_duration);
+    }
+    aabb over(float t0, float t1) const {
+        return surrounding_box(at(t0), at(t1));
+    }
+};
\ No newline at end of file
@@ -2,7 +2,11 @@
 
 #include "scene_object.h"
 #include "triangle.h"
+#include "wide_bvh.h"
 #include "sphere.h"
 #include "box.h"
 #include "rect.h"
 #include "volumes.h"
+#include "compiled_scene.h"
+#include "mesh.h"
+#include "instance.h"
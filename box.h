@@ -27,5 +27,11 @@ public:
         *box = aabb(min, max);
         return true;
     }
+    bool lower(scene_compiler *c) const override {
+        return rect_list->lower(c);
+    }
+    void add_lights(light_list *lights) override {
+        rect_list->add_lights(lights);
+    }
     
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "ray.h"
-#include "pcg.h"
+#include "sampler.h"
 
 class camera {
 public:
@@ -11,7 +11,9 @@ public:
     Vec3 horz;
     Vec3 vert;
     float lens_radius;
+    float focus_dist;
     float time0, time1; // shutter open/close times
+    Vec3 world_up;
 
     camera(const Vec3& pos, const Vec3& lookat, const Vec3& up, float vfov, float aspect, float aperture, float focus_dist, float shutter_t0, float shutter_t1) {
 
@@ -23,11 +25,13 @@ public:
         float width = aspect * height;
 
         origin = pos;
+        world_up = up;
         w = (pos - lookat).normalize();
         u = cross(up, w).normalize();
         v = cross(w, u);
 
         lens_radius = aperture / 2.0f;
+        this->focus_dist = focus_dist;
 
         horz = focus_dist * width * u;
         vert = focus_dist * height * v;
@@ -35,12 +39,41 @@ public:
 
     }
 
+    // interactive mode: offset is in camera space (x right, y up, z backwards), yaw turns around the world up axis,
+    // pitch around the camera x axis and stops short of looking straight up or down
+    void move(const Vec3& offset, float yaw, float pitch) {
+        origin += offset.x * u + offset.y * v + offset.z * w;
+
+        Vec3 up = normalize(world_up);
+        Vec3 new_w = rotate(rotate(w, up, yaw), u, pitch);
+        if (fabsf(dot(new_w, up)) > 0.99f)
+            new_w = rotate(w, up, yaw);
+
+        float width = horz.length();
+        float height = vert.length();
+        w = normalize(new_w);
+        u = cross(world_up, w).normalize();
+        v = cross(w, u);
+
+        horz = width * u;
+        vert = height * v;
+        llcorner = origin - 0.5f * horz - 0.5f * vert - focus_dist*w;
+    }
+
     ray get_ray(float s, float t) const {
-        Vec3 rd = lens_radius * random_in_disk();
+        Vec3 rd = lens_radius * sample_disk();
         Vec3 offset = u * rd.x + v * rd.y;
-        float time = time0 + (time1 - time0) * randf();
+        float time = time0 + (time1 - time0) * sample_1d();
 
         ray ray(origin + offset, llcorner + s * horz + t * vert - origin - offset, time);
         return ray;
     }
+
+private:
+    // Rodrigues' rotation of a around the unit vector axis
+    static Vec3 rotate(const Vec3& a, const Vec3& axis, float radians) {
+        float c = cosf(radians);
+        float s = sinf(radians);
+        return a * c + cross(axis, a) * s + axis * (dot(axis, a) * (1.0f - c));
+    }
 };
\ No newline at end of file
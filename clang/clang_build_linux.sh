@@ -26,6 +26,17 @@ warns="-Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -Wno-
 opts="-m64 -g -O3 -march=native"
 misc="-fno-exceptions -fno-rtti -DBENCHMARK_STATIC_DEFINE"
 
+# "./clang_build_linux.sh headless" builds without SDL for machines without a display (batch rendering with -output only)
+# "./clang_build_linux.sh stats" adds the BVH, primitive and stage counters to the -stats report (see stats.h), both can be combined
+for arg in "$@"; do
+    if [ "$arg" = "headless" ]; then
+        libs="-lpthread"
+        misc="$misc -DMRT_HEADLESS"
+    elif [ "$arg" = "stats" ]; then
+        misc="$misc -DMRT_STATS=1"
+    fi
+done
+
 clang++ -std=c++20 $opts $dirs $libs $warns $misc -o MiniRayTracer $files
 
 # optional asm output
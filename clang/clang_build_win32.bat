@@ -24,6 +24,9 @@ SET warns=-Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers
 SET opts=-m64 -O3 -march=native
 SET misc=-fno-exceptions -fno-rtti -D_CRT_SECURE_NO_WARNINGS -DBENCHMARK_STATIC_DEFINE -D_ENABLE_EXTENDED_ALIGNED_STORAGE -Xclang -flto-visibility-public-std
 
+REM "clang_build_win32.bat stats" adds the BVH, primitive and stage counters to the -stats report (see stats.h)
+if "%1"=="stats" SET misc=%misc% -DMRT_STATS=1
+
 REM C++14 is required if compiling with the Visual Studio 2017 headers
 clang++ -std=c++20 %opts% %dirs% %libs% %warns% %misc% -o MiniRayTracer.exe %files%
 
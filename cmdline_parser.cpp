@@ -36,11 +36,18 @@ constexpr char* std::numeric_limits<char*>::max() noexcept {
     return __builtin_constant_p((char*) UINTPTR_MAX) ? (char*) UINTPTR_MAX : (char*) UINTPTR_MAX;
 }
 
+// compares a command line argument with a parameter name, "--name" is accepted for "-name" as well
+static bool MatchParameter(const char *parameter, const char *arg) {
+    if (arg[0] == '-' && arg[1] == '-' && parameter[1] != '-')
+        arg++;
+    return strcmp(parameter, arg) == 0;
+}
+
 // tries to read a parameter from the command line
 template<typename T>
 int ReadParameter(int argc, char *argv[], const char *parameter, T *res_p, T min, T max) {
     for (int i = 1; i < argc; i++) {
-        if (strcmp(parameter, argv[i]) == 0) {
+        if (MatchParameter(parameter, argv[i])) {
 
             if ((i + 1) == argc) {
                 std::cout << "Warning: Missing value for parameter '" << parameter << "'." << std::endl;
@@ -63,7 +70,7 @@ int ReadParameter(int argc, char *argv[], const char *parameter, T *res_p, T min
 
 int CheckParameter(int argc, char *argv[], const char *parameter) {
     for (int i = 1; i < argc; i++) {
-        if (strcmp(parameter, argv[i]) == 0) {
+        if (MatchParameter(parameter, argv[i])) {
             return i;
         }
     }
@@ -86,6 +93,28 @@ void ParseArgv(int argc, char** argv) {
     }
 
     MRT_Params p;
+    ParseParams(argc, argv, &p);
+    ReadParameter(argc, argv, "-server", &p.serverAddress);
+    if (!p.serverAddress && ReadParameter(argc, argv, "-heatmap", &p.heatmapPrefix)) {
+        // the costs are measured per pixel, packets and the wavefront integrator work on many pixels at once
+        p.rayPackets = 0;
+        p.wavefront = 0;
+    }
+    p.headless = (p.outputFile || p.outputFileHDR || p.serverAddress || p.heatmapPrefix);
+
+    if (CheckParameter(argc, argv, "-interactive") && !p.headless) {
+        p.interactive = true;
+        // the first sample pass is a preview, which needs every tile to go through the samples in order
+        if (p.threadingMode == 0)
+            p.threadingMode = 1;
+    }
+
+    G_params = p;
+}
+
+void ParseParams(int argc, char** argv, MRT_Params *out) {
+
+    MRT_Params &p = *out;
 
     if (ReadParameter(argc, argv, "-width" , &p.windowWidth , 1u))
         p.bufferWidth  = p.windowWidth;
@@ -93,17 +122,37 @@ void ParseArgv(int argc, char** argv) {
         p.bufferHeight = p.windowHeight;
 
     ReadParameter(argc, argv, "-samples",  &p.samplesPerPixel, 1u);
+    ReadParameter(argc, argv, "-sampler",  &p.samplerType, 0u, ENUM_SAMPLERS_MAX - 1u);
     ReadParameter(argc, argv, "-tilesize", &p.tileSize, 1u);
     ReadParameter(argc, argv, "-threads",  &p.numThreads);
     ReadParameter(argc, argv, "-depth",    &p.maxBounces);
+    ReadParameter(argc, argv, "-diffuse-depth",  &p.maxDiffuseBounces);
+    ReadParameter(argc, argv, "-specular-depth", &p.maxSpecularBounces);
+    ReadParameter(argc, argv, "-transmission-depth", &p.maxTransmissionBounces);
+    ReadParameter(argc, argv, "-rr-depth", &p.rouletteDepth);
     ReadParameter(argc, argv, "-scene",    &p.sceneSelect, 0u, ENUM_SCENES_MAX - 1u);
-    ReadParameter(argc, argv, "-mode",     &p.threadingMode, 0u, 1u);
+    ReadParameter(argc, argv, "-mode",     &p.threadingMode, 0u, 2u);
     ReadParameter(argc, argv, "-maxlum",   &p.maxLuminance);
+    ReadParameter(argc, argv, "-tonemap",  &p.tonemapOperator, 0u, ENUM_TONEMAP_MAX - 1u);
+    ReadParameter(argc, argv, "-packets",  &p.rayPackets, 0u, 1u);
+    ReadParameter(argc, argv, "-wavefront", &p.wavefront, 0u, 1u);
+    ReadParameter(argc, argv, "-compile",  &p.compileScene, 0u, 1u);
+    ReadParameter(argc, argv, "-noise-threshold", &p.noiseThreshold, 0.0f);
+    ReadParameter(argc, argv, "-max-spp", &p.maxSamples, 1u);
+
+    if (p.noiseThreshold > 0 && p.threadingMode != 2) {
+        std::cout << "Warning: Adaptive sampling (-noise-threshold) requires -mode 2, disabled." << std::endl;
+        p.noiseThreshold = 0;
+    }
 
     if (CheckParameter(argc, argv, "-delay"))
         p.delay = true;
+    if (CheckParameter(argc, argv, "-stats"))
+        p.printStats = true;
+    ReadParameter(argc, argv, "-stats-json", &p.statsFile);
 
-    G_params = p;
+    ReadParameter(argc, argv, "-output",     &p.outputFile);
+    ReadParameter(argc, argv, "-output-hdr", &p.outputFileHDR);
 }
 
 
@@ -113,12 +162,30 @@ void PrintCmdLineHelp() {
            "  -width    \t<value>\t\tWindow width\n" \
            "  -height   \t<value>\t\tWindow height\n" \
            "  -samples  \t<value>\t\tSamples per pixel\n" \
+           "  -sampler  \t[0, 2]\t\tSample generator (0 for random, 1 for Sobol, 2 for Owen-scrambled Sobol)\n" \
            "  -depth    \t<value>\t\tMaximum bounce depth per primary ray\n" \
+           "  -diffuse-depth <value>\tMaximum diffuse bounces per primary ray\n" \
+           "  -specular-depth <value>\tMaximum specular reflections per primary ray\n" \
+           "  -transmission-depth <value>\tMaximum refractions per primary ray\n" \
+           "  -rr-depth \t<value>\t\tBounces before Russian roulette starts ending dim paths\n" \
            "  -maxlum   \t<value>\t\tClamp maximum luminance (introduces bias)\n" \
+           "  -tonemap  \t[0, 3]\t\tTone mapping (0 for logarithmic, 1 for Reinhard, 2 for ACES, 3 for gamma correction only)\n" \
            "  -threads  \t<value>\t\tNumber of execution threads (0 selects maximum hardware threads)\n" \
            "  -tilesize \t<value>\t\tSize of image tiles (threads operate on tiles)\n" \
-           "  -mode     \t[0, 1]\t\tThreading/queue mode (0 for sequential, 1 for dynamic sampling)\n" \
+           "  -mode     \t[0, 2]\t\tThreading/queue mode (0 for sequential, 1 for dynamic sampling, 2 for dynamic sampling with work stealing)\n" \
            "  -scene    \t[0, %i]\t\tSelect the scene\n" \
-           "  -delay    \t\t\tDelay start until keypress\n", ENUM_SCENES_MAX - 1);
+           "  -packets  \t[0, 1]\t\tTrace camera rays in packets of neighbouring rays\n" \
+           "  -wavefront\t[0, 1]\t\tTrace tiles bounce by bounce with the wavefront integrator (ignores -packets)\n" \
+           "  -compile  \t[0, 1]\t\tFlatten the scene into a single BVH before rendering\n" \
+           "  -noise-threshold <value>\tAdaptive sampling: stop tiles below this relative error (mode 2 only)\n" \
+           "  -max-spp  \t<value>\t\tAdaptive sampling: samples per pixel for noisy tiles (default: -samples)\n" \
+           "  -delay    \t\t\tDelay start until keypress\n" \
+           "  -interactive\t\t\tMove the camera with WASD/QE and by dragging with the left mouse button, restarts rendering\n" \
+           "  -stats    \t\t\tPrint ray, traversal and timing counters after rendering (see stats.h)\n" \
+           "  -stats-json\t<file>\t\tWrite the same counters as JSON\n" \
+           "  -output   \t<file>\t\tRender without a window, write the image and exit (.png, .pfm or .exr)\n" \
+           "  -output-hdr\t<file>\t\tSame as -output, for writing a second (linear) image\n" \
+           "  -heatmap  \t<prefix>\tRender without a window and write BVH nodes, primitive tests, path length and time per pixel as images\n" \
+           "  -server   \t<address>\tRun as render server on a localhost TCP port or unix:<path>, takes jobs with the parameters above\n", ENUM_SCENES_MAX - 1);
     // TODO: find a commonly understood term for the threading modes
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include "common.h"
 #include "scene.h"
+#include "sampler.h"
+#include "tonemap.h"
 
 struct MRT_Params {
     uint32 windowWidth = 500;
@@ -8,16 +10,37 @@ struct MRT_Params {
     uint32 bufferWidth = windowWidth;
     uint32 bufferHeight = windowHeight;
     uint32 samplesPerPixel = 128;
+    uint32 samplerType = SAMPLER_SOBOL_OWEN;
     uint32 tileSize = 32;
     uint32 numThreads = 0; // 0 == automatic
     uint32 maxBounces = 32;
+    uint32 maxDiffuseBounces = 32;      // limits per kind of bounce on top of maxBounces (see path.h)
+    uint32 maxSpecularBounces = 32;
+    uint32 maxTransmissionBounces = 32;
+    uint32 rouletteDepth = 3;           // bounces before Russian roulette can end a path, >= maxBounces disables it
     uint32 sceneSelect = SCENE_TRIANGLES;
-    uint32 threadingMode = 1; // use mode=0 and threads=1 for a deterministic runtime test
-    float  maxLuminance = 1000; // luminance values can be clamped for faster convergence, but low values lead to bias
+    uint32 threadingMode = 2; // use mode=0 and threads=1 for a deterministic runtime test
+    uint32 rayPackets = 1;    // trace camera rays in packets (see ray_packet.h)
+    uint32 wavefront = 0;     // trace whole tiles bounce by bounce instead of recursively per pixel (see wavefront.h)
+    uint32 compileScene = 1;  // flatten the scene into a single BVH before rendering (see compiled_scene.h)
+    float  maxLuminance = 1000; // the luminance of every sample is clamped to this for faster convergence, low values lead to bias
+    uint32 tonemapOperator = TONEMAP_LOGMAP; // see tonemap.h
+    float  noiseThreshold = 0;  // adaptive sampling: tiles stop once their relative error is below this, 0 == disabled (mode 2 only)
+    uint32 maxSamples = 0;      // adaptive sampling: samples per pixel for tiles that do not converge, 0 == samplesPerPixel
     bool   delay = false; // delayed start for recording
+    bool   interactive = false; // window only: move the camera with WASD/QE and the left mouse button, restarts the accumulation
+    char  *outputFile = nullptr;    // batch mode: render without a window, write the image and exit
+    char  *outputFileHDR = nullptr; // same, but usually used for the linear buffer (.pfm/.exr)
+    bool   printStats = false;      // print the counters of stats.h after rendering
+    char  *statsFile = nullptr;     // same, as JSON into this file
+    char  *heatmapPrefix = nullptr; // batch mode: also write the cost of every pixel as images (see heatmap.h)
+    char  *serverAddress = nullptr; // render server: take jobs from this TCP port or unix:<path> (see render_server.h)
+    bool   headless = false;        // set if any output file or a server address is given
 };
 
 void ParseArgv(int argc, char** argv);
+// reads all parameters that are present on top of the values already in p, also used for render server jobs
+void ParseParams(int argc, char** argv, MRT_Params *p);
 MRT_Params *getParams();
 void PrintCmdLineHelp();
 
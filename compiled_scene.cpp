@@ -0,0 +1,120 @@
+#include "compiled_scene.h"
+#include "sphere.h"
+#include "rect.h"
+
+void compiled_prim::set_box(const aabb& box) {
+    for (int i = 0; i < 3; i++) {
+        box_min[i] = box.min[i];
+        box_max[i] = box.max[i];
+    }
+}
+
+void compiled_prim::add_to_box(aabb *box, float time) const {
+    switch (type) {
+    case PRIM_SPHERE: {
+        Vec3 center(sphere.center[0], sphere.center[1], sphere.center[2]);
+        Vec3 velocity(sphere.velocity[0], sphere.velocity[1], sphere.velocity[2]);
+        float r = MRT::abs(sphere.radius);
+        Vec3 c = center + (time - sphere.time0) * velocity;
+        box->grow(aabb(c - Vec3(r), c + Vec3(r)));
+        break;
+    }
+    case PRIM_OBJECT: {
+        aabb b;
+        object->bounding_box(&b, time, time);
+        box->grow(b);
+        break;
+    }
+    default:
+        add_to_box(box);
+        break;
+    }
+}
+
+bool compiled_prim::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    switch (type) {
+    case PRIM_SPHERE: {
+        Vec3 center(sphere.center[0], sphere.center[1], sphere.center[2]);
+        Vec3 velocity(sphere.velocity[0], sphere.velocity[1], sphere.velocity[2]);
+
+        // the BVH passes the closest hit so far, which hit_sphere() would overwrite on a miss
+        hit_record cur_rec;
+        if (hit_sphere(center + (r.time - sphere.time0) * velocity, sphere.radius, mat_ptr, r, tmin, tmax, &cur_rec)) {
+            *rec = cur_rec;
+            return true;
+        }
+        return false;
+    }
+    case PRIM_XY_RECT:
+        return hit_rect<2, 0, 1>(rect.k, rect.a0, rect.a1, rect.b0, rect.b1, rect.normal_sign, mat_ptr, r, tmin, tmax, rec);
+    case PRIM_XZ_RECT:
+        return hit_rect<1, 0, 2>(rect.k, rect.a0, rect.a1, rect.b0, rect.b1, rect.normal_sign, mat_ptr, r, tmin, tmax, rec);
+    case PRIM_YZ_RECT:
+        return hit_rect<0, 1, 2>(rect.k, rect.a0, rect.a1, rect.b0, rect.b1, rect.normal_sign, mat_ptr, r, tmin, tmax, rec);
+    case PRIM_OBJECT: {
+        hit_record cur_rec;
+        if (object->hit(r, tmin, tmax, &cur_rec)) {
+            *rec = cur_rec;
+            return true;
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+void lower_object(scene_compiler *c, const scene_object *obj) {
+    if (obj->lower(c))
+        return;
+
+    aabb box;
+    if (obj->bounding_box(&box, c->time0, c->time1)) {
+        compiled_prim p;
+        p.type = PRIM_OBJECT;
+        p.mat_ptr = nullptr;
+        p.object = obj;
+        p.set_box(box);
+        c->prims.push_back(p);
+    }
+    else {
+        c->unbounded.push_back(obj);
+    }
+}
+
+compiled_scene::compiled_scene(const scene_object *root, float time0, float time1) {
+    scene_compiler c;
+    c.time0 = time0;
+    c.time1 = time1;
+    lower_object(&c, root);
+
+    prim_count = c.prims.size();
+    if (prim_count > 0) {
+        bvh = std::make_unique<pod_bvh<compiled_prim>>(c.prims.data(), prim_count, time0, time1);
+    }
+    unbounded = std::move(c.unbounded);
+}
+
+bool compiled_scene::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    bool has_hit = false;
+    if (bvh && bvh->hit(r, tmin, tmax, rec)) {
+        has_hit = true;
+        tmax = rec->t;
+    }
+
+    hit_record cur_rec;
+    for (const scene_object *obj : unbounded) {
+        if (obj->hit(r, tmin, tmax, &cur_rec)) {
+            has_hit = true;
+            tmax = cur_rec.t;
+            *rec = cur_rec;
+        }
+    }
+    return has_hit;
+}
+
+bool compiled_scene::bounding_box(aabb *box, float time0, float time1) const {
+    if (!bvh || !unbounded.empty())
+        return false;
+    return bvh->bounding_box(box, time0, time1);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "scene_object.h"
+#include "triangle.h" // pod_bvh
+#include <vector>
+
+// Flattened copy of a scene_object tree for rendering. Lists, bvh_nodes and boxes are dissolved, spheres and rects are
+// stored by value in the leaves of a single pod_bvh and intersected through a switch instead of virtual calls.
+// Everything else (transforms, volumes, meshes with their own BVH) is kept as an object primitive that still calls hit().
+
+enum compiled_prim_type : uint32 {
+    PRIM_SPHERE,
+    PRIM_XY_RECT,
+    PRIM_XZ_RECT,
+    PRIM_YZ_RECT,
+    PRIM_OBJECT
+};
+
+struct compiled_prim {
+    compiled_prim_type type;
+    material *mat_ptr;
+    union {
+        struct {
+            float center[3];   // at time0
+            float velocity[3]; // per unit of time, 0 if not moving
+            float time0;
+            float radius;
+        } sphere;
+        struct {
+            float k, a0, a1, b0, b1;
+            float normal_sign;
+        } rect;
+        const scene_object *object;
+    };
+    float box_min[3];
+    float box_max[3];
+
+    bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const;
+    Vec3 get_centroid() const {
+        return 0.5f * (Vec3(box_min[0], box_min[1], box_min[2]) + Vec3(box_max[0], box_max[1], box_max[2]));
+    }
+    void add_to_box(aabb *box) const {
+        box->min = vmin(box->min, Vec3(box_min[0], box_min[1], box_min[2]));
+        box->max = vmax(box->max, Vec3(box_max[0], box_max[1], box_max[2]));
+    }
+    // box at a single point in time, moving spheres and objects only use a part of the box above
+    void add_to_box(aabb *box, float time) const;
+    void set_box(const aabb& box);
+};
+
+// collects the primitives while lowering, see scene_object::lower()
+struct scene_compiler {
+    std::vector<compiled_prim> prims;
+    std::vector<const scene_object*> unbounded; // objects without a bounding box are tested one by one
+    float time0;
+    float time1;
+};
+
+class compiled_scene final : public scene_object {
+    std::unique_ptr<pod_bvh<compiled_prim>> bvh;
+    std::vector<const scene_object*> unbounded;
+    size_t prim_count;
+public:
+    // root is referenced by the object primitives and must stay alive
+    compiled_scene(const scene_object *root, float time0, float time1);
+
+    bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    bool bounding_box(aabb *box, float time0, float time1) const override;
+    size_t get_prim_count() const { return prim_count; }
+};
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "heatmap.h"
+#include "stats.h"
+#include "vec3.h"
+#include "image_writer.h"
+
+static const char *channel_names[ENUM_HEAT_MAX] = {
+    "nodes",
+    "prims",
+    "depth",
+    "time",
+};
+
+void cost_probe::read(uint64 count[ENUM_HEAT_MAX]) {
+    const thread_stats& s = get_thread_stats();
+    count[HEAT_NODES] = s.nodes.load(std::memory_order_relaxed);
+    count[HEAT_PRIMS] = s.prim_tests.load(std::memory_order_relaxed);
+    count[HEAT_DEPTH] = s.ray_count() - s.shadow_rays.load(std::memory_order_relaxed);
+    count[HEAT_TIME]  = MRT_GetTime();
+}
+
+void cost_probe::add_to(pixel_cost *cost, uint32 samples) const {
+    uint64 now[ENUM_HEAT_MAX];
+    read(now);
+    for (uint32 i = 0; i < HEAT_TIME; i++) {
+        cost->value[i] += float(now[i] - count[i]);
+    }
+    cost->value[HEAT_TIME] += 1000000.0f * MRT_TimeDelta(count[HEAT_TIME], now[HEAT_TIME]);
+    cost->samples += samples;
+}
+
+// blue - cyan - green - yellow - red for t in [0, 1]
+static Vec3 false_color(float t) {
+    static const Vec3 ramp[5] = { Vec3(0, 0, 1), Vec3(0, 1, 1), Vec3(0, 1, 0), Vec3(1, 1, 0), Vec3(1, 0, 0) };
+    float x = std::min(std::max(t, 0.0f), 1.0f) * 4.0f;
+    uint32 i = std::min(uint32(x), 3u);
+    float f = x - i;
+    return ramp[i] * (1.0f - f) + ramp[i + 1] * f;
+}
+
+bool write_heatmaps(const char *prefix, const pixel_cost *costs, uint32 width, uint32 height) {
+    size_t count = size_t(width) * height;
+    std::vector<Vec3> values(count);
+    std::vector<float> sorted(count);
+    std::vector<uint32> colors(count);
+
+    bool ok = true;
+    for (uint32 c = 0; c < ENUM_HEAT_MAX; c++) {
+#if !MRT_STATS
+        if (c == HEAT_NODES || c == HEAT_PRIMS)
+            continue; // never counted
+#endif
+        for (size_t i = 0; i < count; i++) {
+            float v = costs[i].samples ? costs[i].value[c] / costs[i].samples : 0.0f;
+            values[i] = Vec3(v);
+            sorted[i] = v;
+        }
+
+        // a few extreme pixels would leave everything else blue, so they are clamped
+        size_t k = (count - 1) * 99 / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        float scale = sorted[k] > 0 ? 1.0f / sorted[k] : 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            colors[i] = ARGB32(false_color(values[i].x * scale));
+        }
+
+        char filename[512];
+        snprintf(filename, sizeof(filename), "%s-%s.pfm", prefix, channel_names[c]);
+        if (writePFM(filename, values.data(), width, height)) printf("Wrote %s\n", filename);
+        else ok = false;
+        snprintf(filename, sizeof(filename), "%s-%s.png", prefix, channel_names[c]);
+        if (writePNG(filename, colors.data(), width, height)) printf("Wrote %s (red: %g and above)\n", filename, sorted[k]);
+        else ok = false;
+    }
+    return ok;
+}
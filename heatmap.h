@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+// -heatmap <prefix>: debug render mode that writes what every pixel cost next to the image, to find the geometry a slow
+// scene spends its time on and to compare BVH builds on real rays:
+//   <prefix>-nodes  BVH nodes entered per sample (MRT_STATS builds only, see stats.h)
+//   <prefix>-prims  primitive tests per sample (MRT_STATS builds only)
+//   <prefix>-depth  path length, rays per sample without the shadow rays
+//   <prefix>-time   microseconds per sample
+// each one as .pfm with the values (the same in all three channels) and as .png in false colors, red is the 99th percentile.
+//
+// The costs are the differences of the counters of the rendering thread (see stats.h) before and after each pixel,
+// so the mode turns off ray packets and the wavefront integrator, which mix the work of many pixels.
+
+enum heatmap_channel : uint32 {
+    HEAT_NODES,
+    HEAT_PRIMS,
+    HEAT_DEPTH,
+    HEAT_TIME,
+    ENUM_HEAT_MAX
+};
+
+// sums over all samples of a pixel
+struct pixel_cost {
+    float value[ENUM_HEAT_MAX];
+    uint32 samples;
+};
+
+// counters of the calling thread when it started on a pixel
+class cost_probe {
+    uint64 count[ENUM_HEAT_MAX];
+    static void read(uint64 count[ENUM_HEAT_MAX]);
+public:
+    void start() { read(count); }
+    // adds what the thread did since start() to cost, as samples more samples of the pixel
+    void add_to(pixel_cost *cost, uint32 samples) const;
+};
+
+// costs has the layout of the backbuffers, false if any of the images could not be written
+bool write_heatmaps(const char *prefix, const pixel_cost *costs, uint32 width, uint32 height);
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "image_writer.h"
+#include "platform.h"
+
+static void put8(std::vector<uint8>& buf, uint8 v) {
+    buf.push_back(v);
+}
+
+static void put32be(std::vector<uint8>& buf, uint32 v) {
+    buf.push_back(uint8(v >> 24));
+    buf.push_back(uint8(v >> 16));
+    buf.push_back(uint8(v >> 8));
+    buf.push_back(uint8(v));
+}
+
+static void put32le(std::vector<uint8>& buf, uint32 v) {
+    buf.push_back(uint8(v));
+    buf.push_back(uint8(v >> 8));
+    buf.push_back(uint8(v >> 16));
+    buf.push_back(uint8(v >> 24));
+}
+
+static void put64le(std::vector<uint8>& buf, uint64 v) {
+    put32le(buf, uint32(v));
+    put32le(buf, uint32(v >> 32));
+}
+
+static void putf32le(std::vector<uint8>& buf, float f) {
+    uint32 v;
+    memcpy(&v, &f, sizeof(v));
+    put32le(buf, v);
+}
+
+static void putstr(std::vector<uint8>& buf, const char *str) {
+    buf.insert(buf.end(), str, str + strlen(str) + 1); // including null terminator
+}
+
+static bool writeFile(const char *filename, const std::vector<uint8>& buf) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        MRT_DebugPrint("Error: could not open '%s' for writing.\n", filename);
+        return false;
+    }
+    size_t written = fwrite(buf.data(), 1, buf.size(), f);
+    fclose(f);
+
+    if (written != buf.size()) {
+        MRT_DebugPrint("Error: could not write '%s'.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+static bool hasExtension(const char *filename, const char *ext) {
+    size_t len = strlen(filename);
+    size_t extLen = strlen(ext);
+    if (len < extLen) return false;
+
+    const char *a = filename + len - extLen;
+    for (size_t i = 0; i < extLen; i++) {
+        char c = a[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != ext[i]) return false;
+    }
+    return true;
+}
+
+/////////////////////////
+//         PNG         //
+/////////////////////////
+
+// https://www.w3.org/TR/png/
+
+static uint32 crc32(const uint8 *data, size_t n, uint32 crc = 0) {
+    static uint32 table[256];
+    static bool init = false;
+    if (!init) {
+        for (uint32 i = 0; i < 256; i++) {
+            uint32 c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        init = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void putChunk(std::vector<uint8>& png, const char *type, const std::vector<uint8>& data) {
+    put32be(png, uint32(data.size()));
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    put32be(png, crc32(&png[start], png.size() - start));
+}
+
+bool writePNG(const char *filename, const uint32 *pixels, uint32 width, uint32 height) {
+
+    // raw scanlines, each prefixed with filter type 0 (none)
+    size_t rowSize = size_t(width) * 3 + 1;
+    std::vector<uint8> raw(rowSize * height);
+    for (uint32 y = 0; y < height; y++) {
+        uint8 *row = &raw[y * rowSize];
+        const uint32 *src = &pixels[size_t(height - 1 - y) * width]; // flip, PNG is stored top to bottom
+        *row++ = 0;
+        for (uint32 x = 0; x < width; x++) {
+            *row++ = uint8(src[x] >> 16);
+            *row++ = uint8(src[x] >> 8);
+            *row++ = uint8(src[x]);
+        }
+    }
+
+    // zlib stream made of uncompressed deflate blocks, keeps the writer trivial
+    // (rendered images are noisy enough that a simple LZ77 pass doesn't buy much)
+    std::vector<uint8> zlib;
+    zlib.reserve(raw.size() + (raw.size() / 65535 + 1) * 5 + 6);
+    put8(zlib, 0x78);
+    put8(zlib, 0x01);
+
+    size_t pos = 0;
+    do {
+        size_t blockSize = std::min<size_t>(raw.size() - pos, 65535);
+        bool last = (pos + blockSize == raw.size());
+        put8(zlib, last ? 1 : 0);
+        put8(zlib, uint8(blockSize));
+        put8(zlib, uint8(blockSize >> 8));
+        put8(zlib, uint8(~blockSize));
+        put8(zlib, uint8(~blockSize >> 8));
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + blockSize);
+        pos += blockSize;
+    } while (pos < raw.size());
+
+    // adler32 checksum of the uncompressed data
+    uint32 s1 = 1, s2 = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        s1 = (s1 + raw[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    put32be(zlib, (s2 << 16) | s1);
+
+    std::vector<uint8> header;
+    put32be(header, width);
+    put32be(header, height);
+    put8(header, 8); // bit depth
+    put8(header, 2); // color type RGB
+    put8(header, 0); // compression
+    put8(header, 0); // filter
+    put8(header, 0); // interlace
+
+    static const uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<uint8> png(signature, signature + sizeof(signature));
+    putChunk(png, "IHDR", header);
+    putChunk(png, "IDAT", zlib);
+    putChunk(png, "IEND", {});
+
+    return writeFile(filename, png);
+}
+
+/////////////////////////
+//         PFM         //
+/////////////////////////
+
+bool writePFM(const char *filename, const Vec3 *pixels, uint32 width, uint32 height) {
+    std::vector<uint8> pfm;
+
+    char header[64];
+    int len = snprintf(header, sizeof(header), "PF\n%u %u\n-1.0\n", width, height); // negative scale == little endian
+    pfm.insert(pfm.end(), header, header + len);
+    pfm.reserve(pfm.size() + size_t(width) * height * 12);
+
+    // PFM is stored bottom to top, same as our buffers
+    for (size_t i = 0; i < size_t(width) * height; i++) {
+        putf32le(pfm, pixels[i].r);
+        putf32le(pfm, pixels[i].g);
+        putf32le(pfm, pixels[i].b);
+    }
+    return writeFile(filename, pfm);
+}
+
+/////////////////////////
+//       OpenEXR       //
+/////////////////////////
+
+// single-part scanline file, uncompressed 32-bit float channels
+// https://openexr.com/en/latest/OpenEXRFileLayout.html
+
+static void putAttribute(std::vector<uint8>& exr, const char *name, const char *type, const std::vector<uint8>& value) {
+    putstr(exr, name);
+    putstr(exr, type);
+    put32le(exr, uint32(value.size()));
+    exr.insert(exr.end(), value.begin(), value.end());
+}
+
+bool writeEXR(const char *filename, const Vec3 *pixels, uint32 width, uint32 height) {
+    std::vector<uint8> exr;
+
+    put32le(exr, 20000630); // magic number
+    put32le(exr, 2);        // version 2, single-part scanline
+
+    // channels must be sorted alphabetically
+    std::vector<uint8> chlist;
+    for (const char *name : { "B", "G", "R" }) {
+        putstr(chlist, name);
+        put32le(chlist, 2); // FLOAT
+        put32le(chlist, 0); // pLinear + reserved
+        put32le(chlist, 1); // xSampling
+        put32le(chlist, 1); // ySampling
+    }
+    put8(chlist, 0);
+
+    std::vector<uint8> box;
+    put32le(box, 0);
+    put32le(box, 0);
+    put32le(box, width - 1);
+    put32le(box, height - 1);
+
+    std::vector<uint8> v2f;
+    putf32le(v2f, 0.0f);
+    putf32le(v2f, 0.0f);
+
+    std::vector<uint8> one;
+    putf32le(one, 1.0f);
+
+    putAttribute(exr, "channels", "chlist", chlist);
+    putAttribute(exr, "compression", "compression", { 0 }); // NO_COMPRESSION
+    putAttribute(exr, "dataWindow", "box2i", box);
+    putAttribute(exr, "displayWindow", "box2i", box);
+    putAttribute(exr, "lineOrder", "lineOrder", { 0 });     // INCREASING_Y
+    putAttribute(exr, "pixelAspectRatio", "float", one);
+    putAttribute(exr, "screenWindowCenter", "v2f", v2f);
+    putAttribute(exr, "screenWindowWidth", "float", one);
+    put8(exr, 0); // end of header
+
+    // offset table, one scanline per block without compression
+    uint32 lineBytes = width * 3 * sizeof(float);
+    uint64 offset = exr.size() + uint64(height) * sizeof(uint64);
+    for (uint32 y = 0; y < height; y++) {
+        put64le(exr, offset);
+        offset += 8 + lineBytes;
+    }
+
+    exr.reserve(offset);
+    for (uint32 y = 0; y < height; y++) {
+        const Vec3 *src = &pixels[size_t(height - 1 - y) * width]; // flip, EXR y axis points down
+        put32le(exr, y);
+        put32le(exr, lineBytes);
+        for (uint32 x = 0; x < width; x++) putf32le(exr, src[x].b);
+        for (uint32 x = 0; x < width; x++) putf32le(exr, src[x].g);
+        for (uint32 x = 0; x < width; x++) putf32le(exr, src[x].r);
+    }
+
+    return writeFile(filename, exr);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool writeImage(const char *filename, const uint32 *pixels, const Vec3 *linearPixels, uint32 width, uint32 height) {
+    if (hasExtension(filename, ".pfm")) {
+        return writePFM(filename, linearPixels, width, height);
+    }
+    else if (hasExtension(filename, ".exr")) {
+        return writeEXR(filename, linearPixels, width, height);
+    }
+    else {
+        if (!hasExtension(filename, ".png")) {
+            MRT_DebugPrint("Warning: unknown image extension for '%s', writing PNG.\n", filename);
+        }
+        return writePNG(filename, pixels, width, height);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+
+// NOTE: all buffers are expected in the same layout as the backbuffers, i.e. rows from bottom to top
+
+// 8-bit RGB PNG from a 32-bit ARGB buffer (see ARGB32())
+bool writePNG(const char *filename, const uint32 *pixels, uint32 width, uint32 height);
+
+// linear 32-bit float RGB
+bool writePFM(const char *filename, const Vec3 *pixels, uint32 width, uint32 height);
+bool writeEXR(const char *filename, const Vec3 *pixels, uint32 width, uint32 height);
+
+// picks the format from the file extension (.png, .pfm or .exr), the PNG is written from the display buffer, the others from the linear buffer
+bool writeImage(const char *filename, const uint32 *pixels, const Vec3 *linearPixels, uint32 width, uint32 height);
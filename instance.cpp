@@ -0,0 +1,64 @@
+#include "instance.h"
+#include "platform.h"
+
+static inline Vec3 transform_point(const Mat4& m, const Vec3& p) {
+    return m * p + Vec3(m.m03, m.m13, m.m23);
+}
+
+// normals transform with the inverse transpose, which is the row vector product, the W component of the result
+// picks up the translation and is dropped
+static inline Vec3 transform_normal(const Mat4& inverse, const Vec3& n) {
+    Vec3 t = n * inverse;
+    return Vec3(t.x, t.y, t.z);
+}
+
+static aabb transform_box(const Mat4& m, const aabb& local) {
+    aabb box = aabb::empty();
+    for (int i = 0; i < 8; i++) {
+        Vec3 corner((i & 1) ? local.max.x : local.min.x,
+                    (i & 2) ? local.max.y : local.min.y,
+                    (i & 4) ? local.max.z : local.min.z);
+        box.grow(transform_point(m, corner));
+    }
+    return box;
+}
+
+instance::instance(const scene_object *blas, const Mat4& to_world, float time0, float time1, material *mat, const Vec3& velocity)
+    : to_world(to_world), to_object(Mat4::Invert(to_world)), blas(blas), mat_ptr(mat), velocity(velocity), time0(time0) {
+
+    aabb local;
+    bool bounded = blas->bounding_box(&local, time0, time1);
+    MRT_Assert(bounded);
+
+    box = transform_box(to_world, local);
+    box = surrounding_box(box, aabb(box.min + (time1 - time0) * velocity, box.max + (time1 - time0) * velocity));
+}
+
+void instance::add_to_box(aabb* b, float time) const {
+    aabb local;
+    blas->bounding_box(&local, time, time);
+    Vec3 offset = (time - time0) * velocity;
+    aabb world = transform_box(to_world, local);
+    b->grow(aabb(world.min + offset, world.max + offset));
+}
+
+bool instance::hit(const ray& r, float tmin, float tmax, hit_record* rec) const {
+    // the ray constructor normalizes the direction, so distances are scaled by its length in object space
+    Vec3 dir = to_object * r.dir;
+    float scale = dir.length();
+    Vec3 origin = r.origin - (r.time - time0) * velocity;
+    ray local(transform_point(to_object, origin), dir, r.time, r.isInside);
+
+    // the BVH passes the closest hit so far, which the BLAS may overwrite on a miss
+    hit_record cur_rec;
+    if (!blas->hit(local, tmin * scale, tmax * scale, &cur_rec))
+        return false;
+
+    rec->t = cur_rec.t / scale;
+    rec->p = r.eval(rec->t);
+    rec->n = transform_normal(to_object, cur_rec.n).normalize();
+    rec->u = cur_rec.u;
+    rec->v = cur_rec.v;
+    rec->mat_ptr = mat_ptr ? mat_ptr : cur_rec.mat_ptr;
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "scene_object.h"
+#include "triangle.h" // pod_bvh
+#include "mat4.h"
+
+// Two-level acceleration structure: the top level is a pod_bvh<instance>, every instance places a shared bottom level
+// object (a mesh, pod_bvh, bvh_node, ...) into the world with its own affine transform. Rays are transformed into object
+// space instead of duplicating the geometry, so thousands of instances only cost one BLAS plus a few bytes each.
+
+struct instance {
+    Mat4 to_world;            // object to world space
+    Mat4 to_object;           // world to object space
+    const scene_object *blas;
+    material *mat_ptr;        // replaces the material of the BLAS if not null
+    aabb box;                 // world space bounds of the transformed BLAS over the whole time interval
+    Vec3 velocity;            // world space translation per unit of time, like a moving sphere
+    float time0;              // to_world is the transform at this time
+
+    instance() = default;
+    // the BLAS must be bounded, to_world must be invertible
+    instance(const scene_object *blas, const Mat4& to_world, float time0, float time1, material *mat = nullptr, const Vec3& velocity = Vec3(0.0f));
+
+    bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const;
+    Vec3 get_centroid() const {
+        return box.center();
+    }
+    void add_to_box(aabb* b) const {
+        b->min = vmin(b->min, box.min);
+        b->max = vmax(b->max, box.max);
+    }
+    void add_to_box(aabb* b, float time) const;
+};
@@ -0,0 +1,476 @@
+#include "light.h"
+#include "onb.h"
+#include "pcg.h"
+#include "sampler.h"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+#define LIGHT_BVH_BUCKETS 12
+#define LIGHT_BVH_MAX_DEPTH 64 // bits in a trail
+
+static constexpr float ONE_MINUS_EPSILON = 1.0f - std::numeric_limits<float>::epsilon() / 2; // largest float below 1
+
+static float safe_sqrt(float f) {
+    return MRT::sqrt(std::max(f, 0.0f));
+}
+
+static float safe_acos(float f) {
+    return acosf(std::clamp(f, -1.0f, 1.0f));
+}
+
+// rotates a around the unit vector axis
+static Vec3 rotate(const Vec3& a, const Vec3& axis, float radians) {
+    float c = cosf(radians);
+    float s = sinf(radians);
+    return a * c + cross(axis, a) * s + axis * (dot(axis, a) * (1.0f - c));
+}
+
+// smallest cone around both normal cones, bounds with no power are empty
+static light_bounds merge(const light_bounds& a, const light_bounds& b) {
+    if (!(a.power > 0))
+        return b;
+    if (!(b.power > 0))
+        return a;
+
+    light_bounds r;
+    r.box = a.box;
+    r.box.grow(b.box);
+    r.power = a.power + b.power;
+    r.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+
+    float theta_a = safe_acos(a.cos_theta_o);
+    float theta_b = safe_acos(b.cos_theta_o);
+    float theta_d = safe_acos(dot(a.axis, b.axis));
+    if (std::min(theta_d + theta_b, M_PI_F) <= theta_a) {
+        r.axis = a.axis;
+        r.cos_theta_o = a.cos_theta_o;
+    }
+    else if (std::min(theta_d + theta_a, M_PI_F) <= theta_b) {
+        r.axis = b.axis;
+        r.cos_theta_o = b.cos_theta_o;
+    }
+    else {
+        float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+        Vec3 wr = cross(a.axis, b.axis);
+        if (theta_o >= M_PI_F || sdot(wr) < 1e-12f) {
+            r.axis = a.axis;
+            r.cos_theta_o = -1.0f;
+        }
+        else {
+            r.axis = normalize(rotate(a.axis, normalize(wr), theta_o - theta_a));
+            r.cos_theta_o = cosf(theta_o);
+        }
+    }
+    return r;
+}
+
+float light_bounds::importance(const Vec3& p) const {
+    Vec3 pc = box.center();
+    Vec3 to_p = p - pc;
+    float dist_sq = sdot(to_p);
+    float radius = 0.5f * (box.max - box.min).length();
+
+    // cone of directions from p to the box
+    float cos_theta_b = -1.0f;
+    if (dist_sq > radius * radius) {
+        cos_theta_b = safe_sqrt(1 - radius * radius / dist_sq);
+    }
+    float sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+    // angle between the axis and p, minus the spread of the normals and of the box, clamped to 0
+    float cos_theta_w = dist_sq > 0 ? dot(axis, to_p) / MRT::sqrt(dist_sq) : 1.0f;
+    float sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+    float sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+    float cos_theta_x = 1.0f;
+    float sin_theta_x = 0.0f;
+    if (cos_theta_w < cos_theta_o) {
+        cos_theta_x = cos_theta_w * cos_theta_o + sin_theta_w * sin_theta_o;
+        sin_theta_x = sin_theta_w * cos_theta_o - cos_theta_w * sin_theta_o;
+    }
+    float cos_theta_p = 1.0f;
+    if (cos_theta_x < cos_theta_b) {
+        cos_theta_p = cos_theta_x * cos_theta_b + sin_theta_x * sin_theta_b;
+    }
+    if (cos_theta_p <= cos_theta_e)
+        return 0;
+
+    // close to the box the distance is meaningless, don't let it blow up
+    return power * cos_theta_p / std::max(dist_sq, radius);
+}
+
+// surface area orientation heuristic of one side of a split
+static float split_cost(const light_bounds& b, const aabb& node_box, int axis) {
+    float theta_o = safe_acos(b.cos_theta_o);
+    float theta_e = safe_acos(b.cos_theta_e);
+    float theta_w = std::min(theta_o + theta_e, M_PI_F);
+    float sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+    float m_omega = 2 * M_PI_F * (1 - b.cos_theta_o) +
+        0.5f * M_PI_F * (2 * theta_w * sin_theta_o - cosf(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + b.cos_theta_o);
+
+    // penalize thin slabs across the longest axis of the node
+    Vec3 d = node_box.max - node_box.min;
+    float kr = std::max(d.x, std::max(d.y, d.z)) / d[axis];
+    return b.power * m_omega * kr * b.box.half_area();
+}
+
+light_list::light_list(scene_object *objects) {
+
+    objects->add_lights(this);
+    if (lights.empty())
+        return;
+
+    std::vector<uint32> ids(lights.size());
+    for (uint32 i = 0; i < ids.size(); i++) {
+        ids[i] = i;
+    }
+    trails.resize(lights.size());
+    nodes.reserve(2 * lights.size() - 1);
+    build(ids.data(), (uint32) ids.size(), 0, 0);
+
+    light_bounds_list.clear();
+    light_bounds_list.shrink_to_fit();
+}
+
+uint32 light_list::build(uint32 *ids, uint32 count, uint32 depth, uint64 trail) {
+
+    uint32 node_index = (uint32) nodes.size();
+    nodes.emplace_back();
+
+    if (count == 1) {
+        nodes[node_index] = { light_bounds_list[ids[0]], ids[0], true };
+        trails[ids[0]] = trail;
+        return node_index;
+    }
+
+    light_bounds bounds = light_bounds_list[ids[0]];
+    aabb centroids = aabb::empty();
+    for (uint32 i = 0; i < count; i++) {
+        const light_bounds& b = light_bounds_list[ids[i]];
+        bounds = i ? merge(bounds, b) : b;
+        centroids.grow(b.box.center());
+    }
+
+    // binned split with the lowest cost
+    float best_cost = std::numeric_limits<float>::max();
+    int best_axis = -1;
+    uint32 best_bucket = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroids.max[axis] - centroids.min[axis];
+        if (!(extent > 0))
+            continue;
+
+        light_bounds buckets[LIGHT_BVH_BUCKETS] = {};
+        uint32 counts[LIGHT_BVH_BUCKETS] = {};
+        for (uint32 i = 0; i < count; i++) {
+            const light_bounds& b = light_bounds_list[ids[i]];
+            uint32 bucket = std::min((uint32) (LIGHT_BVH_BUCKETS * (b.box.center()[axis] - centroids.min[axis]) / extent), LIGHT_BVH_BUCKETS - 1u);
+            buckets[bucket] = merge(buckets[bucket], b);
+            counts[bucket]++;
+        }
+
+        for (uint32 split = 1; split < LIGHT_BVH_BUCKETS; split++) {
+            light_bounds left = {}, right = {};
+            uint32 left_count = 0, right_count = 0;
+            for (uint32 i = 0; i < split; i++) {
+                left = merge(left, buckets[i]);
+                left_count += counts[i];
+            }
+            for (uint32 i = split; i < LIGHT_BVH_BUCKETS; i++) {
+                right = merge(right, buckets[i]);
+                right_count += counts[i];
+            }
+            if (!left_count || !right_count)
+                continue;
+
+            float cost = split_cost(left, bounds.box, axis) + split_cost(right, bounds.box, axis);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bucket = split;
+            }
+        }
+    }
+
+    // the trails have room for LIGHT_BVH_MAX_DEPTH levels, splitting by count always fits
+    uint32 levels = 0;
+    while ((1u << levels) < count)
+        levels++;
+
+    uint32 mid;
+    if (best_axis >= 0 && depth + levels < LIGHT_BVH_MAX_DEPTH) {
+        float extent = centroids.max[best_axis] - centroids.min[best_axis];
+        uint32 *m = std::partition(ids, ids + count, [&](uint32 id) {
+            uint32 bucket = (uint32) (LIGHT_BVH_BUCKETS * (light_bounds_list[id].box.center()[best_axis] - centroids.min[best_axis]) / extent);
+            return std::min(bucket, LIGHT_BVH_BUCKETS - 1u) < best_bucket;
+        });
+        mid = (uint32) (m - ids);
+    }
+    else {
+        // all lights in the same place or the tree is getting too deep
+        mid = count / 2;
+        int axis = max_dim(centroids.max - centroids.min);
+        std::nth_element(ids, ids + mid, ids + count, [&](uint32 a, uint32 b) {
+            return light_bounds_list[a].box.center()[axis] < light_bounds_list[b].box.center()[axis];
+        });
+    }
+
+    build(ids, mid, depth + 1, trail);
+    uint32 second = build(ids + mid, count - mid, depth + 1, trail | (1ull << depth));
+    nodes[node_index] = { bounds, second, false };
+    return node_index;
+}
+
+// copies the emitter material for the new light, emitters that don't emit anything are left alone
+material *light_list::add(light& l, const light_bounds& b, const material *mat) {
+    if (!(b.power > 0)) {
+        return const_cast<material*>(mat);
+    }
+
+    diffuse_light *copy = new diffuse_light(*static_cast<const diffuse_light*>(mat));
+    copy->light_index = (uint32) lights.size();
+    l.mat_ptr = copy;
+    lights.push_back(l);
+    light_bounds_list.push_back(b);
+    return copy;
+}
+
+// emitted power of a light with uniform emission (sampled at p) over the area
+static float emitter_power(const material *mat, const Vec3& p, float area) {
+    const diffuse_light *emitter = static_cast<const diffuse_light*>(mat);
+    return area * luminance(emitter->scale * sample_texture(emitter->emissive, 0.5f, 0.5f, p));
+}
+
+material *light_list::add_rect(uint8 axis, float k, float a0, float a1, float b0, float b1, float normal_sign, const material *mat) {
+    light l;
+    l.type = LIGHT_RECT;
+    l.rect.axis = axis;
+    l.rect.k = k;
+    l.rect.a0 = a0;
+    l.rect.a1 = a1;
+    l.rect.b0 = b0;
+    l.rect.b1 = b1;
+    l.rect.normal_sign = normal_sign;
+
+    Vec3 lo(0.0f), hi(0.0f), n(0.0f);
+    lo[axis] = hi[axis] = k;
+    lo[axis == 0 ? 1 : 0] = a0;
+    hi[axis == 0 ? 1 : 0] = a1;
+    lo[axis == 2 ? 1 : 2] = b0;
+    hi[axis == 2 ? 1 : 2] = b1;
+    n[axis] = normal_sign;
+
+    light_bounds b;
+    b.box = aabb(lo, hi);
+    b.axis = n;
+    b.cos_theta_o = 1.0f;
+    b.cos_theta_e = 0.0f;
+    b.power = emitter_power(mat, b.box.center(), (a1 - a0) * (b1 - b0));
+    return add(l, b, mat);
+}
+
+material *light_list::add_sphere(const Vec3& center, const Vec3& velocity, float time0, float radius, const aabb& box, const material *mat) {
+    light l;
+    l.type = LIGHT_SPHERE;
+    for (int i = 0; i < 3; i++) {
+        l.sphere.center[i] = center[i];
+        l.sphere.velocity[i] = velocity[i];
+    }
+    l.sphere.time0 = time0;
+    l.sphere.radius = radius;
+
+    light_bounds b;
+    b.box = box;
+    b.axis = Vec3(0, 0, 1);
+    b.cos_theta_o = -1.0f; // normals in all directions
+    b.cos_theta_e = 0.0f;
+    b.power = emitter_power(mat, center, 4 * M_PI_F * radius * radius);
+    return add(l, b, mat);
+}
+
+material *light_list::add_triangle(const Vec3& a, const Vec3& b, const Vec3& c, const material *mat) {
+    light l;
+    l.type = LIGHT_TRIANGLE;
+    Vec3 u = b - a;
+    Vec3 v = c - a;
+    for (int i = 0; i < 3; i++) {
+        l.tri.m[i] = a[i];
+        l.tri.u[i] = u[i];
+        l.tri.v[i] = v[i];
+    }
+
+    Vec3 n = cross(u, v);
+    float area = 0.5f * n.length();
+    if (!(area > 0)) {
+        return const_cast<material*>(mat);
+    }
+
+    light_bounds lb;
+    lb.box = aabb::empty();
+    lb.box.grow(a);
+    lb.box.grow(b);
+    lb.box.grow(c);
+    lb.axis = normalize(n);
+    lb.cos_theta_o = 1.0f;
+    lb.cos_theta_e = 0.0f;
+    lb.power = emitter_power(mat, lb.box.center(), area);
+    return add(l, lb, mat);
+}
+
+// probability of sample() choosing the light from p
+float light_list::select_pdf(const Vec3& p, uint32 index) const {
+    uint64 trail = trails[index];
+    uint32 node = 0;
+    float prob = 1.0f;
+    while (!nodes[node].leaf) {
+        float i0 = nodes[node + 1].bounds.importance(p);
+        float i1 = nodes[nodes[node].index].bounds.importance(p);
+        if (!(i0 + i1 > 0))
+            return 0;
+
+        if (trail & 1) {
+            prob *= i1 / (i0 + i1);
+            node = nodes[node].index;
+        }
+        else {
+            prob *= i0 / (i0 + i1);
+            node = node + 1;
+        }
+        trail >>= 1;
+    }
+    return prob;
+}
+
+static Vec3 sphere_center(const light& l, float time) {
+    return Vec3(l.sphere.center[0], l.sphere.center[1], l.sphere.center[2])
+        + (time - l.sphere.time0) * Vec3(l.sphere.velocity[0], l.sphere.velocity[1], l.sphere.velocity[2]);
+}
+
+// 1 / solid angle of the cone around the sphere, 0 if p is inside
+static float sphere_pdf(const light& l, const Vec3& p, float time) {
+    float dist_sq = sdot(sphere_center(l, time) - p);
+    float r_sq = l.sphere.radius * l.sphere.radius;
+    if (dist_sq <= r_sq)
+        return 0;
+    float cos_theta_max = MRT::sqrt(1 - r_sq / dist_sq);
+    return 1 / (2 * M_PI_F * (1 - cos_theta_max));
+}
+
+bool light_list::sample(const Vec3& p, float time, light_sample *s) const {
+    if (lights.empty())
+        return false;
+
+    // walk down the BVH, u is rescaled at every step so it can choose again
+    float u = sample_1d();
+    float select_pdf = 1.0f;
+    uint32 node = 0;
+    while (!nodes[node].leaf) {
+        uint32 second = nodes[node].index;
+        float i0 = nodes[node + 1].bounds.importance(p);
+        float i1 = nodes[second].bounds.importance(p);
+        if (!(i0 + i1 > 0))
+            return false;
+
+        float p0 = i0 / (i0 + i1);
+        if (u < p0) {
+            u = std::min(u / p0, ONE_MINUS_EPSILON);
+            select_pdf *= p0;
+            node = node + 1;
+        }
+        else {
+            u = std::min((u - p0) / (1 - p0), ONE_MINUS_EPSILON);
+            select_pdf *= 1 - p0;
+            node = second;
+        }
+    }
+    const light& l = lights[nodes[node].index];
+    s->mat = l.mat_ptr;
+
+    if (l.type == LIGHT_RECT) {
+        uint32 axis = l.rect.axis;
+        vec2 uv = sample_2d();
+        Vec3 q(0.0f); // sdot() includes w
+        q[axis] = l.rect.k;
+        q[axis == 0 ? 1 : 0] = l.rect.a0 + uv.x * (l.rect.a1 - l.rect.a0);
+        q[axis == 2 ? 1 : 2] = l.rect.b0 + uv.y * (l.rect.b1 - l.rect.b0);
+
+        Vec3 d = q - p;
+        float dist_sq = sdot(d);
+        s->dir = d / MRT::sqrt(dist_sq);
+        float cosine = -s->dir[axis] * l.rect.normal_sign; // one sided, like diffuse_light
+        if (cosine <= 0)
+            return false;
+        float area = (l.rect.a1 - l.rect.a0) * (l.rect.b1 - l.rect.b0);
+        s->pdf = select_pdf * dist_sq / (cosine * area);
+    }
+    else if (l.type == LIGHT_SPHERE) {
+        float pdf = sphere_pdf(l, p, time);
+        if (pdf == 0)
+            return false;
+        Vec3 d = sphere_center(l, time) - p;
+        onb uvw(normalize(d));
+        s->dir = normalize(uvw * random_towards_sphere(l.sphere.radius, sdot(d)));
+        s->pdf = select_pdf * pdf;
+    }
+    else {
+        Vec3 m(l.tri.m[0], l.tri.m[1], l.tri.m[2]);
+        Vec3 e0(l.tri.u[0], l.tri.u[1], l.tri.u[2]);
+        Vec3 e1(l.tri.v[0], l.tri.v[1], l.tri.v[2]);
+        vec2 uv = sample_2d();
+        float su = MRT::sqrt(uv.x);
+        Vec3 q = m + (su * (1 - uv.y)) * e0 + (su * uv.y) * e1;
+
+        Vec3 d = q - p;
+        float dist_sq = sdot(d);
+        s->dir = d / MRT::sqrt(dist_sq);
+        Vec3 n = cross(e0, e1);
+        float area2 = n.length();
+        float cosine = -dot(s->dir, n) / area2;
+        if (cosine <= 0)
+            return false;
+        s->pdf = select_pdf * dist_sq / (cosine * 0.5f * area2);
+    }
+    return true;
+}
+
+float light_list::pdf(const ray& r, const hit_record& rec) const {
+    uint32 index = static_cast<const diffuse_light*>(rec.mat_ptr)->light_index;
+    if (index == NO_LIGHT)
+        return 0;
+
+    const light& l = lights[index];
+    if (l.type == LIGHT_RECT) {
+        float cosine = MRT::abs(r.dir[l.rect.axis]);
+        float area = (l.rect.a1 - l.rect.a0) * (l.rect.b1 - l.rect.b0);
+        return select_pdf(r.origin, index) * rec.t * rec.t / (cosine * area);
+    }
+    else if (l.type == LIGHT_SPHERE) {
+        return select_pdf(r.origin, index) * sphere_pdf(l, r.origin, r.time);
+    }
+    else {
+        Vec3 n = cross(Vec3(l.tri.u[0], l.tri.u[1], l.tri.u[2]), Vec3(l.tri.v[0], l.tri.v[1], l.tri.v[2]));
+        float area2 = n.length();
+        float cosine = MRT::abs(dot(r.dir, n)) / area2;
+        return select_pdf(r.origin, index) * rec.t * rec.t / (cosine * 0.5f * area2);
+    }
+}
+
+bool sample_direct(const scene& scene, const ray& r, const hit_record& hrec, const scatter_record& srec, Vec3 *radiance) {
+
+    *radiance = Vec3(0.0f);
+
+    light_sample ls;
+    if (!scene.lights->sample(hrec.p, r.time, &ls))
+        return false;
+
+    ray shadow(hrec.p, ls.dir, r.time);
+    hit_record lrec;
+    if (scene.objects->hit(shadow, 0.001f, std::numeric_limits<float>::max(), &lrec) && lrec.mat_ptr == ls.mat) {
+        float scatter_pdf = material_scattering_pdf(hrec.mat_ptr, r, hrec, shadow);
+        if (scatter_pdf > 0) {
+            Vec3 emitted = material_emitted(lrec.mat_ptr, shadow, lrec);
+            *radiance = srec.attenuation * scatter_pdf * emitted * (mis_weight(ls.pdf, srec.bsdf.value(shadow.dir, r.time)) / ls.pdf);
+        }
+    }
+    return true;
+}
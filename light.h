@@ -0,0 +1,123 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+#include "scene.h"
+#include "material.h"
+#include <vector>
+
+// Explicit light sampling (next event estimation) with multiple importance sampling against the BSDF.
+// see "Optimally Combining Sampling Techniques for Monte Carlo Rendering" (Veach & Guibas 1995)
+//
+// The light list is gathered from the scene objects that support it (rects, spheres and triangles with a diffuse_light
+// material, also inside object lists, bvh_nodes, boxes and pod_bvhs), see scene_object::add_lights(). Emitters the list
+// cannot sample (meshes, transformed or instanced objects) are still found by BSDF sampling, they just don't get the MIS weight.
+//
+// Every light gets its own copy of the material that knows its index (diffuse_light::light_index), so a BSDF sampled ray
+// that hits an emitter can look up the light it came from and a shadow ray only has to compare the material it hit.
+//
+// The light is chosen by walking down a BVH over the lights, each step picks a child by an estimate of how much light
+// it contributes to the shading point (power, distance and orientation), so choosing a light and its probability are O(log N).
+// see "Importance Sampling of Many Lights With Adaptive Tree Splitting" (Conty Estevez & Kulla 2018),
+// the importance and the split cost are the ones from pbrt-v4
+
+enum light_type : uint8 {
+    LIGHT_RECT,
+    LIGHT_SPHERE,
+    LIGHT_TRIANGLE,
+};
+
+struct light {
+    light_type type;
+    const material *mat_ptr; // the copy of the emitter material owned by this light
+    union {
+        struct {
+            uint8 axis;        // of the normal, same as N in hit_rect()
+            float k;           // plane at axis = k
+            float a0, a1;      // first axis spanning the rect
+            float b0, b1;      // second axis spanning the rect
+            float normal_sign;
+        } rect;
+        struct {
+            float center[3];   // at time0
+            float velocity[3]; // per unit of time, 0 if not moving
+            float time0;
+            float radius;
+        } sphere;
+        struct {
+            float m[3];        // first vertex
+            float u[3], v[3];  // edges from m, the front side is cross(u, v) like triangle::hit()
+        } tri;
+    };
+};
+
+// bounds of one light or a subtree of the light BVH, everything the importance estimate needs
+struct light_bounds {
+    aabb box;
+    Vec3 axis;         // principal direction of the surface normals
+    float cos_theta_o; // all normals are within theta_o of the axis
+    float cos_theta_e; // light leaves the surface within theta_e of its normal, pi/2 for diffuse emitters
+    float power;       // emitted flux up to a constant factor
+
+    // upper bound on the light reaching p, relative to the other nodes
+    float importance(const Vec3& p) const;
+};
+
+struct light_bvh_node {
+    light_bounds bounds;
+    uint32 index; // leaf: light, interior: second child (the first child is the next node)
+    bool leaf;
+};
+
+// direction towards a point on a light
+struct light_sample {
+    Vec3 dir;
+    float pdf;           // solid angle density, including the probability of choosing the light
+    const material *mat; // a shadow ray reaches the light if the first thing it hits has this material
+};
+
+class light_list {
+    std::vector<light> lights;
+    std::vector<light_bounds> light_bounds_list; // only while building
+    std::vector<light_bvh_node> nodes;
+    std::vector<uint64> trails; // per light, which child to take at each level of the BVH, starting with the lowest bit
+
+    material *add(light& l, const light_bounds& b, const material *mat);
+    uint32 build(uint32 *ids, uint32 count, uint32 depth, uint64 trail);
+    float select_pdf(const Vec3& p, uint32 index) const;
+public:
+    // turns the emitters of objects into lights and points them to their own materials
+    light_list(scene_object *objects);
+
+    // called from scene_object::add_lights(), returns the material the emitter has to use from now on
+    material *add_rect(uint8 axis, float k, float a0, float a1, float b0, float b1, float normal_sign, const material *mat);
+    // box covers the sphere over the whole shutter interval
+    material *add_sphere(const Vec3& center, const Vec3& velocity, float time0, float radius, const aabb& box, const material *mat);
+    material *add_triangle(const Vec3& a, const Vec3& b, const Vec3& c, const material *mat);
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    // chooses a light and a direction towards it as seen from p, false if the chosen light faces away
+    bool sample(const Vec3& p, float time, light_sample *s) const;
+    // density sample() would have generated the ray r with for the hit on the emitter in rec
+    float pdf(const ray& r, const hit_record& rec) const;
+};
+
+// power heuristic with beta = 2
+inline float mis_weight(float pdf, float other_pdf) {
+    float p2 = pdf * pdf;
+    float o2 = other_pdf * other_pdf;
+    return p2 / (p2 + o2);
+}
+
+// Radiance from a light arriving at the non-specular hit hrec and scattered along -r.dir, weighted against BSDF sampling
+// with srec.bsdf. Returns false if no shadow ray was traced.
+bool sample_direct(const scene& scene, const ray& r, const hit_record& hrec, const scatter_record& srec, Vec3 *radiance);
+
+// MIS weight of the emission at hrec if r was sampled from a BSDF with density bsdf_pdf, 0 for rays that were not
+inline float emission_weight(const scene& scene, const ray& r, const hit_record& hrec, float bsdf_pdf) {
+    if (bsdf_pdf <= 0 || hrec.mat_ptr->type != MATERIAL_DIFFUSE_LIGHT)
+        return 1.0f;
+    return mis_weight(bsdf_pdf, scene.lights->pdf(r, hrec));
+}
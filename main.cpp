@@ -1,6 +1,7 @@
 #include <limits>
 #include <thread>
 #include <stdio.h>
+#include <string.h>
 
 #include "common.h"
 
@@ -13,15 +14,25 @@
 #include "obj_loader.h"
 #include "work_queue.h"
 #include "pdf.h"
+#include "ray_packet.h"
+#include "wavefront.h"
+#include "sampler.h"
 #include "scene.h"
+#include "light.h"
+#include "path.h"
 #include "cmdline_parser.h"
+#include "image_writer.h"
+#include "render_server.h"
+#include "tonemap.h"
+#include "stats.h"
+#include "heatmap.h"
 
 using namespace MRT;
 
 /* TODO:
     - set as high-DPI aware to prevent Windows from scaling the window content
     - most scenes are currently broken due to handling of sky + tone mapping!
-    - proper SIMD implementation via ray bundles
+    - proper SIMD implementation via ray bundles (camera rays are traced as packets, secondary rays are not)
         - GPU implementation?
     - fix build with MinGW headers, fix build with GCC
     - could eliminate arbitrary ray tmin offset by using the isInside property to only intersect with front XOR backfaces
@@ -35,14 +46,11 @@ using namespace MRT;
     - add benchmark for iterations over the buffer (standard x,y loop, single counter, pointer, pointer in reverse)
     - make triangles simple structs with no material pointer and no virtual functions, triangle *meshes* should inherit from scene object instead
         - meshes could be a specialization of bvhnode, including a more suitable implementation for the leaf nodes
-    - fix race condition in work queue
     - combine draw and draw2 into a common interface
     - complete math library
     - try to make a very simple brute force SSS material
     - do something to combat the "fireflies"
-    - allocate obj file triangles and/or BVH nodes into contiguous memory --> SoA index buffers in a Mesh class
     - press key to pause/continue tracing (even after initial image is done)
-    - iterative trace function?
     - generalize moving object code (move into base class, add transforms for all objects, can also use this for instancing)
     - consistent naming conventions everywhere
     - better/any documentation
@@ -52,10 +60,11 @@ using namespace MRT;
 */
 
 static volatile bool G_isRunning = true;
-static std::atomic<size_t> G_rayCounter;
 
 static uint32* G_backBuffer; // ARGB in register, BGRA in memory
 static Vec3 *G_linearBackBuffer;
+static float *G_varianceBuffer; // adaptive sampling only: sum of squared luminance deviations per pixel (Welford)
+static pixel_cost *G_costBuffer; // -heatmap only
 
 ////////////////////////////
 //       RAY TRACER       //
@@ -63,73 +72,51 @@ static Vec3 *G_linearBackBuffer;
 
 static MRT_Params *params = getParams();
 
-Vec3 trace(const ray& r, const scene_object& scene, scene_object *biased_obj, uint32 depth) {
-
-    G_rayCounter.fetch_add(1, std::memory_order_relaxed);
+// -maxlum applies to every sample before it is averaged, the same in all modes, so the average never needs clamping
+static Vec3 clamp_luminance(Vec3 color, const MRT_Params *p) {
+    float lum = luminance(color);
+    if (lum > p->maxLuminance) {
+        color = color * (p->maxLuminance / lum);
+    }
+    return color;
+}
 
-    hit_record hrec;
-    if (scene.hit(r, 0.001f, std::numeric_limits<float>::max(), &hrec)) {
-        
-        thread_local pdf_space pdf_storage;
-        thread_local pdf * const pdf_p = (pdf*) &pdf_storage;
-        scatter_record srec;
+Vec3 trace(const ray& r, const scene& scene) {
+    path_state path(r);
+    return trace_path(&path, scene);
+}
 
-        Vec3 emitted = hrec.mat_ptr->sampleEmissive(r, hrec);
+// traces the camera rays in mask together, the secondary rays diverge too much and are traced one by one
+// samplers holds the sampler state of each ray after generating it
+static void trace_packet(const ray_packet& rp, const sampler_state samplers[], uint32 mask, const scene& scene, Vec3 colors[]) {
 
-        if ((depth < params->maxBounces) && hrec.mat_ptr->scatter(r, hrec, &srec, pdf_p)) {
+    count_rays(0, MRT::popcnt(mask));
 
-            if (srec.is_specular) {
-                return srec.attenuation * trace(srec.specular_ray, scene, biased_obj, depth + 1);
-            }
-            else {
-                ray scattered;
-                float pdf_v;
-                if (biased_obj) {
-                    object_pdf plight(hrec.p, biased_obj);
-                    mix_pdf p(&plight, pdf_p);
-                    scattered = ray(hrec.p, p.generate(r.time), r.time);
-                    pdf_v = p.value(scattered.dir, r.time);
-                }
-                else {
-                    scattered = ray(hrec.p, pdf_p->generate(r.time), r.time);
-                    pdf_v = pdf_p->value(scattered.dir, r.time);
-                }
-                //delete srec.pdf; // NOTE: currently reusing thread local storage as we don't need more than one PDF per thread at a time
+    alignas(16) float tmax[RAY_PACKET_SIZE];
+    hit_record hrec[RAY_PACKET_SIZE];
+    for (uint32 i = 0; i < RAY_PACKET_SIZE; i++) {
+        tmax[i] = std::numeric_limits<float>::max();
+    }
 
-                float scatter_pdf = hrec.mat_ptr->scattering_pdf(r, hrec, scattered);
-                Vec3 scatter_color = trace(scattered, scene, biased_obj, depth + 1);
+    stage_timer clock;
+    uint32 hits = scene.objects->hit_packet(rp, mask, 0.001f, tmax, hrec);
+    clock.lap(STAGE_INTERSECT);
 
-                return emitted + srec.attenuation * scatter_pdf * scatter_color / pdf_v;
-            }
-        }
-        else {
-            return emitted;
-        }
-    }
-    else {
-        if (params->sceneSelect >= SCENE_CORNELL_BOX)
-            return Vec3(0.0f);
-        else {
-            // background (sky)
-            float t = 0.5f * (r.dir.y + 1.0f);
-            return Vec3(1.0f - t) + t * Vec3(0.5f, 0.7f, 1.0f);
-        }
+    while (mask) {
+        uint32 i = MRT::tzcnt(mask);
+        mask &= mask - 1;
+        set_sampler_state(samplers[i]);
+        path_state path(rp.rays[i]);
+        colors[i] = finish_path(&path, (hits >> i) & 1, &hrec[i], scene);
     }
 }
 
-// TODO: delete once we have sobol sequence
-struct vec2 {
-    float x;
-    float y;
-};
-
 // worker thread arguments
 struct drawArgs {
     uint64 initstate;
     uint64 initseq;
     work_queue* queue;
     scene scene;
-    vec2 *sample_dist; // array of sample offsets
     uint32 numSamples;
     uint32 threadId;
 };
@@ -143,38 +130,107 @@ unsigned int __stdcall draw(void * argp) {
     Init_Thread_RNG(args.initstate, args.initseq);
     MRT_Params *p = getParams();
 
-    while (tile *t = args.queue->getWork(nullptr)) // fetch new work from the queue
+    wavefront_tracer wavefront;
+    std::vector<Vec3> tileSamples;
+    std::vector<Vec3> tileColors;
+
+    while (tile *t = args.queue->getWork(args.threadId, nullptr)) // fetch new work from the queue
     {
+        if (p->wavefront) {
+            // the whole tile advances one sample at a time
+            uint32 tileWidth = t->xMax - t->xMin;
+            size_t tilePixels = size_t(tileWidth) * (t->yMax - t->yMin);
+            tileSamples.resize(tilePixels);
+            tileColors.assign(tilePixels, Vec3(0.0f));
+
+            for (uint32 s = 0; s < args.numSamples; s++) {
+                wavefront.trace_tile(*t, args.scene, s, tileSamples.data());
+
+                for (size_t i = 0; i < tilePixels; i++) {
+                    Vec3 sample = tileSamples[i];
+                    if (!isfinite(sample.r) || !isfinite(sample.g) || !isfinite(sample.b)) {
+                        stat_add(get_thread_stats().discarded, 1);
+                        sample = tileColors[i];
+                    }
+                    else {
+                        sample = clamp_luminance(sample, p);
+                    }
+                    tileColors[i] += sample;
+                }
+
+                if (!G_isRunning) {
+                    goto endthread;
+                }
+            }
+
+            for (uint32 y = t->yMin; y < t->yMax; y++) {
+                for (uint32 x = t->xMin; x < t->xMax; x++) {
+                    Vec3 color = tileColors[(x - t->xMin) + (y - t->yMin) * tileWidth] / float(args.numSamples);
+                    G_linearBackBuffer[x + y * p->bufferWidth] = color;
+                }
+            }
+            args.queue->markDirty(t);
+            continue;
+        }
+
         for (uint32 y = t->yMin; y < t->yMax; y++) {
             for (uint32 x = t->xMin; x < t->xMax; x++) {
 
                 Vec3 color(0, 0, 0);
+                cost_probe probe;
+                if (G_costBuffer) probe.start();
 
-                // multiple samples per pixel
-                for (uint32 i = 0; i < args.numSamples; i++)
+                // multiple samples per pixel, traced as packets of samples if enabled
+                uint32 batchSize = p->rayPackets ? RAY_PACKET_SIZE : 1;
+                for (uint32 s = 0; s < args.numSamples; s += batchSize)
                 {
-                    float u = (x + args.sample_dist[i].x) / (float) p->bufferWidth;
-                    float v = (y + args.sample_dist[i].y) / (float) p->bufferHeight;
-
-                    ray r = args.scene.camera->get_ray(u, v);
-
-                    Vec3 sample = trace(r, *args.scene.objects, args.scene.biased_objects, 0);
+                    uint32 n = std::min(batchSize, args.numSamples - s);
+                    Vec3 samples[RAY_PACKET_SIZE];
+                    sampler_state samplers[RAY_PACKET_SIZE];
+                    ray_packet rp;
+
+                    for (uint32 i = 0; i < n; i++) {
+                        stage_timer clock;
+                        start_sample(x + y * p->bufferWidth, s + i);
+                        vec2 offset = sample_2d();
+                        float u = (x + offset.x) / (float) p->bufferWidth;
+                        float v = (y + offset.y) / (float) p->bufferHeight;
+
+                        ray r = args.scene.camera->get_ray(u, v);
+                        clock.lap(STAGE_CAMERA);
+
+                        if (p->rayPackets) {
+                            rp.set(i, r);
+                            samplers[i] = get_sampler_state();
+                        }
+                        else
+                            samples[i] = trace(r, args.scene);
+                    }
+                    if (p->rayPackets) {
+                        trace_packet(rp, samplers, (1u << n) - 1, args.scene, samples);
+                    }
 
-                    if (!isfinite(sample.r) || !isfinite(sample.g) || !isfinite(sample.b)) {
-                        sample = color;
+                    for (uint32 i = 0; i < n; i++) {
+                        Vec3 sample = samples[i];
+                        if (!isfinite(sample.r) || !isfinite(sample.g) || !isfinite(sample.b)) {
+                            stat_add(get_thread_stats().discarded, 1);
+                            sample = color;
+                        }
+                        else {
+                            sample = clamp_luminance(sample, p);
+                        }
+                        color += sample;
                     }
-                    color += sample;
                 }
                 color /= float(args.numSamples);
-
-                float lum = luminance(color);
-                if (lum > p->maxLuminance) {
-                    color = color * (p->maxLuminance / lum);
+                if (G_costBuffer) {
+                    probe.add_to(&G_costBuffer[x + y * p->bufferWidth], args.numSamples);
                 }
 
                 G_linearBackBuffer[x + y * p->bufferWidth] = color;
                 //G_backBuffer[x + y * p->bufferWidth] = ARGB32(color.gamma_correct());
             }
+            args.queue->markDirty(t); // every row, a tile takes all of its samples at once in this mode
 
             // periodically check if we want to exit prematurely
             if (!G_isRunning) {
@@ -189,6 +245,95 @@ endthread:
 
 // --- different multi-threading implementation ---
 
+// adds sample number sampleCount of a pixel to the running average in the linear buffer, the sample is clamped before
+// (see clamp_luminance()), so the average in the buffer is the same one the variance is built against
+static void accumulate_sample(uint32 x, uint32 y, Vec3 color, uint32 sampleCount, const MRT_Params *p) {
+
+    // a discarded sample keeps the average and says nothing about the variance
+    bool discarded = !isfinite(color.r) || !isfinite(color.g) || !isfinite(color.b);
+    if (discarded) {
+        stat_add(get_thread_stats().discarded, 1);
+        if (sampleCount > 0)
+            color = G_linearBackBuffer[x + y * p->bufferWidth];
+        else
+            color = Vec3(0.0f);
+    }
+    else {
+        color = clamp_luminance(color, p);
+    }
+
+    if (sampleCount > 0) {
+        Vec3 old_color = G_linearBackBuffer[x + y * p->bufferWidth];
+        Vec3 sample = color;
+        color = old_color + (color - old_color) * (1.0f / (sampleCount + 1.0f)); // iterative average
+
+        if (G_varianceBuffer && !discarded) {
+            float lum = luminance(sample);
+            G_varianceBuffer[x + y * p->bufferWidth] += (lum - luminance(old_color)) * (lum - luminance(color));
+        }
+    }
+
+    G_linearBackBuffer[x + y * p->bufferWidth] = color;
+    //G_backBuffer[x + y * p->bufferWidth] = ARGB32(color.gamma_correct());
+}
+
+static const uint32 ADAPTIVE_MIN_SAMPLES = 16;   // the variance estimate is too noisy before this
+static const uint32 ADAPTIVE_CHECK_INTERVAL = 8;
+
+// relative standard error of the noisiest pixel in the tile after numSamples samples
+static float tile_error(const tile& t, uint32 numSamples, const MRT_Params *p) {
+    float maxError = 0;
+    for (uint32 y = t.yMin; y < t.yMax; y++) {
+        for (uint32 x = t.xMin; x < t.xMax; x++) {
+            float mean = luminance(G_linearBackBuffer[x + y * p->bufferWidth]);
+            float variance = G_varianceBuffer[x + y * p->bufferWidth] / (numSamples - 1);
+            float error = sqrtf(variance / numSamples) / (mean + 0.001f);
+            maxError = std::max(maxError, error);
+        }
+    }
+    return maxError;
+}
+
+// adaptive sampling: lets the queue skip the remaining samples of a tile once it is below the noise threshold,
+// the freed up time goes to the tiles that are still noisy
+static void retire_converged_tile(const drawArgs& args, const tile& t, uint32 sampleCount, const MRT_Params *p) {
+    uint32 n = sampleCount + 1;
+    if (G_varianceBuffer && (n >= ADAPTIVE_MIN_SAMPLES) && (n % ADAPTIVE_CHECK_INTERVAL) == 0) {
+        if (tile_error(t, n, p) < p->noiseThreshold)
+            args.queue->retireTile(args.threadId);
+    }
+}
+
+static const uint32 PREVIEW_BLOCK = 4;
+
+// interactive mode: traces one sample per PREVIEW_BLOCK x PREVIEW_BLOCK block of pixels and fills the whole block with it,
+// so the preview pass is done long before the first full sample pass, which then overwrites it
+static void trace_preview(const drawArgs& args, const tile& t, const MRT_Params *p) {
+    for (uint32 y0 = t.yMin; y0 < t.yMax; y0 += PREVIEW_BLOCK) {
+        for (uint32 x0 = t.xMin; x0 < t.xMax; x0 += PREVIEW_BLOCK) {
+            uint32 xMax = std::min(x0 + PREVIEW_BLOCK, t.xMax);
+            uint32 yMax = std::min(y0 + PREVIEW_BLOCK, t.yMax);
+
+            start_sample(x0 + y0 * p->bufferWidth, 0);
+            float u = 0.5f * (x0 + xMax) / (float) p->bufferWidth;
+            float v = 0.5f * (y0 + yMax) / (float) p->bufferHeight;
+            Vec3 color = trace(args.scene.camera->get_ray(u, v), args.scene);
+
+            if (!isfinite(color.r) || !isfinite(color.g) || !isfinite(color.b)) {
+                stat_add(get_thread_stats().discarded, 1);
+                color = Vec3(0.0f);
+            }
+            color = clamp_luminance(color, p);
+
+            for (uint32 y = y0; y < yMax; y++) {
+                for (uint32 x = x0; x < xMax; x++) {
+                    G_linearBackBuffer[x + y * p->bufferWidth] = color;
+                }
+            }
+        }
+    }
+}
+
 // main worker thread function
 unsigned int __stdcall draw2(void * argp) {
 
@@ -198,44 +343,93 @@ unsigned int __stdcall draw2(void * argp) {
     Init_Thread_RNG(args.initstate, args.initseq);
     MRT_Params *p = getParams();
 
+    wavefront_tracer wavefront;
+    std::vector<Vec3> tileColors;
+
     uint32 sampleCount = 0;
-    while (tile *t = args.queue->getWork(&sampleCount)) // fetch new work from the queue
+    while (tile *t = args.queue->getWork(args.threadId, &sampleCount)) // fetch new work from the queue
     {
+        // interactive mode: the queue has an extra pass in front for the preview
+        if (p->interactive) {
+            if (sampleCount == 0) {
+                trace_preview(args, *t, p);
+                args.queue->markDirty(t);
+                if (!G_isRunning) {
+                    goto endthread;
+                }
+                continue;
+            }
+            sampleCount--;
+        }
+
+        if (p->wavefront) {
+            uint32 tileWidth = t->xMax - t->xMin;
+            tileColors.resize(size_t(tileWidth) * (t->yMax - t->yMin));
+
+            wavefront.trace_tile(*t, args.scene, sampleCount, tileColors.data());
+
+            for (uint32 y = t->yMin; y < t->yMax; y++) {
+                for (uint32 x = t->xMin; x < t->xMax; x++) {
+                    accumulate_sample(x, y, tileColors[(x - t->xMin) + (y - t->yMin) * tileWidth], sampleCount, p);
+                }
+            }
+            args.queue->markDirty(t);
+            retire_converged_tile(args, *t, sampleCount, p);
+
+            if (!G_isRunning) {
+                goto endthread;
+            }
+            continue;
+        }
+
         for (uint32 y = t->yMin; y < t->yMax; y++) {
-            for (uint32 x = t->xMin; x < t->xMax; x++) {
 
-                float u = (x + args.sample_dist[sampleCount].x) / (float) p->bufferWidth;
-                float v = (y + args.sample_dist[sampleCount].y) / (float) p->bufferHeight;
+            // neighbouring pixels in a row are traced as one packet if enabled
+            uint32 batchSize = p->rayPackets ? RAY_PACKET_SIZE : 1;
+            for (uint32 x0 = t->xMin; x0 < t->xMax; x0 += batchSize) {
 
-                ray r = args.scene.camera->get_ray(u, v);
+                uint32 n = std::min(batchSize, t->xMax - x0);
+                Vec3 colors[RAY_PACKET_SIZE];
+                sampler_state samplers[RAY_PACKET_SIZE];
+                ray_packet rp;
 
-                Vec3 color = trace(r, *args.scene.objects, args.scene.biased_objects, 0);
+                cost_probe probe;
+                if (G_costBuffer) probe.start();
+                for (uint32 i = 0; i < n; i++) {
+                    stage_timer clock;
+                    start_sample(x0 + i + y * p->bufferWidth, sampleCount);
+                    vec2 offset = sample_2d();
+                    float u = (x0 + i + offset.x) / (float) p->bufferWidth;
+                    float v = (y + offset.y) / (float) p->bufferHeight;
+
+                    ray r = args.scene.camera->get_ray(u, v);
+                    clock.lap(STAGE_CAMERA);
 
-                if (!isfinite(color.r) || !isfinite(color.g) || !isfinite(color.b)) {
-                    if (sampleCount > 0)
-                        color = G_linearBackBuffer[x + y * p->bufferWidth];
+                    if (p->rayPackets) {
+                        rp.set(i, r);
+                        samplers[i] = get_sampler_state();
+                    }
                     else
-                        color = Vec3(0.0f);
+                        colors[i] = trace(r, args.scene);
                 }
-
-                if (sampleCount > 0) {
-                    Vec3 old_color = G_linearBackBuffer[x + y * p->bufferWidth];
-                    color = old_color + (color - old_color) * (1.0f / (sampleCount + 1.0f)); // iterative average
+                if (p->rayPackets) {
+                    trace_packet(rp, samplers, (1u << n) - 1, args.scene, colors);
+                }
+                if (G_costBuffer) { // no packets, n == 1
+                    probe.add_to(&G_costBuffer[x0 + y * p->bufferWidth], 1);
                 }
 
-                float lum = luminance(color);
-                if (lum > p->maxLuminance) {
-                    color = color * (p->maxLuminance / lum);
+                for (uint32 i = 0; i < n; i++) {
+                    accumulate_sample(x0 + i, y, colors[i], sampleCount, p);
                 }
-                
-                G_linearBackBuffer[x + y * p->bufferWidth] = color;
-                //G_backBuffer[x + y * p->bufferWidth] = ARGB32(color.gamma_correct());
             }
             // periodically check if we want to exit prematurely
             if (!G_isRunning) {
                 goto endthread;
             }
         }
+        args.queue->markDirty(t);
+        retire_converged_tile(args, *t, sampleCount, p);
     }
 
 endthread:
@@ -243,6 +437,38 @@ endthread:
 }
 
 
+////////////////////////////
+//      TONE MAPPING      //
+////////////////////////////
+
+static tonemapper& getTonemapper() {
+    // the helper threads are started on first use and stay around
+    static tonemapper tonemapper(std::min(std::thread::hardware_concurrency(), 8u));
+    return tonemapper;
+}
+
+// converts the linear buffer to the display buffer
+static void tonemap(const MRT_Params *p) {
+    getTonemapper().run((tonemap_operator) p->tonemapOperator, G_linearBackBuffer, G_backBuffer, size_t(p->bufferWidth) * p->bufferHeight);
+}
+
+// window: converts only the tiles the workers wrote since the last frame, rects gets the parts of the display buffer that changed
+static void tonemapDirty(const MRT_Params *p, work_queue *queue, std::vector<MRT_Rect> *rects) {
+    static std::vector<uint32> dirty;
+    dirty.clear();
+    queue->takeDirty([](uint32 i) { dirty.push_back(i); });
+
+    if (getTonemapper().update((tonemap_operator) p->tonemapOperator, G_linearBackBuffer, G_backBuffer, p->bufferWidth, queue->worklist, dirty)) {
+        for (uint32 i : dirty) {
+            const tile& t = queue->worklist[i];
+            rects->push_back({ t.xMin, t.yMin, t.xMax - t.xMin, t.yMax - t.yMin });
+        }
+    }
+    else {
+        rects->push_back({ 0, 0, p->bufferWidth, p->bufferHeight });
+    }
+}
+
 ////////////////////////////
 //          INPUT         //
 ////////////////////////////
@@ -253,7 +479,18 @@ static KeyState rButtonState = MRT_NONE;
 //static KeyState shiftState   = MRT_NONE;
 //static KeyState altState     = MRT_NONE;
 
+// interactive mode, applied by the main loop once per frame
+static bool G_keysDown[256];
+static int32 G_mouseX, G_mouseY;
+static int32 G_mouseDragX, G_mouseDragY; // movement with the left button held since the last frame
+
 void MRT::MouseCallback(int32 x, int32 y, KeyState lButton, KeyState rButton) {
+    if (lButtonState == MRT_DOWN) {
+        G_mouseDragX += x - G_mouseX;
+        G_mouseDragY += y - G_mouseY;
+    }
+    G_mouseX = x;
+    G_mouseY = y;
     if (lButton != MRT_NONE) lButtonState = lButton;
     if (rButton != MRT_NONE) rButtonState = rButton;
 }
@@ -262,10 +499,30 @@ void MRT::KeyboardCallback(int keycode, KeyState state, KeyState prev) {
     static MRT_Params *p = getParams();
     if (state == MRT_DOWN && prev == MRT_UP)
         p->delay = false;
-    switch (keycode) {
-    case 'a':
-        break; // TODO
-    }
+    if (keycode >= 0 && keycode < 256)
+        G_keysDown[keycode] = (state == MRT_DOWN);
+}
+
+// interactive mode: turns the input since the last frame into a camera movement, false if the camera stays where it is
+static bool cameraInput(const scene& scene, float seconds, Vec3 *offset, float *yaw, float *pitch) {
+    const float turnSpeed = 0.005f; // radians per pixel
+
+    // scenes have no common scale, so the speed depends on the distance to whatever is in the center of the view
+    const camera& cam = *scene.camera;
+    hit_record hrec;
+    float distance = cam.focus_dist;
+    if (scene.objects->hit(ray(cam.origin, -cam.w, cam.time0), 0.001f, std::numeric_limits<float>::max(), &hrec))
+        distance = hrec.t;
+    float moveSpeed = 0.5f * distance * seconds;
+
+    *offset = Vec3(float(G_keysDown['D'] - G_keysDown['A']),
+                   float(G_keysDown['E'] - G_keysDown['Q']),
+                   float(G_keysDown['S'] - G_keysDown['W'])) * moveSpeed;
+    *yaw   = -G_mouseDragX * turnSpeed;
+    *pitch = -G_mouseDragY * turnSpeed;
+    G_mouseDragX = G_mouseDragY = 0;
+
+    return (dot(*offset, *offset) > 0) || (*yaw != 0) || (*pitch != 0);
 }
 
 void MRT::WindowCallback(WindowEvent e) {
@@ -280,118 +537,322 @@ void MRT::WindowCallback(WindowEvent e) {
 //          MAIN          //
 ////////////////////////////
 
-int main(int argc, char* argv[]) {
-    
-    MRT_PlatformInit();
+// window title, or the console in headless mode
+static void showStatus(const MRT_Params *p, const char *str) {
+    if (p->headless) {
+        int len = (int) strlen(str);
+        bool newline = (len > 0) && (str[len - 1] == '\n');
+        printf("\r%-100.*s%s", len - newline, str, newline ? "\n" : "");
+        fflush(stdout);
+    }
+    else {
+        MRT_SetWindowTitle(str);
+    }
+}
 
-    ParseArgv(argc, argv);
+static bool writeOutput(const MRT_Params *p, const char *filename) {
+    bool ok = writeImage(filename, G_backBuffer, G_linearBackBuffer, p->bufferWidth, p->bufferHeight);
+    if (ok) printf("Wrote %s\n", filename);
+    return ok;
+}
 
-    MRT_Params *p = getParams();
+// -stats and -stats-json, after a render that took seconds
+static bool reportStats(const MRT_Params *p, const stats_totals& stats, float seconds) {
+    if (p->printStats) stats_print(stats, seconds);
+    return !p->statsFile || stats_write_json(p->statsFile, stats, seconds);
+}
 
-    MRT_CreateWindow(p->windowWidth, p->windowHeight, p->bufferWidth, p->bufferHeight);
+// (re)allocates the frame buffers for the current resolution
+static void allocateBuffers(const MRT_Params *p) {
+    free(G_backBuffer);
+    free(G_linearBackBuffer);
+    free(G_varianceBuffer);
+    free(G_costBuffer);
 
     G_backBuffer = (uint32*) calloc(p->bufferWidth * p->bufferHeight, sizeof(*G_backBuffer));
-    MRT_DrawToWindow(G_backBuffer);
-
     G_linearBackBuffer = (Vec3*) calloc(p->bufferWidth * p->bufferHeight, sizeof(*G_linearBackBuffer));
+    G_varianceBuffer = nullptr;
+    if (p->noiseThreshold > 0)
+        G_varianceBuffer = (float*) calloc(p->bufferWidth * p->bufferHeight, sizeof(*G_varianceBuffer));
+    G_costBuffer = nullptr;
+    if (p->heatmapPrefix)
+        G_costBuffer = (pixel_cost*) calloc(p->bufferWidth * p->bufferHeight, sizeof(*G_costBuffer));
+}
 
-    /////////////////////////
-    // --- Setup Scene --- //
-    /////////////////////////
+// generates the selected scene and writes the generation time into title
+static scene generateScene(const MRT_Params *p, char *title, size_t titleSize) {
 
     Init_Thread_RNG(11350390909718046443uLL, 6305599193148252115uLL);
 
-    MRT_SetWindowTitle("MiniRayTracer - Generating Scene...");
-
     // start timer for scene generation
     uint64 t1_gen = MRT_GetTime();
 
     scene scene = select_scene((scenes) p->sceneSelect, float(p->bufferWidth) / float(p->bufferHeight));
 
-    // stop timer, display in window title
-    char windowTitle[64];
-    snprintf(windowTitle, sizeof(windowTitle), "MiniRayTracer - Scene: %.0fms", 1000.f * MRT_TimeDelta(t1_gen, MRT_GetTime()));
-    MRT_SetWindowTitle(windowTitle);
-
-    // setup sample distribution
-    // TODO: distribution for non-square numbers
-    //       unbiased distribution that converges earlier: Sobol sequence or others, see http://woo4.me/wootracer/2d-samplers/
-    uint32 sqrt_samples = (uint32) MRT::sqrt((float) p->samplesPerPixel);
-    uint32 numSamples = sqrt_samples * sqrt_samples;
-
-    vec2 *sample_dist = (vec2*) calloc(numSamples, sizeof(*sample_dist));
-
-    for (uint32 i = 0; i < sqrt_samples; i++) {
-        for (uint32 j = 0; j < sqrt_samples; j++) {
-            // sample distribution is a regular grid
-            float u_adjust = (i + 0.5f) / (float) sqrt_samples;
-            float v_adjust = (j + 0.5f) / (float) sqrt_samples;
-            sample_dist[i * sqrt_samples + j].x = u_adjust;
-            sample_dist[i * sqrt_samples + j].y = v_adjust;
-        }
-    }
+    // the original object tree stays alive, object primitives still reference it
+    if (p->compileScene)
+        scene.objects = new compiled_scene(scene.objects, scene.camera->time0, scene.camera->time1);
 
-    /////////////////////////////
-    // --- Multi-Threading --- //
-    /////////////////////////////
+    snprintf(title, titleSize, "MiniRayTracer - Scene: %.0fms (BVH: %.0fms)",
+             1000.f * MRT_TimeDelta(t1_gen, MRT_GetTime()), 1000.f * MRT_TimeDelta(0, G_bvhBuildTicks));
+    return scene;
+}
+
+// worker threads of one render
+struct render_threads {
+    work_queue *queue;
+    drawArgs *args;
+    std::thread *threads;
+    uint32 numSamples;
+};
+
+static render_threads startRender(const scene& scene, MRT_Params *p) {
+
+    // setup sample generation, sub-pixel offsets are the first two sample dimensions
+    Init_Sampler((sampler_type) p->samplerType);
+
+    render_threads r;
+
+    // adaptive sampling can spend up to maxSamples on tiles that do not converge
+    r.numSamples = (p->noiseThreshold > 0 && p->maxSamples) ? p->maxSamples : p->samplesPerPixel;
+    uint32 queueSamples = r.numSamples + (p->interactive ? 1 : 0); // draw2 traces the preview as pass 0
 
     if (p->numThreads == 0) {
         // ALL YOUR PROCESSOR ARE BELONG TO US!
         p->numThreads = std::thread::hardware_concurrency();
     }
-    
+
     typedef unsigned int(__stdcall *thread_fn)(void*);
     thread_fn thread_fun;
-    work_queue *queue = nullptr;
 
     if (p->threadingMode == 0) {
         thread_fun = draw;
-        queue = new work_queue_seq(p->bufferWidth, p->bufferHeight, p->tileSize, p->numThreads);
+        r.queue = new work_queue_seq(p->bufferWidth, p->bufferHeight, p->tileSize, p->numThreads);
     }
     else if (p->threadingMode == 1) {
         thread_fun = draw2;
-        queue = new work_queue_dynamic(p->bufferWidth, p->bufferHeight, p->tileSize, p->numThreads, numSamples);
+        r.queue = new work_queue_dynamic(p->bufferWidth, p->bufferHeight, p->tileSize, p->numThreads, queueSamples);
+    }
+    else {
+        thread_fun = draw2;
+        r.queue = new work_queue_stealing(p->bufferWidth, p->bufferHeight, p->tileSize, p->numThreads, queueSamples);
     }
 
     // setup function arguments for the worker threads
-    drawArgs *threadArgs = (drawArgs*) calloc(p->numThreads, sizeof(drawArgs));
+    r.args = (drawArgs*) calloc(p->numThreads, sizeof(drawArgs));
     for (uint32 i = 0; i < p->numThreads; i++) {
-        threadArgs[i].initstate = (uint64(rand32()) << 32) | rand32();
-        threadArgs[i].initseq   = (uint64(rand32()) << 32) | rand32();
-        threadArgs[i].queue = queue;
-        threadArgs[i].scene = scene;
-        threadArgs[i].sample_dist = sample_dist;
-        threadArgs[i].numSamples = numSamples;
-        threadArgs[i].threadId = i;
+        r.args[i].initstate = (uint64(rand32()) << 32) | rand32();
+        r.args[i].initseq   = (uint64(rand32()) << 32) | rand32();
+        r.args[i].queue = r.queue;
+        r.args[i].scene = scene;
+        r.args[i].numSamples = r.numSamples;
+        r.args[i].threadId = i;
+    }
+
+    stats_reset();
+    getTonemapper().reset(r.queue->numTiles);
+
+    // start worker threads
+    r.threads = new std::thread[p->numThreads];
+    for (size_t i = 0; i < p->numThreads; i++) {
+        void* args = &r.args[i];
+        r.threads[i] = std::thread(thread_fun, args);
+    }
+    return r;
+}
+
+// waits for the workers to finish, set G_isRunning to false before to stop them early
+static void joinRender(render_threads *r, const MRT_Params *p) {
+    for (size_t i = 0; i < p->numThreads; i++) {
+        r->threads[i].join();
+    }
+    delete[] r->threads;
+    free(r->args);
+    delete r->queue;
+}
+
+// packs the linear buffer into an image the client can use
+static void sendFrame(render_server *server, const render_job& job, uint32 samples, const MRT_Params *p) {
+    if (job.stream == STREAM_LDR)
+        tonemap(p);
+    server->sendFrame(job, samples, G_backBuffer, G_linearBackBuffer);
+}
+
+// renders the jobs of the render server one after another until it is shut down
+static int runServer(MRT_Params *p) {
+
+    render_server server;
+    if (!server.start(p->serverAddress, *p)) {
+        fprintf(stderr, "Could not listen on %s\n", p->serverAddress);
+        return 1;
     }
+    printf("Render server listening on %s\n", p->serverAddress);
+
+    // scenes are only generated once per scene, aspect ratio and compile mode, jobs usually reuse them
+    struct cached_scene {
+        uint32 sceneSelect;
+        uint32 bufferWidth, bufferHeight;
+        uint32 compileScene;
+        scene scene;
+    };
+    std::vector<cached_scene> scenes;
+
+    while (!server.isShutdown()) {
+
+        server.poll(100);
+        if (server.isShutdown())
+            break;
+        std::unique_ptr<render_job> job = server.nextJob();
+        if (!job)
+            continue;
+
+        *p = job->params;
+
+        const scene *jobScene = nullptr;
+        for (const cached_scene& c : scenes) {
+            if (c.sceneSelect == p->sceneSelect && uint64(c.bufferWidth) * p->bufferHeight == uint64(p->bufferWidth) * c.bufferHeight
+                && c.compileScene == p->compileScene)
+                jobScene = &c.scene;
+        }
+        if (!jobScene) {
+            char title[64];
+            scenes.push_back({ p->sceneSelect, p->bufferWidth, p->bufferHeight, p->compileScene, generateScene(p, title, sizeof(title)) });
+            jobScene = &scenes.back().scene;
+            printf("%s\n", title);
+        }
+
+        allocateBuffers(p);
+
+        uint64 t1_trace = MRT_GetTime();
+        render_threads render = startRender(*jobScene, p);
+        server.beginJob(*job, render.numSamples);
+
+        // a frame goes out whenever another sample pass is complete, work_queue_seq only knows about finished tiles
+        uint32 samplesSent = 0;
+        for (;;) {
+            server.poll(1000u / 30);
+
+            if (server.isActiveCancelled()) {
+                G_isRunning = false;
+                break;
+            }
+
+            float pctDone = render.queue->getPercentDone();
+            if (pctDone == 100.0f)
+                break;
+
+            uint32 samplesDone = (p->threadingMode == 0) ? 0 : uint32(pctDone * render.numSamples / 100.0f);
+            if (samplesDone > samplesSent) {
+                samplesSent = samplesDone;
+                sendFrame(&server, *job, samplesSent, p);
+            }
+        }
+
+        joinRender(&render, p);
+        G_isRunning = true;
+        float secondsElapsed = MRT_TimeDelta(t1_trace, MRT_GetTime());
+
+        if (!server.isActiveCancelled()) {
+            sendFrame(&server, *job, render.numSamples, p);
+
+            tonemap(p);
+            if (p->outputFile)    writeOutput(p, p->outputFile);
+            if (p->outputFileHDR) writeOutput(p, p->outputFileHDR);
+
+            stats_totals stats = stats_collect();
+            printf("Job %u: %.2fs - %.3f Mrays/s\n", job->id, secondsElapsed, (stats.ray_count() * 0.000001f) / secondsElapsed);
+            reportStats(p, stats, secondsElapsed);
+        }
+        server.finishJob(*job, secondsElapsed);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    
+    ParseArgv(argc, argv);
+
+    MRT_Params *p = getParams();
+
+    MRT_PlatformInit(p->headless);
+
+    if (p->serverAddress) {
+        int result = runServer(p);
+        MRT_PlatformDestroy();
+        return result;
+    }
+
+    if (!p->headless)
+        MRT_CreateWindow(p->windowWidth, p->windowHeight, p->bufferWidth, p->bufferHeight);
+
+    allocateBuffers(p);
+    if (!p->headless)
+        MRT_DrawToWindow(G_backBuffer);
+
+    /////////////////////////
+    // --- Setup Scene --- //
+    /////////////////////////
+
+    showStatus(p, "MiniRayTracer - Generating Scene...");
+
+    // display scene generation time in window title
+    char windowTitle[64];
+    scene scene = generateScene(p, windowTitle, sizeof(windowTitle));
+    showStatus(p, windowTitle);
 
     // delayed start for recording
-    while (p->delay && G_isRunning) {
+    while (p->delay && !p->headless && G_isRunning) {
         MRT_HandleMessages();
         MRT_Sleep(33);
     }
 
+    /////////////////////////////
+    // --- Multi-Threading --- //
+    /////////////////////////////
+
     // start time for ray tracer
     uint64 t1_trace = MRT_GetTime();
 
-    // start worker threads
-    std::thread *threads = new std::thread[p->numThreads];
-    for (size_t i = 0; i < p->numThreads; i++) {
-        void* args = &threadArgs[i];
-        threads[i] = std::thread(thread_fun, args);
-    }
+    render_threads render = startRender(scene, p);
+    work_queue *queue = render.queue;
 
-    static uint32 updateFreq = 30;
+    // headless mode only polls for completion, there is nothing to display
+    static uint32 updateFreq = p->headless ? 10 : 30;
+    uint32 statusCounter = 0;
     bool isTracing = true;
+    float secondsElapsed = 0;
+    uint64 lastFrame = MRT_GetTime();
+    std::vector<MRT_Rect> dirtyRects;
     
     while (G_isRunning) {
 
         MRT_HandleMessages();
         MRT_Sleep(1000u / updateFreq);
 
+        // interactive mode: stop the workers where they are, move the camera and start over with the preview pass
+        uint64 now = MRT_GetTime();
+        Vec3 offset;
+        float yaw, pitch;
+        if (p->interactive && G_isRunning && cameraInput(scene, MRT_TimeDelta(lastFrame, now), &offset, &yaw, &pitch)) {
+            G_isRunning = false;
+            joinRender(&render, p);
+            G_isRunning = true;
+
+            scene.camera->move(offset, yaw, pitch);
+            memset(G_linearBackBuffer, 0, p->bufferWidth * p->bufferHeight * sizeof(*G_linearBackBuffer));
+            if (G_varianceBuffer)
+                memset(G_varianceBuffer, 0, p->bufferWidth * p->bufferHeight * sizeof(*G_varianceBuffer));
+
+            t1_trace = MRT_GetTime();
+            render = startRender(scene, p);
+            queue = render.queue;
+            isTracing = true;
+        }
+        lastFrame = now;
+
         if (isTracing) {
             // display elapsed time in window title
-            float secondsElapsed = MRT_TimeDelta(t1_trace, MRT_GetTime());
+            secondsElapsed = MRT_TimeDelta(t1_trace, MRT_GetTime());
             float pctDone = queue->getPercentDone();
 
             static char buf[128];
@@ -400,99 +861,44 @@ int main(int argc, char* argv[]) {
                 isTracing = false;
                 updateFreq = 30;
 
-                size_t rays = G_rayCounter;
+                size_t rays = stats_collect().ray_count();
                 snprintf(buf, sizeof(buf), "%s - Trace: %.2fs - %.3f Mrays/s | %.3f us/ray\n",
                          windowTitle, secondsElapsed, ((rays * 0.000001f) / secondsElapsed), (secondsElapsed * 1000000.0f) / rays);
-                MRT_SetWindowTitle(buf);
+                showStatus(p, buf);
             }
-            else {
+            else if (!p->headless || (statusCounter++ % updateFreq) == 0) {
                 float eta = secondsElapsed * (100.0f / pctDone) - secondsElapsed;
                 snprintf(buf, sizeof(buf), "%s - Trace: %.2fs (%.0f%% - ETA %.0fs)", windowTitle, secondsElapsed, pctDone, eta);
-                MRT_SetWindowTitle(buf);
+                showStatus(p, buf);
             }
 
-            MRT_ReportProgress((uint64_t)pctDone, 100);
-
-#if 1
-            {
-                // Adaptive Logarithmic Mapping For Displaying Contrast Scenes
-                // http://resources.mpi-inf.mpg.de/tmo/logmap/logmap.pdf
-
-                float L_dmax = 230.0f; // reference maximum display brightness in cd/m^2
-                float bias = logf(0.7f) / logf(0.5f); // tune the numerator!
-
-                float L_wmax = 0;
-                for (size_t y = 0; y < p->bufferHeight; y++) {
-                    for (size_t x = 0; x < p->bufferWidth; x++) {
-                        float lum = luminance(G_linearBackBuffer[x + y * p->bufferWidth]);
-                        L_wmax = std::max(L_wmax, lum);
-                    }
-                }
-                float invlogmax = 1.0f / log10f(L_wmax + 1.0f);
-                float invmax = 1.0f / L_wmax;
-
-                for (size_t y = 0; y < p->bufferHeight; y++) {
-                    for (size_t x = 0; x < p->bufferWidth; x++) {
-                        Vec3 color = G_linearBackBuffer[x + y * p->bufferWidth];
-                        float lum = luminance(color);
-                        float loglw = logf(lum + 1.0f);
-                        float lum_new = (L_dmax * 0.01f * invlogmax) * (loglw / logf(2 + powf(lum * invmax, bias) * 8));
-                        color = (lum_new * color) / (lum + 0.00001f);
-                        G_backBuffer[x + y * p->bufferWidth] = ARGB32(color);
-                    }
-                }
-            }
-#elif 1
-            {
-                // Photographic Tone Reproduction for Digital Images
-                // http://www.cs.utah.edu/~reinhard/cdrom/tonemap.pdf
-
-                float a = 0.10f; // "key value" (middle gray)
-                float sigma = 0.00001f;
-                float scale = 1.0f / (p->bufferWidth * p->bufferHeight);
-                float logavg = 0;
-                float L_wmax = 0;
-                for (size_t y = 0; y < p->bufferHeight; y++) {
-                    for (size_t x = 0; x < p->bufferWidth; x++) {
-                        float lum = luminance(G_linearBackBuffer[x + y * p->bufferWidth]);
-                        logavg += logf(sigma + lum);
-                        L_wmax = std::max(L_wmax, lum);
-                    }
-                }
-                logavg = exp(scale * logavg); // NOTE: in the paper, 1/N (scale) is in the wrong place, producing inf/nan values
-                float invlogavg = 1.0f / logavg;
-                float invmax = 1.0f / L_wmax;
-
-                for (size_t y = 0; y < p->bufferHeight; y++) {
-                    for (size_t x = 0; x < p->bufferWidth; x++) {
-                        Vec3 color = G_linearBackBuffer[x + y * p->bufferWidth];
-                        float lum = luminance(color);
-                        float lum_new = a * invlogavg * lum;
-                        lum_new = lum_new * (1 + lum_new * (invmax*invmax)) / (1 + lum_new);
-                        color = (lum_new * color) / (lum + sigma);
-                        G_backBuffer[x + y * p->bufferWidth] = ARGB32(color);
-                    }
-                }
-            }
-#else
-            // simple gamma correction
-            for (size_t y = 0; y < p->bufferHeight; y++) {
-                for (size_t x = 0; x < p->bufferWidth; x++) {
-                    G_backBuffer[x + y * p->bufferWidth] = ARGB32(gamma_correct(G_linearBackBuffer[x + y * p->bufferWidth]));
-                }
+            if (p->headless) {
+                if (!isTracing) break;
+                continue;
             }
-#endif
+
+            MRT_ReportProgress((uint64_t)pctDone, 100);
         }
 
-        MRT_DrawToWindow(G_backBuffer);
+        // also after the queue ran out, the last tiles may still be in progress
+        dirtyRects.clear();
+        tonemapDirty(p, queue, &dirtyRects);
+        MRT_DrawToWindow(G_backBuffer, dirtyRects.data(), dirtyRects.size());
     }
 
     // wait for threads to finish
-    for (size_t i = 0; i < p->numThreads; i++) {
-        threads[i].join();
+    joinRender(&render, p);
+
+    int result = 0;
+    if (p->headless) {
+        tonemap(p);
+        if (p->outputFile    && !writeOutput(p, p->outputFile))    result = 1;
+        if (p->outputFileHDR && !writeOutput(p, p->outputFileHDR)) result = 1;
+        if (p->heatmapPrefix && !write_heatmaps(p->heatmapPrefix, G_costBuffer, p->bufferWidth, p->bufferHeight)) result = 1;
     }
+    if (!reportStats(p, stats_collect(), secondsElapsed)) result = 1;
 
     MRT_PlatformDestroy();
 
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
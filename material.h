@@ -12,12 +12,28 @@
 struct scatter_record {
     ray specular_ray;
     Vec3 attenuation;
+    pdf bsdf;        // not specular only: density of the scattered directions
     bool is_specular;
+    bool is_transmission = false; // specular only: the ray went through the surface (see path.h)
+};
+
+// used to group shading work by material in the wavefront integrator and to dispatch the calls below without virtual calls
+enum material_type : uint8 {
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_ISOTROPIC,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_DIFFUSE_LIGHT,
+    MATERIAL_TYPE_COUNT
 };
 
 class material {
 public:
-    virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const {
+    const material_type type;
+
+    material(material_type type) : type(type) {}
+
+    virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const {
         return false;
     }
     virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
@@ -35,7 +51,7 @@ class lambertian final : public material {
 public:
     texture *albedo;
 
-    lambertian(texture *albedo) : albedo(albedo) {};
+    lambertian(texture *albedo) : material(MATERIAL_LAMBERTIAN), albedo(albedo) {};
 
     float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
         float cosine = dot(rec.n, scattered.dir);
@@ -45,10 +61,10 @@ public:
             return cosine * (1.0f / M_PI_F);
     }
 
-    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const override {
+    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const override {
         srec->is_specular = false;
-        srec->attenuation = albedo->sample(hrec.u, hrec.v, hrec.p);
-        new (pdf_storage) cosine_pdf(hrec.n);
+        srec->attenuation = sample_texture(albedo, hrec.u, hrec.v, hrec.p);
+        srec->bsdf = pdf::cosine(hrec.n);
         return true;
     }
 };
@@ -59,16 +75,16 @@ class isotropic final : public material {
 public:
     texture *albedo;
 
-    isotropic(texture *albedo) : albedo(albedo) {};
+    isotropic(texture *albedo) : material(MATERIAL_ISOTROPIC), albedo(albedo) {};
     
     float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
-        return 1.0f / (2.0f * M_PI_F);
+        return 1.0f / (4.0f * M_PI_F);
     }
 
-    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const override {
+    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const override {
         srec->is_specular = false;
-        srec->attenuation = albedo->sample(hrec.u, hrec.v, hrec.p);
-        new (pdf_storage) isotropic_pdf(hrec.n);
+        srec->attenuation = sample_texture(albedo, hrec.u, hrec.v, hrec.p);
+        srec->bsdf = pdf::isotropic();
         return true;
     }
 };
@@ -81,19 +97,19 @@ public:
     texture *albedo;
     float gloss;
 
-    metal(texture* albedo, float gloss) : albedo(albedo) {
+    metal(texture* albedo, float gloss) : material(MATERIAL_METAL), albedo(albedo) {
         this->gloss = std::min(gloss, 1.0f);
     }
 
     float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
         return 0;
     }
-    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const override {
+    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const override {
 
         Vec3 reflected = reflect(r_in.dir, hrec.n);
         srec->specular_ray = ray(hrec.p, reflected + (1 - gloss) * random_in_sphere(), r_in.time); //TODO: fix direction, could be (0,0,0).
         srec->is_specular = true;
-        srec->attenuation = albedo->sample(hrec.u, hrec.v, hrec.p);
+        srec->attenuation = sample_texture(albedo, hrec.u, hrec.v, hrec.p);
         return true;
     }
 };
@@ -113,12 +129,12 @@ class dielectric final : public material {
 public:
     float ref_index;
     
-    dielectric(float ref_index) : ref_index(ref_index) {}
+    dielectric(float ref_index) : material(MATERIAL_DIELECTRIC), ref_index(ref_index) {}
 
     float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
         return 0;
     }
-    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const override {
+    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const override {
        
         srec->attenuation = Vec3(1.0f);
         srec->is_specular = true;
@@ -170,6 +186,7 @@ public:
                 inside++; // if we hit a frontface we are now inside this volume
             }
             srec->specular_ray = ray(hrec.p, refracted, r_in.time, inside);
+            srec->is_transmission = true;
         }
         return true;
     }
@@ -177,25 +194,61 @@ public:
 
 //////////// DIFFUSE LIGHT ////////////
 
+// index of an emitter in the light list (see light.h) if it is not in there
+#define NO_LIGHT UINT32_MAX
+
 class diffuse_light final : public material {
 public:
     texture *emissive;
     float scale;
+    uint32 light_index = NO_LIGHT;
 
-    diffuse_light(texture *emissive, float scale = 1.0f) : emissive(emissive), scale(scale) {};
+    diffuse_light(texture *emissive, float scale = 1.0f) : material(MATERIAL_DIFFUSE_LIGHT), emissive(emissive), scale(scale) {};
 
     float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
         return 0;
     }
-    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec, pdf *pdf_storage) const override {
+    bool scatter(const ray& r_in, const hit_record& hrec, scatter_record *srec) const override {
         return false;
     }
     Vec3 sampleEmissive(const ray& r_in, const hit_record& rec) const override {
         
         if (dot(rec.n, r_in.dir) < 0.0f)
-            return scale * emissive->sample(rec.u, rec.v, rec.p);
+            return scale * sample_texture(emissive, rec.u, rec.v, rec.p);
         else
             return Vec3(0.0f);
     }
 };
 
+////////////// DISPATCH //////////////
+
+// all material classes are final, so the calls below are resolved statically
+
+inline bool material_scatter(const material *m, const ray& r_in, const hit_record& hrec, scatter_record *srec) {
+    switch (m->type) {
+    case MATERIAL_LAMBERTIAN:    return static_cast<const lambertian*>(m)->scatter(r_in, hrec, srec);
+    case MATERIAL_ISOTROPIC:     return static_cast<const isotropic*>(m)->scatter(r_in, hrec, srec);
+    case MATERIAL_METAL:         return static_cast<const metal*>(m)->scatter(r_in, hrec, srec);
+    case MATERIAL_DIELECTRIC:    return static_cast<const dielectric*>(m)->scatter(r_in, hrec, srec);
+    case MATERIAL_DIFFUSE_LIGHT: return false;
+    default:                     return m->scatter(r_in, hrec, srec);
+    }
+}
+
+inline float material_scattering_pdf(const material *m, const ray& r_in, const hit_record& rec, const ray& scattered) {
+    switch (m->type) {
+    case MATERIAL_LAMBERTIAN: return static_cast<const lambertian*>(m)->scattering_pdf(r_in, rec, scattered);
+    case MATERIAL_ISOTROPIC:  return static_cast<const isotropic*>(m)->scattering_pdf(r_in, rec, scattered);
+    case MATERIAL_METAL:
+    case MATERIAL_DIELECTRIC:
+    case MATERIAL_DIFFUSE_LIGHT: return 0;
+    default:                  return m->scattering_pdf(r_in, rec, scattered);
+    }
+}
+
+inline Vec3 material_emitted(const material *m, const ray& r_in, const hit_record& rec) {
+    if (m->type == MATERIAL_DIFFUSE_LIGHT)
+        return static_cast<const diffuse_light*>(m)->sampleEmissive(r_in, rec);
+    else
+        return Vec3(0.0f);
+}
@@ -0,0 +1,101 @@
+#include "mesh.h"
+
+#define TRI_EPS 0.00001f
+
+// same test as triangle::hit()
+bool mesh_triangle::hit(const ray& r, float tmin, float tmax, hit_record* rec) const {
+    STAT_ADD(prim_tests, 1);
+    Vec3 m = buffers->position(v0);
+    Vec3 u = buffers->position(v1) - m;
+    Vec3 v = buffers->position(v2) - m;
+
+    Vec3 pvec = cross(r.dir, v);
+    float det = dot(u, pvec);
+
+    float sign = 1.0f;
+    if (r.isInside) {
+        sign = det < 0.0f ? -1.0f : 1.0f;
+        det = sign * det;
+    }
+
+    if (det < TRI_EPS)
+        return false;
+
+    Vec3 tvec = r.origin - m;
+    float uu = dot(tvec, pvec) * sign;
+
+    Vec3 qvec = cross(tvec, u);
+    float vv = dot(r.dir, qvec) * sign;
+    if ((uu < 0) | (uu > det) | (vv < 0) | ((uu + vv) > det))
+        return false;
+
+    float invDet = 1 / det;
+    float t = dot(v, qvec) * invDet * sign;
+
+    if ((t < tmin) | (t > tmax))
+        return false;
+
+    uu *= invDet;
+    vv *= invDet;
+    float ww = 1 - uu - vv;
+
+    rec->t = t;
+    rec->p = r.eval(t);
+    if (buffers->has_normals())
+        rec->n = ((buffers->normal(v0) * ww) + (buffers->normal(v1) * uu) + (buffers->normal(v2) * vv)).normalize();
+    else
+        rec->n = cross(u, v).normalize();
+
+    if (buffers->has_uvs()) {
+        rec->u = buffers->tu[v0] * ww + buffers->tu[v1] * uu + buffers->tu[v2] * vv;
+        rec->v = buffers->tv[v0] * ww + buffers->tv[v1] * uu + buffers->tv[v2] * vv;
+    }
+    else {
+        rec->u = uu;
+        rec->v = vv;
+    }
+    return true;
+}
+
+uint32 mesh_triangle::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+    Vec3 m = buffers->position(v0);
+    mask = triangle_packet_test(m, buffers->position(v1) - m, buffers->position(v2) - m, rp, mask, tmin, tmax);
+    return hit_packet_single(*this, rp, mask, tmin, tmax, rec);
+}
+
+/////////////////////////////////////////
+
+mesh::mesh(std::unique_ptr<mesh_buffers> buffers, material *mat, float time0, float time1) : buffers(std::move(buffers)), mat_ptr(mat) {
+    const mesh_buffers *b = this->buffers.get();
+    tri_count = b->triangle_count();
+
+    auto tris = std::make_unique_for_overwrite<mesh_triangle[]>(tri_count);
+    for (size_t i = 0; i < tri_count; i++) {
+        tris[i] = { b, b->indices[3 * i], b->indices[3 * i + 1], b->indices[3 * i + 2] };
+    }
+    bvh = std::make_unique<wide_bvh<mesh_triangle, BVH_WIDTH>>(tris.get(), tri_count, time0, time1);
+
+    // the BVH leaves hold the indices now
+    this->buffers->indices.clear();
+    this->buffers->indices.shrink_to_fit();
+}
+
+bool mesh::hit(const ray& r, float tmin, float tmax, hit_record* rec) const {
+    if (bvh->hit(r, tmin, tmax, rec)) {
+        rec->mat_ptr = mat_ptr;
+        return true;
+    }
+    return false;
+}
+
+uint32 mesh::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+    uint32 hits = bvh->hit_packet(rp, mask, tmin, tmax, rec);
+    for (uint32 m = hits; m; m &= m - 1) {
+        rec[MRT::tzcnt(m)].mat_ptr = mat_ptr;
+    }
+    return hits;
+}
+
+bool mesh::bounding_box(aabb* box, float time0, float time1) const {
+    return bvh->bounding_box(box, time0, time1);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "scene_object.h"
+#include "wide_bvh.h"
+#include <memory>
+#include <vector>
+
+// Indexed triangle mesh with one material. Vertices are shared between triangles and every attribute component
+// has its own array, the BVH leaves only hold the vertex indices of their triangles.
+
+struct mesh_buffers {
+    std::vector<float> px, py, pz; // positions
+    std::vector<float> nx, ny, nz; // vertex normals, empty for flat shading
+    std::vector<float> tu, tv;     // texture coordinates, empty to use the barycentric coordinates like triangle
+    std::vector<uint32> indices;   // 3 per triangle, moved into the BVH when the mesh is created
+
+    size_t vertex_count() const { return px.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+    bool has_normals() const { return !nx.empty(); }
+    bool has_uvs() const { return !tu.empty(); }
+
+    Vec3 position(uint32 i) const { return Vec3(px[i], py[i], pz[i]); }
+    Vec3 normal(uint32 i) const { return Vec3(nx[i], ny[i], nz[i]); }
+
+    void add_position(const Vec3& p) {
+        px.push_back(p.x);
+        py.push_back(p.y);
+        pz.push_back(p.z);
+    }
+    void add_normal(const Vec3& n) {
+        nx.push_back(n.x);
+        ny.push_back(n.y);
+        nz.push_back(n.z);
+    }
+    void add_triangle(uint32 a, uint32 b, uint32 c) {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+};
+
+// BVH primitive, the material is filled in by the mesh after the traversal
+struct mesh_triangle {
+    const mesh_buffers *buffers;
+    uint32 v0, v1, v2;
+
+    bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const;
+
+    Vec3 get_centroid() const {
+        return (buffers->position(v0) + buffers->position(v1) + buffers->position(v2)) * (1.0f / 3.0f);
+    }
+    void add_to_box(aabb* box) const {
+        Vec3 a = buffers->position(v0);
+        Vec3 b = buffers->position(v1);
+        Vec3 c = buffers->position(v2);
+        box->min = vmin(box->min, vmin(a, b, c));
+        box->max = vmax(box->max, vmax(a, b, c));
+    }
+};
+
+class mesh final : public scene_object {
+    std::unique_ptr<mesh_buffers> buffers; // referenced by the BVH primitives
+    std::unique_ptr<wide_bvh<mesh_triangle, BVH_WIDTH>> bvh;
+    size_t tri_count;
+    material *mat_ptr;
+public:
+    mesh(std::unique_ptr<mesh_buffers> buffers, material *mat, float time0, float time1);
+    // takes a BVH that was built for these buffers before, its primitives must already point to them
+    mesh(std::unique_ptr<mesh_buffers> buffers, std::unique_ptr<wide_bvh<mesh_triangle, BVH_WIDTH>> bvh, size_t tri_count, material *mat)
+        : buffers(std::move(buffers)), bvh(std::move(bvh)), tri_count(tri_count), mat_ptr(mat) {}
+
+    bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
+    bool bounding_box(aabb* box, float time0, float time1) const override;
+    size_t get_triangle_count() const { return tri_count; }
+    const mesh_buffers& get_buffers() const { return *buffers; }
+    const wide_bvh<mesh_triangle, BVH_WIDTH>& get_bvh() const { return *bvh; }
+};
@@ -63,11 +63,37 @@ namespace MRT {
         _BitScanReverse(&i, v);
         i = 31 - i;
 #else
-#error INSERT LZCNT INTRINSIC HERE
+        uint32 i = __builtin_clz(v);
 #endif
         return i;
     }
 
+    // v must not be 0
+    inline uint32 tzcnt(uint32 v) {
+#if _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, v);
+#else
+        uint32 i = __builtin_ctz(v);
+#endif
+        return i;
+    }
+
+    // v must not be 0
+    inline uint32 tzcnt(uint64 v) {
+#if _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i, v);
+#else
+        uint32 i = __builtin_ctzll(v);
+#endif
+        return i;
+    }
+
+    inline uint32 popcnt(uint32 v) {
+        return _mm_popcnt_u32(v);
+    }
+
     inline uint32 log2U32(uint32 v) {
         if (v == 0) return 0;
         else        return 31 - lzcnt(v);
@@ -1,163 +1,659 @@
 #include "obj_loader.h"
 #include <stdio.h>
 #include <string.h>
+#include <math.h> // pow
+#include <stddef.h> // offsetof
+#include <string>
 #include <vector>
-#include <utility> // std::swap
+#include <thread>
+#include <unordered_map>
+#include <filesystem>
+#include <algorithm>
 #include "platform.h"
 
-#ifndef _MSC_VER
-#define fscanf_s fscanf
-#endif
+// OBJ files are mapped into memory and split into chunks of whole lines that are parsed by several threads.
+// Every chunk collects its own vertex attributes and faces, they are merged once all chunks are done.
 
-#define OBJ_LOADER_DEBUG true
+#define OBJ_MIN_CHUNK_SIZE (1u << 20)
 
-std::unique_ptr<triangle[]> readObj(const char* filename, material* mat, size_t* numTris, bool flip_triangles, const Mat4& scale, const Vec3& translate, const Mat4& rotate) {
-    std::vector<Vec3> verts;
-    std::vector<Vec3> norms;
-    std::vector<triangle> polys; // TODO: this creates an unnecessary copy but is easier for now, we're not really worried about scene build cost anyways
-
-    Mat4 invRot = Mat4::Invert(rotate);
+struct obj_uv {
+    float u, v;
+};
 
-    FILE* f = fopen(filename, "r");
+// face corner, 0-based indices or -1 if the attribute is missing
+struct obj_corner {
+    int32 v, t, n;
 
-    if (f) {
+    bool operator==(const obj_corner& o) const {
+        return v == o.v && t == o.t && n == o.n;
+    }
+};
+
+struct obj_corner_hash {
+    size_t operator()(const obj_corner& c) const {
+        uint64 h = uint64(uint32(c.v)) * 0x9E3779B97F4A7C15ull;
+        h ^= uint64(uint32(c.t)) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+        h ^= uint64(uint32(c.n)) + 0x8CB92BA72F3D8DD7ull + (h << 6) + (h >> 2);
+        return size_t(h);
+    }
+};
+
+// negative OBJ indices count back from the last element before the face, which is only known relative to the chunk while parsing
+enum obj_relative_bits : uint8 {
+    OBJ_REL_V = 1,
+    OBJ_REL_T = 2,
+    OBJ_REL_N = 4
+};
+
+struct obj_chunk {
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<obj_uv> uvs;
+    std::vector<obj_corner> corners; // 3 per triangle
+    std::vector<uint8> relative;     // obj_relative_bits per corner
+    uint32 errors = 0;
+};
+
+struct obj_transform {
+    Mat4 scale;
+    Mat4 rotate;
+    Mat4 invRot;
+    Vec3 translate;
+};
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && is_blank(*p))
+        p++;
+    return p;
+}
+
+// returns the start of the next line
+static const char* next_line(const char* p, const char* end) {
+    const char* nl = (const char*) memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static bool parse_int(const char** pp, const char* end, int32* out) {
+    const char* p = *pp;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    if (p >= end || !is_digit(*p))
+        return false;
 
-        float x, y, z;
-        Vec3 a, b, c;
-        Vec3 an, bn, cn;
+    int64 v = 0;
+    while (p < end && is_digit(*p)) {
+        v = std::min(v * 10 + (*p - '0'), int64(INT32_MAX)); // out of range indices fail the range check later
+        p++;
+    }
+    *out = int32(neg ? -v : v);
+    *pp = p;
+    return true;
+}
+
+// no locale, no null terminator needed, exact enough for floats
+static bool parse_float(const char** pp, const char* end, float* out) {
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* p = *pp;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
 
-        while (!feof(f)) {
+    uint64 mantissa = 0;
+    int32 exponent = 0;
+    bool any_digits = false;
+    while (p < end && is_digit(*p)) {
+        if (mantissa < 1000000000000000000ull)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            exponent++;
+        any_digits = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && is_digit(*p)) {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+            any_digits = true;
+            p++;
+        }
+    }
+    if (!any_digits)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        int32 e;
+        if (parse_int(&q, end, &e)) {
+            exponent += std::clamp(e, -1000, 1000);
+            p = q;
+        }
+    }
 
-            char s = (char) getc(f);
+    double value = double(mantissa);
+    if (exponent < 0)
+        value = (exponent >= -22) ? value / pow10[-exponent] : value * pow(10.0, exponent);
+    else if (exponent > 0)
+        value = (exponent <= 22) ? value * pow10[exponent] : value * pow(10.0, exponent);
+
+    *out = float(neg ? -value : value);
+    *pp = p;
+    return true;
+}
+
+// returns the number of floats read, up to n
+static int parse_floats(const char* p, const char* end, float* out, int n) {
+    int i = 0;
+    for (; i < n; i++) {
+        p = skip_blanks(p, end);
+        if (!parse_float(&p, end, &out[i]))
+            break;
+    }
+    return i;
+}
 
-            if (s == '#') { // comment
-                char buf[64] = { 0 };
-                do {
-                    fgets(buf, sizeof(buf), f);
-                } while (buf[strlen(buf) - 1] != '\n' && !feof(f)); // read until newline
+static bool resolve_index(int32 idx, size_t local_count, uint8 rel_bit, int32* out, uint8* rel) {
+    if (idx > 0) {
+        *out = idx - 1;
+        return true;
+    }
+    if (idx < 0) {
+        *out = int32(local_count) + idx; // may point into a previous chunk
+        *rel |= rel_bit;
+        return true;
+    }
+    return false; // 0 is not a valid index
+}
+
+static void parse_chunk(const char* p, const char* end, const obj_transform& xf, bool flip_triangles, obj_chunk* c) {
+    std::vector<obj_corner> face;
+    std::vector<uint8> face_rel;
+
+    while (p < end) {
+        p = skip_blanks(p, end);
+        if (p >= end)
+            break;
+
+        const char* line_end = next_line(p, end);
+        char c0 = p[0];
+        char c1 = (p + 1 < line_end) ? p[1] : '\n';
+        char c2 = (p + 2 < line_end) ? p[2] : '\n';
+
+        if (c0 == 'v' && is_blank(c1)) { // vertex, an optional w or vertex color is ignored
+            float f[3];
+            Vec3 v(0.0f);
+            if (parse_floats(p + 2, line_end, f, 3) == 3) {
+                v = xf.rotate * (xf.scale * Vec3(f[0], f[1], f[2]));
+                v += xf.translate;
             }
-            else if (s == '\n' || s == ' ' || s == '\t') {
-                // continue
+            else {
+                c->errors++; // still add it, so the following indices stay correct
             }
-            else if (s == 'v') {
-
-                s = (char) getc(f);
-
-                if (s == ' ' || s == '\t') { // vertex
-
-                    if (fscanf_s(f, " %f %f %f ", &x, &y, &z) == 3) {
-                        verts.push_back(Vec3(x, y, z));
+            c->positions.push_back(v);
+        }
+        else if (c0 == 'v' && c1 == 'n' && is_blank(c2)) { // vertex normal
+            float f[3];
+            Vec3 n(0, 0, 1);
+            if (parse_floats(p + 3, line_end, f, 3) == 3)
+                n = Vec3(f[0], f[1], f[2]) * xf.invRot;
+            else
+                c->errors++;
+            c->normals.push_back(n);
+        }
+        else if (c0 == 'v' && c1 == 't' && is_blank(c2)) { // texture coordinate, v is optional
+            float f[2] = { 0, 0 };
+            if (parse_floats(p + 3, line_end, f, 2) == 0)
+                c->errors++;
+            c->uvs.push_back({ f[0], f[1] });
+        }
+        else if (c0 == 'f' && is_blank(c1)) { // face, formats: v, v/t, v//n, v/t/n
+            face.clear();
+            face_rel.clear();
+            bool ok = true;
+            const char* q = p + 2;
+            for (;;) {
+                q = skip_blanks(q, line_end);
+                if (q >= line_end || *q == '\n' || *q == '#')
+                    break;
+
+                obj_corner corner = { -1, -1, -1 };
+                uint8 rel = 0;
+                int32 idx;
+                if (!parse_int(&q, line_end, &idx) || !resolve_index(idx, c->positions.size(), OBJ_REL_V, &corner.v, &rel)) {
+                    ok = false;
+                    break;
+                }
+                if (q < line_end && *q == '/') {
+                    q++;
+                    if (q < line_end && *q != '/') {
+                        if (!parse_int(&q, line_end, &idx) || !resolve_index(idx, c->uvs.size(), OBJ_REL_T, &corner.t, &rel)) {
+                            ok = false;
+                            break;
+                        }
                     }
-                    else {
-                        if (OBJ_LOADER_DEBUG) MRT_Assert(false);
-                        MRT_DebugPrint("Warning: unknown obj format! May slow down or crash the program!\n");
-                        break;
+                    if (q < line_end && *q == '/') {
+                        q++;
+                        if (!parse_int(&q, line_end, &idx) || !resolve_index(idx, c->normals.size(), OBJ_REL_N, &corner.n, &rel)) {
+                            ok = false;
+                            break;
+                        }
                     }
                 }
-                else if (s == 'n') { // vertex normal
+                if (q < line_end && !is_blank(*q) && *q != '\n') {
+                    ok = false;
+                    break;
+                }
+                face.push_back(corner);
+                face_rel.push_back(rel);
+            }
 
-                    if (fscanf_s(f, " %f %f %f ", &x, &y, &z) == 3) {
-                        norms.push_back(Vec3(x, y, z));
-                    }
-                    else {
-                        if (OBJ_LOADER_DEBUG) MRT_Assert(false);
-                        MRT_DebugPrint("Warning: unknown obj format! May slow down or crash the program!\n");
-                        break;
-                    }
+            if (!ok || face.size() < 3) {
+                c->errors++;
+            }
+            else {
+                // triangle fan, n-gons are assumed to be convex
+                for (size_t i = 1; i + 1 < face.size(); i++) {
+                    size_t a = 0, b = i, cc = i + 1;
+                    if (flip_triangles)
+                        std::swap(a, cc);
+                    c->corners.push_back(face[a]);
+                    c->corners.push_back(face[b]);
+                    c->corners.push_back(face[cc]);
+                    c->relative.push_back(face_rel[a]);
+                    c->relative.push_back(face_rel[b]);
+                    c->relative.push_back(face_rel[cc]);
                 }
             }
-            else if (s == 'f') { // face
+        }
+        // everything else (comments, groups, materials, lines, ...) is skipped
 
-                if (norms.empty()) { // format: f 1 2 3
-                    int ai, bi, ci;
+        p = line_end;
+    }
+}
+
+// reads the faces into out, every distinct combination of position, normal and texture coordinate becomes one vertex
+static bool parseObj(const char* filename, mesh_buffers* out, bool flip_triangles, const Mat4& scale, const Vec3& translate, const Mat4& rotate) {
+    size_t size;
+    const char* data = (const char*) MRT_MapFile(filename, &size);
+    if (!data)
+        return false;
+
+    obj_transform xf;
+    xf.scale = scale;
+    xf.rotate = rotate;
+    xf.invRot = Mat4::Invert(rotate);
+    xf.translate = translate;
+
+    const char* end = data + size;
+    size_t num_chunks = std::clamp<size_t>(size / OBJ_MIN_CHUNK_SIZE, 1, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<obj_chunk> chunks(num_chunks);
+    std::vector<std::thread> threads;
+
+    const char* chunk_start = data;
+    for (size_t i = 0; i < num_chunks; i++) {
+        const char* chunk_end = (i == num_chunks - 1) ? end : std::max(chunk_start, next_line(data + size * (i + 1) / num_chunks, end));
+        threads.emplace_back(parse_chunk, chunk_start, chunk_end, std::cref(xf), flip_triangles, &chunks[i]);
+        chunk_start = chunk_end;
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    MRT_UnmapFile(data, size);
+
+    // merge the chunks, indices that counted back get the offset of their chunk
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<obj_uv> uvs;
+    std::vector<obj_corner> corners;
+    uint32 errors = 0;
+
+    for (obj_chunk& c : chunks) {
+        int32 v_base = (int32) positions.size();
+        int32 t_base = (int32) uvs.size();
+        int32 n_base = (int32) normals.size();
+        positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+        normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+        uvs.insert(uvs.end(), c.uvs.begin(), c.uvs.end());
+        errors += c.errors;
+
+        for (size_t i = 0; i < c.corners.size(); i++) {
+            obj_corner& corner = c.corners[i];
+            if (c.relative[i] & OBJ_REL_V) corner.v += v_base;
+            if (c.relative[i] & OBJ_REL_T) corner.t += t_base;
+            if (c.relative[i] & OBJ_REL_N) corner.n += n_base;
+        }
+        corners.insert(corners.end(), c.corners.begin(), c.corners.end());
+        c = obj_chunk(); // free the chunk before the next one is copied
+    }
 
-                    if (fscanf_s(f, " %i %i %i ", &ai, &bi, &ci) == 3) {
+    // drop triangles with indices out of range
+    bool has_attributes = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < corners.size(); i += 3) {
+        bool valid = true;
+        for (size_t k = i; k < i + 3; k++) {
+            const obj_corner& c = corners[k];
+            valid &= (c.v >= 0 && c.v < (int32) positions.size());
+            valid &= (c.t == -1 || (c.t >= 0 && c.t < (int32) uvs.size()));
+            valid &= (c.n == -1 || (c.n >= 0 && c.n < (int32) normals.size()));
+            has_attributes |= (c.t != -1 || c.n != -1);
+        }
+        if (valid) {
+            corners[kept++] = corners[i];
+            corners[kept++] = corners[i + 1];
+            corners[kept++] = corners[i + 2];
+        }
+        else {
+            errors++;
+        }
+    }
+    corners.resize(kept);
 
-                        if (flip_triangles) {
-                            std::swap(ai, ci);
-                        }
+    if (errors)
+        MRT_DebugPrint("Warning: %s: skipped %u invalid lines or faces\n", filename, errors);
+
+    out->indices.reserve(corners.size());
+    if (!has_attributes) {
+        // positions only, no need to split vertices
+        for (const Vec3& v : positions) {
+            out->add_position(v);
+        }
+        for (const obj_corner& c : corners) {
+            out->indices.push_back(c.v);
+        }
+    }
+    else {
+        std::unordered_map<obj_corner, uint32, obj_corner_hash> vertex_ids;
+        vertex_ids.reserve(positions.size());
+
+        for (const obj_corner& c : corners) {
+            auto [it, inserted] = vertex_ids.try_emplace(c, (uint32) out->vertex_count());
+            if (inserted) {
+                out->add_position(positions[c.v]);
+                if (c.n != -1) {
+                    out->add_normal(normals[c.n]);
+                }
+                if (c.t != -1) {
+                    out->tu.push_back(uvs[c.t].u);
+                    out->tv.push_back(uvs[c.t].v);
+                }
+            }
+            out->indices.push_back(it->second);
+        }
+    }
 
-                        a = scale * verts[ai - 1];
-                        b = scale * verts[bi - 1];
-                        c = scale * verts[ci - 1];
+    // files that mix faces with and without normals are shaded flat, same for texture coordinates
+    if (out->nx.size() != out->px.size()) {
+        out->nx.clear();
+        out->ny.clear();
+        out->nz.clear();
+    }
+    if (out->tu.size() != out->px.size()) {
+        out->tu.clear();
+        out->tv.clear();
+    }
+    return true;
+}
 
-                        a = rotate * a;
-                        b = rotate * b;
-                        c = rotate * c;
+std::unique_ptr<mesh_buffers> readObjMesh(const char* filename, bool flip_triangles, const Mat4& scale, const Vec3& translate, const Mat4& rotate) {
+    auto buffers = std::make_unique<mesh_buffers>();
+    if (!parseObj(filename, buffers.get(), flip_triangles, scale, translate, rotate) || buffers->triangle_count() == 0)
+        return nullptr;
+    return buffers;
+}
 
-                        a += translate;
-                        b += translate;
-                        c += translate;
+std::unique_ptr<triangle[]> readObj(const char* filename, material* mat, size_t* numTris, bool flip_triangles, const Mat4& scale, const Vec3& translate, const Mat4& rotate) {
+    std::unique_ptr<mesh_buffers> buffers = readObjMesh(filename, flip_triangles, scale, translate, rotate);
+    if (!buffers) {
+        *numTris = 0;
+        return nullptr;
+    }
 
+    *numTris = buffers->triangle_count();
+    std::unique_ptr<triangle[]> list = std::make_unique_for_overwrite<triangle[]>(*numTris);
+    const uint32* idx = buffers->indices.data();
+    for (size_t i = 0; i < *numTris; i++, idx += 3) {
+        Vec3 a = buffers->position(idx[0]);
+        Vec3 b = buffers->position(idx[1]);
+        Vec3 c = buffers->position(idx[2]);
+        if (buffers->has_normals())
+            list[i] = triangle(a, b, c, buffers->normal(idx[0]), buffers->normal(idx[1]), buffers->normal(idx[2]), mat);
+        else
+            list[i] = triangle(a, b, c, mat);
+    }
+    return list;
+}
+
+////////////////////////
+//     MESH CACHE     //
+////////////////////////
+
+// <obj file>.mrtmesh: header, positions (x, y, z arrays), normals and texture coordinates if present,
+// vertex indices in BVH leaf order and the wide BVH nodes, everything in native byte order
+
+#define MESH_CACHE_VERSION 1
+
+struct mesh_cache_header {
+    // everything up to vertex_count has to match for the cache to be used
+    char   magic[4]; // "MRTM"
+    uint32 version;
+    uint32 bvh_width;
+    uint32 node_size;
+    uint32 flip_triangles;
+    float  scale[16];
+    float  rotate[16];
+    float  translate[3];
+    uint64 source_size; // the cache is rebuilt if the obj file changes
+    int64  source_time;
+
+    uint32 vertex_count;
+    uint32 triangle_count;
+    uint32 node_count;
+    uint32 has_normals;
+    uint32 has_uvs;
+    float  bounds_min[3];
+    float  bounds_max[3];
+};
+
+typedef wide_bvh_node<BVH_WIDTH> mesh_bvh_node;
+
+// A cache of the right size can still be stale or corrupted, the traversal trusts every index in the nodes.
+// The writer appends children after their parent, so every interior child has to come after it and be referenced once,
+// which also rules out cycles and limits the depth to what the traversal stack holds.
+static bool validMeshCacheNodes(const std::vector<mesh_bvh_node>& nodes, size_t triangle_count) {
+    std::vector<uint32> depth(nodes.size(), 0); // 0 for nodes no parent referenced (yet)
+    depth[0] = 1;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const mesh_bvh_node& node = nodes[i];
+        if (depth[i] == 0 || node.child_count == 0 || node.child_count > BVH_WIDTH)
+            return false;
+        for (uint32 c = 0; c < node.child_count; c++) {
+            if (node.count[c]) {
+                if (uint64(node.child[c]) + node.count[c] > triangle_count)
+                    return false;
+            }
+            else {
+                uint32 child = node.child[c];
+                if (child <= i || child >= nodes.size() || depth[child] != 0 || depth[i] >= BVH_MAX_DEPTH)
+                    return false;
+                depth[child] = depth[i] + 1;
+            }
+        }
+    }
+    return true;
+}
 
-                        polys.emplace_back(a, b, c, mat);
-                    }
-                    else {
-                        if (OBJ_LOADER_DEBUG) MRT_Assert(false);
-                        MRT_DebugPrint("Warning: unknown obj format! May slow down or crash the program!\n");
-                        break;
-                    }
-                }
-                else { // format : f1//4 2//5 3//6
+static mesh *loadMeshCache(const char* cache_name, const mesh_cache_header& key, material* mat) {
+    size_t size;
+    const uint8* data = (const uint8*) MRT_MapFile(cache_name, &size);
+    if (!data)
+        return nullptr;
 
-                    int ai, bi, ci;
-                    int ani, bni, cni;
+    mesh_cache_header h;
+    if (size < sizeof(h)) {
+        MRT_UnmapFile(data, size);
+        return nullptr;
+    }
+    memcpy(&h, data, sizeof(h));
 
-                    if (fscanf_s(f, " %i//%i %i//%i %i//%i ", &ai, &ani, &bi, &bni, &ci, &cni) == 6) {
+    size_t V = h.vertex_count;
+    size_t T = h.triangle_count;
+    size_t floats_per_vertex = 3 + (h.has_normals ? 3 : 0) + (h.has_uvs ? 2 : 0);
+    size_t expected_size = sizeof(h) + V * floats_per_vertex * sizeof(float) + T * 3 * sizeof(uint32) + h.node_count * sizeof(mesh_bvh_node);
 
-                        if (flip_triangles) {
-                            std::swap(ai, ci);
-                            std::swap(ani, cni);
-                        }
-                        a = scale * verts[ai - 1];
-                        b = scale * verts[bi - 1];
-                        c = scale * verts[ci - 1];
+    if (memcmp(&h, &key, offsetof(mesh_cache_header, vertex_count)) != 0 || size != expected_size || T == 0 || h.node_count == 0) {
+        MRT_UnmapFile(data, size);
+        return nullptr;
+    }
 
-                        an = norms[ani - 1];
-                        bn = norms[bni - 1];
-                        cn = norms[cni - 1];
+    const uint8* p = data + sizeof(h);
+    auto read_floats = [&p, V](std::vector<float>* v) {
+        v->resize(V);
+        memcpy(v->data(), p, V * sizeof(float));
+        p += V * sizeof(float);
+    };
+
+    auto buffers = std::make_unique<mesh_buffers>();
+    read_floats(&buffers->px);
+    read_floats(&buffers->py);
+    read_floats(&buffers->pz);
+    if (h.has_normals) {
+        read_floats(&buffers->nx);
+        read_floats(&buffers->ny);
+        read_floats(&buffers->nz);
+    }
+    if (h.has_uvs) {
+        read_floats(&buffers->tu);
+        read_floats(&buffers->tv);
+    }
 
-                        an = an * invRot;
-                        bn = bn * invRot;
-                        cn = cn * invRot;
+    auto prims = std::make_unique_for_overwrite<mesh_triangle[]>(T);
+    for (size_t i = 0; i < T; i++) {
+        uint32 idx[3];
+        memcpy(idx, p, sizeof(idx));
+        p += sizeof(idx);
+        if (idx[0] >= V || idx[1] >= V || idx[2] >= V) {
+            MRT_UnmapFile(data, size);
+            return nullptr;
+        }
+        prims[i] = { buffers.get(), idx[0], idx[1], idx[2] };
+    }
 
-                        a = rotate * a;
-                        b = rotate * b;
-                        c = rotate * c;
+    std::vector<mesh_bvh_node> nodes(h.node_count);
+    memcpy(nodes.data(), p, h.node_count * sizeof(mesh_bvh_node));
+    MRT_UnmapFile(data, size);
+    if (!validMeshCacheNodes(nodes, T))
+        return nullptr;
 
-                        a += translate;
-                        b += translate;
-                        c += translate;
+    aabb bounds(Vec3(h.bounds_min[0], h.bounds_min[1], h.bounds_min[2]), Vec3(h.bounds_max[0], h.bounds_max[1], h.bounds_max[2]));
+    auto bvh = std::make_unique<wide_bvh<mesh_triangle, BVH_WIDTH>>(std::move(nodes), std::move(prims), bounds);
+    return new mesh(std::move(buffers), std::move(bvh), T, mat);
+}
+
+static void writeMeshCache(const char* cache_name, mesh_cache_header h, const mesh& m) {
+    FILE* f = fopen(cache_name, "wb");
+    if (!f)
+        return; // e.g. read-only directory, the obj file is simply parsed again next time
+
+    const mesh_buffers& b = m.get_buffers();
+    const auto& bvh = m.get_bvh();
+    size_t V = b.vertex_count();
+    size_t T = m.get_triangle_count();
+
+    aabb bounds;
+    m.bounding_box(&bounds, 0, 0);
+
+    h.vertex_count = (uint32) V;
+    h.triangle_count = (uint32) T;
+    h.node_count = bvh.get_node_count();
+    h.has_normals = b.has_normals();
+    h.has_uvs = b.has_uvs();
+    for (int i = 0; i < 3; i++) {
+        h.bounds_min[i] = bounds.min[i];
+        h.bounds_max[i] = bounds.max[i];
+    }
+    fwrite(&h, sizeof(h), 1, f);
+
+    fwrite(b.px.data(), sizeof(float), V, f);
+    fwrite(b.py.data(), sizeof(float), V, f);
+    fwrite(b.pz.data(), sizeof(float), V, f);
+    if (h.has_normals) {
+        fwrite(b.nx.data(), sizeof(float), V, f);
+        fwrite(b.ny.data(), sizeof(float), V, f);
+        fwrite(b.nz.data(), sizeof(float), V, f);
+    }
+    if (h.has_uvs) {
+        fwrite(b.tu.data(), sizeof(float), V, f);
+        fwrite(b.tv.data(), sizeof(float), V, f);
+    }
 
+    std::vector<uint32> indices(3 * T);
+    const mesh_triangle* prims = bvh.get_prims();
+    for (size_t i = 0; i < T; i++) {
+        indices[3 * i + 0] = prims[i].v0;
+        indices[3 * i + 1] = prims[i].v1;
+        indices[3 * i + 2] = prims[i].v2;
+    }
+    fwrite(indices.data(), sizeof(uint32), indices.size(), f);
+    fwrite(bvh.get_nodes().data(), sizeof(mesh_bvh_node), h.node_count, f);
 
-                        polys.emplace_back(a, b, c, an, bn, cn, mat);
-                    }
-                    else {
-                        if (OBJ_LOADER_DEBUG) MRT_Assert(false);
-                        MRT_DebugPrint("Warning: unknown obj format! May slow down or crash the program!\n");
-                        break;
-                    }
-                }
-            }
-            else {
-                char buf[64] = { 0 };
-                do {
-                    fgets(buf, sizeof(buf), f);
-                } while (buf[strlen(buf) - 1] != '\n' && !feof(f)); // read until newline
+    bool failed = ferror(f);
+    fclose(f);
+    if (failed)
+        remove(cache_name);
+}
 
-                //if (OBJ_LOADER_DEBUG) MRT_Assert(false);
-                MRT_DebugPrint("Warning: unknown obj format! May slow down or crash the program!\n");
-            }
-        }
-        fclose(f);
+mesh *loadObjMesh(const char* filename, material *mat, float time0, float time1, bool flip_triangles, const Mat4& scale, const Vec3& translate, const Mat4& rotate) {
+    static_assert(sizeof(Mat4) == sizeof(mesh_cache_header::scale));
 
-        *numTris = polys.size();
-        std::unique_ptr<triangle[]> list = std::make_unique_for_overwrite<triangle[]>(polys.size());
-        memcpy(list.get(), polys.data(), polys.size() * sizeof(triangle));
-        return list;
-    }
-    else {
-        *numTris = 0;
+    std::error_code ec;
+    uint64 source_size = std::filesystem::file_size(filename, ec);
+    if (ec)
         return nullptr;
+    auto source_time = std::filesystem::last_write_time(filename, ec);
+    if (ec)
+        return nullptr;
+
+    mesh_cache_header key;
+    memset(&key, 0, sizeof(key)); // padding is compared as well
+    memcpy(key.magic, "MRTM", 4);
+    key.version = MESH_CACHE_VERSION;
+    key.bvh_width = BVH_WIDTH;
+    key.node_size = sizeof(mesh_bvh_node);
+    key.flip_triangles = flip_triangles;
+    memcpy(key.scale, &scale, sizeof(key.scale));
+    memcpy(key.rotate, &rotate, sizeof(key.rotate));
+    for (int i = 0; i < 3; i++) {
+        key.translate[i] = translate[i];
     }
-}
\ No newline at end of file
+    key.source_size = source_size;
+    key.source_time = (int64) source_time.time_since_epoch().count();
+
+    std::string cache_name = std::string(filename) + ".mrtmesh";
+    if (mesh* m = loadMeshCache(cache_name.c_str(), key, mat))
+        return m;
+
+    std::unique_ptr<mesh_buffers> buffers = readObjMesh(filename, flip_triangles, scale, translate, rotate);
+    if (!buffers)
+        return nullptr;
+
+    mesh* m = new mesh(std::move(buffers), mat, time0, time1);
+    writeMeshCache(cache_name.c_str(), key, *m);
+    return m;
+}
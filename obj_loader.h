@@ -2,8 +2,18 @@
 
 #include "vec3.h"
 #include "triangle.h"
+#include "mesh.h"
 #include "mat4.h"
 #include <memory>
 
 std::unique_ptr<triangle[]> readObj(const char* filename, material *mat, size_t *numTris, bool flip_triangles = true, const Mat4& scale = Mat4::Identity,
-                   const Vec3& translate = { 0, 0, 0 }, const Mat4& rotate = Mat4::Identity);
\ No newline at end of file
+                   const Vec3& translate = { 0, 0, 0 }, const Mat4& rotate = Mat4::Identity);
+
+// indexed version for mesh, returns nullptr if the file could not be read or has no faces
+std::unique_ptr<mesh_buffers> readObjMesh(const char* filename, bool flip_triangles = true, const Mat4& scale = Mat4::Identity,
+                                          const Vec3& translate = { 0, 0, 0 }, const Mat4& rotate = Mat4::Identity);
+
+// same as readObjMesh, but also builds the BVH and caches both in <filename>.mrtmesh,
+// later calls with the same transform load the cache instead as long as the obj file did not change
+mesh *loadObjMesh(const char* filename, material *mat, float time0, float time1, bool flip_triangles = true, const Mat4& scale = Mat4::Identity,
+                  const Vec3& translate = { 0, 0, 0 }, const Mat4& rotate = Mat4::Identity);
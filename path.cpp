@@ -0,0 +1,71 @@
+#include <limits>
+
+#include "path.h"
+#include "light.h"
+#include "stats.h"
+
+bool path_bounce(path_state *path, bool has_hit, const hit_record& hrec, const scene& scene) {
+    MRT_Params *p = getParams();
+
+    if (!has_hit) {
+        path->radiance += path->throughput * scene_background((scenes) p->sceneSelect, path->r);
+        return false;
+    }
+
+    const ray r = path->r;
+    scatter_record srec;
+
+    Vec3 emitted = material_emitted(hrec.mat_ptr, r, hrec) * emission_weight(scene, r, hrec, path->bsdf_pdf);
+
+    if (!material_scatter(hrec.mat_ptr, r, hrec, &srec) || !path->depth.add(get_bounce_type(srec), p)) {
+        path->radiance += path->throughput * emitted;
+        return false;
+    }
+
+    if (srec.is_specular) {
+        path->throughput *= srec.attenuation;
+        path->r = srec.specular_ray;
+        path->bsdf_pdf = 0;
+    }
+    else {
+        Vec3 direct;
+        if (sample_direct(scene, r, hrec, srec, &direct)) {
+            stat_add(get_thread_stats().shadow_rays, 1);
+        }
+
+        ray scattered = ray(hrec.p, srec.bsdf.generate(r.time), r.time);
+        float pdf_v = srec.bsdf.value(scattered.dir, r.time);
+
+        float scatter_pdf = material_scattering_pdf(hrec.mat_ptr, r, hrec, scattered);
+
+        path->radiance += path->throughput * (emitted + direct);
+        path->throughput *= srec.attenuation * scatter_pdf / pdf_v;
+        path->r = scattered;
+        path->bsdf_pdf = pdf_v;
+    }
+    return russian_roulette(path->depth, p, &path->throughput);
+}
+
+Vec3 finish_path(path_state *path, bool has_hit, hit_record *hrec, const scene& scene) {
+
+    stage_timer clock;
+    while (path_bounce(path, has_hit, *hrec, scene)) {
+        clock.lap(STAGE_SHADE);
+        count_rays(path->depth.total);
+        has_hit = scene.objects->hit(path->r, 0.001f, std::numeric_limits<float>::max(), hrec);
+        clock.lap(STAGE_INTERSECT);
+    }
+    clock.lap(STAGE_SHADE);
+    return path->radiance;
+}
+
+Vec3 trace_path(path_state *path, const scene& scene) {
+
+    count_rays(path->depth.total);
+
+    hit_record hrec;
+    stage_timer clock;
+    bool has_hit = scene.objects->hit(path->r, 0.001f, std::numeric_limits<float>::max(), &hrec);
+    clock.lap(STAGE_INTERSECT);
+    return finish_path(path, has_hit, &hrec, scene);
+}
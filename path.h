@@ -0,0 +1,93 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+#include "material.h"
+#include "sampler.h"
+#include "cmdline_parser.h"
+#include <algorithm>
+
+// The path loop shared by the integrators: the state of a path between bounces, the bounce itself and the termination
+// by depth limits per kind of bounce and Russian roulette on the throughput.
+// see "Physically Based Rendering" (Pharr et al.), 13.7 Russian Roulette
+
+enum bounce_type : uint8 {
+    BOUNCE_DIFFUSE,      // lambertian and volume scattering
+    BOUNCE_SPECULAR,     // mirror, glossy metal and dielectric reflection
+    BOUNCE_TRANSMISSION, // refraction through a dielectric
+};
+
+inline bounce_type get_bounce_type(const scatter_record& srec) {
+    if (!srec.is_specular)
+        return BOUNCE_DIFFUSE;
+    return srec.is_transmission ? BOUNCE_TRANSMISSION : BOUNCE_SPECULAR;
+}
+
+// bounces of a path so far
+struct path_depth {
+    uint32 total = 0;
+    uint32 diffuse = 0;
+    uint32 specular = 0;
+    uint32 transmission = 0;
+
+    // counts the bounce, false if the path already has as many bounces (of this type) as p allows
+    bool add(bounce_type type, const MRT_Params *p) {
+        if (total >= p->maxBounces)
+            return false;
+        uint32 *count;
+        uint32 max;
+        switch (type) {
+        case BOUNCE_DIFFUSE:  count = &diffuse;  max = p->maxDiffuseBounces;  break;
+        case BOUNCE_SPECULAR: count = &specular; max = p->maxSpecularBounces; break;
+        default:              count = &transmission; max = p->maxTransmissionBounces; break;
+        }
+        if (*count >= max)
+            return false;
+        (*count)++;
+        total++;
+        return true;
+    }
+};
+
+// Called after a bounce with the throughput of the continuing path. Once the path has p->rouletteDepth bounces it survives
+// with a probability of its largest throughput component, the survivors are weighted up so the estimate stays unbiased.
+// Returns false if the path ends here, that includes paths that can't carry any light anymore.
+inline bool russian_roulette(const path_depth& depth, const MRT_Params *p, Vec3 *throughput) {
+    float max = std::max(throughput->x, std::max(throughput->y, throughput->z));
+    if (!(max > 0))
+        return false;
+    if (depth.total < p->rouletteDepth || max >= 1)
+        return true;
+    if (sample_1d() >= max)
+        return false;
+    *throughput /= max;
+    return true;
+}
+
+// State of one path between two bounces, everything needed to continue it later. trace() in main.cpp follows a path to
+// its end right away, the wavefront integrator keeps a queue of them and advances all of them by one bounce at a time.
+struct path_state {
+    ray r;                 // the next ray to trace
+    Vec3 throughput;       // product of all attenuation * bsdf / pdf terms so far
+    Vec3 radiance;         // radiance gathered so far, already weighted by the throughput
+    path_depth depth;
+    float bsdf_pdf;        // density of r for the MIS weight of the emitter it hits, 0 if the light was not sampled explicitly
+    uint32 pixel;          // output index, for schedulers that keep many paths around
+    sampler_state sampler; // for schedulers that interleave paths, see set_sampler_state()
+
+    path_state() = default;
+    // camera ray
+    path_state(const ray& r, uint32 pixel = 0) : r(r), throughput(1.0f), radiance(0.0f), bsdf_pdf(0), pixel(pixel) {}
+};
+
+// Advances path by one bounce at the intersection hrec of path->r (has_hit is false if the ray left the scene):
+// adds the emitted and the direct light to the radiance and continues path->r in the scattered direction.
+// Returns false once the path has ended, its radiance is final then. The shadow rays are counted in stats.h, the caller
+// counts the ray it traces next.
+bool path_bounce(path_state *path, bool has_hit, const hit_record& hrec, const scene& scene);
+
+// Follows path from the intersection hrec of path->r until it ends and returns its radiance, for callers that intersected
+// the first ray themselves (camera ray packets). The loop keeps the stack depth constant no matter how long the path gets.
+Vec3 finish_path(path_state *path, bool has_hit, hit_record *hrec, const scene& scene);
+// the whole path, starting with tracing path->r
+Vec3 trace_path(path_state *path, const scene& scene);
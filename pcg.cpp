@@ -82,15 +82,14 @@ Vec3 random_in_sphere_g() {
     return random_in_sphere(&G_rng);
 }
 
-// NOTE: This is not normalized!
-// It probably should be, but the only place we use this is for generating new rays, which normalize in the constructor.
+// uniform on the unit disk projected up to the hemisphere (Malley's method)
 Vec3 random_cosine_direction(pcg32_random_t *rng) {
     float r1 = randf(rng);
     float r2 = randf(rng);
     float z = MRT::sqrt(1 - r2);
     float phi = 2 * M_PI_F * r1;
-    float x = cosf(phi) * 2 * MRT::sqrt(r2);
-    float y = sinf(phi) * 2 * MRT::sqrt(r2);
+    float x = cosf(phi) * MRT::sqrt(r2);
+    float y = sinf(phi) * MRT::sqrt(r2);
     return Vec3(x, y, z);
 }
 Vec3 random_cosine_direction() {
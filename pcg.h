@@ -12,8 +12,7 @@ Vec3 random_in_sphere();
 Vec3 random_on_sphere_uniform();
 Vec3 random_in_disk();
 Vec3 random_towards_sphere(float radius, float dist_sq);
-// NOTE: This is not normalized!
-// It probably should be, but the only place we use this is for generating new rays, which normalize in the constructor.
+// cosine weighted around z, matches cosine_pdf::value()
 Vec3 random_cosine_direction();
 
 // global RNG, for static initialization
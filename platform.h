@@ -1,12 +1,15 @@
 #pragma once
 #include "common.h"
+#include <stddef.h>
 
-void MRT_PlatformInit();
+void MRT_PlatformInit(bool headless); // headless: no window will be created, only the non-window functions may be used
 void MRT_PlatformDestroy();
 void MRT_HandleMessages();
 void MRT_CreateWindow(uint32_t windowWidth, uint32_t windowHeight, uint32_t bufferWidth, uint32_t bufferHeight);
 void MRT_SetWindowTitle(const char *str);
 void MRT_DrawToWindow(const uint32_t *backBuffer);
+struct MRT_Rect { uint32_t x, y, width, height; }; // in buffer pixels, y axis up
+void MRT_DrawToWindow(const uint32_t *backBuffer, const MRT_Rect *rects, size_t numRects); // only copies the rects that changed
 void MRT_ReportProgress(uint64_t done, uint64_t total);
 
 void MRT_DebugPrint(const char *format, ...);
@@ -16,5 +19,20 @@ void MRT_Sleep(uint32_t ms);
 
 void MRT_LowerThreadPriority();
 
+// maps a whole file read-only, returns nullptr if it does not exist or is empty
+const void *MRT_MapFile(const char *filename, size_t *size);
+void MRT_UnmapFile(const void *data, size_t size);
+
 uint64_t MRT_GetTime();
-float MRT_TimeDelta(uint64_t start, uint64_t stop); // returns seconds
\ No newline at end of file
+float MRT_TimeDelta(uint64_t start, uint64_t stop); // returns seconds
+
+// stream sockets for the render server, the address is a TCP port on localhost ("9000") or "unix:<path>" (Linux only)
+typedef intptr_t MRT_Socket;
+const MRT_Socket MRT_INVALID_SOCKET = -1;
+
+MRT_Socket MRT_Listen(const char *address);
+MRT_Socket MRT_Accept(MRT_Socket listener);
+bool MRT_WaitReadable(MRT_Socket s, uint32_t timeoutMs); // also true for a pending connection on a listening socket
+intptr_t MRT_Receive(MRT_Socket s, void *buffer, size_t size); // returns 0 once the other side closed the connection, < 0 on errors
+bool MRT_Send(MRT_Socket s, const void *data, size_t size); // blocks until everything is sent
+void MRT_CloseSocket(MRT_Socket s);
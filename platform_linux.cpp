@@ -4,11 +4,25 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <assert.h>
 #include <sys/syscall.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// MRT_HEADLESS builds without SDL for machines without a display, only batch rendering (-output) is available then
+#ifndef MRT_HEADLESS
 #include <SDL.h>
+#endif
 
 using namespace MRT;
 
@@ -17,9 +31,11 @@ static uint32_t G_windowHeight;
 static uint32_t G_bufferWidth;
 static uint32_t G_bufferHeight;
 
+#ifndef MRT_HEADLESS
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
+#endif
 
 uint64_t MRT_GetTime() {
     struct timespec ts;
@@ -31,7 +47,12 @@ float MRT_TimeDelta(uint64_t start, uint64_t stop) { // returns seconds
     return ((stop - start) / 1000000000.0);
 }
 
-void MRT_PlatformInit() {
+#ifndef MRT_HEADLESS
+
+void MRT_PlatformInit(bool headless) {
+    if (headless)
+        return; // don't touch SDL video, there may be no display
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0){
         MRT_DebugPrint(SDL_GetError());
         exit(1);
@@ -39,7 +60,7 @@ void MRT_PlatformInit() {
 }
 
 void MRT_SetWindowTitle(const char *str) {
-    SDL_SetWindowTitle(window, str);
+    if (window) SDL_SetWindowTitle(window, str);
 }
 
 void MRT_CreateWindow(uint32_t windowWidth, uint32_t windowHeight, uint32_t bufferWidth, uint32_t bufferHeight) {
@@ -59,21 +80,37 @@ void MRT_CreateWindow(uint32_t windowWidth, uint32_t windowHeight, uint32_t buff
 }
 
 void MRT_HandleMessages() {
+    if (!window) return;
+
     SDL_Event e;
     while (SDL_PollEvent(&e)){
         if (e.type == SDL_QUIT){
             WindowCallback(MRT_CLOSE);
         }
-        if (e.type == SDL_KEYDOWN){
-            KeyboardCallback(0, MRT_DOWN, MRT_NONE);
+        if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP){
+            // same key codes as Windows virtual keys for letters
+            int key = e.key.keysym.sym;
+            if (key >= 'a' && key <= 'z')
+                key += 'A' - 'a';
+            if (e.type == SDL_KEYDOWN)
+                KeyboardCallback(key, MRT_DOWN, e.key.repeat ? MRT_DOWN : MRT_UP);
+            else
+                KeyboardCallback(key, MRT_UP, MRT_DOWN);
+        }
+        if (e.type == SDL_MOUSEBUTTONDOWN || e.type == SDL_MOUSEBUTTONUP){
+            KeyState state = (e.type == SDL_MOUSEBUTTONDOWN) ? MRT_DOWN : MRT_UP;
+            MouseCallback(e.button.x, e.button.y, (e.button.button == SDL_BUTTON_LEFT) ? state : MRT_NONE,
+                                                  (e.button.button == SDL_BUTTON_RIGHT) ? state : MRT_NONE);
         }
-        if (e.type == SDL_MOUSEBUTTONDOWN){
-            MouseCallback(0, 0, MRT_DOWN, MRT_NONE);
+        if (e.type == SDL_MOUSEMOTION){
+            MouseCallback(e.motion.x, e.motion.y, MRT_NONE, MRT_NONE);
         }
     }
 }
 
 void MRT_DrawToWindow(const uint32_t* backBuffer) {
+    if (!window) return;
+
     int pitch;
     void* pixels;
     SDL_LockTexture(texture, nullptr, &pixels, &pitch);
@@ -85,6 +122,67 @@ void MRT_DrawToWindow(const uint32_t* backBuffer) {
     SDL_RenderPresent(renderer);
 }
 
+void MRT_DrawToWindow(const uint32_t* backBuffer, const MRT_Rect *rects, size_t numRects) {
+    if (!window) return;
+
+    // the texture keeps the rest of the image, presenting it again costs no CPU time
+    for (size_t i = 0; i < numRects; i++) {
+        const MRT_Rect& r = rects[i];
+        SDL_Rect rect = { int(r.x), int(r.y), int(r.width), int(r.height) };
+        int pitch;
+        void* pixels;
+        SDL_LockTexture(texture, &rect, &pixels, &pitch);
+        for (uint32_t y = 0; y < r.height; y++) {
+            memcpy((char*) pixels + y * pitch, backBuffer + r.x + (r.y + y) * G_bufferWidth, r.width * sizeof(uint32_t));
+        }
+        SDL_UnlockTexture(texture);
+    }
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopyEx(renderer, texture, NULL, NULL, 0, NULL, SDL_FLIP_VERTICAL);
+    SDL_RenderPresent(renderer);
+}
+
+void MRT_PlatformDestroy() {
+    if (!window) return;
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+#else // MRT_HEADLESS
+
+void MRT_PlatformInit(bool headless) {
+    if (!headless) {
+        MRT_DebugPrint("Error: this is a headless build without display support, use -output to render to a file.\n");
+        exit(1);
+    }
+}
+
+void MRT_SetWindowTitle(const char *str) {}
+
+void MRT_CreateWindow(uint32_t windowWidth, uint32_t windowHeight, uint32_t bufferWidth, uint32_t bufferHeight) {
+    G_windowWidth  = windowWidth;
+    G_windowHeight = windowHeight;
+    G_bufferWidth  = bufferWidth;
+    G_bufferHeight = bufferHeight;
+}
+
+void MRT_HandleMessages() {}
+
+void MRT_DrawToWindow(const uint32_t* backBuffer) {}
+void MRT_DrawToWindow(const uint32_t* backBuffer, const MRT_Rect *rects, size_t numRects) {}
+
+void MRT_PlatformDestroy() {}
+
+#endif // MRT_HEADLESS
+
+void MRT_ReportProgress(uint64_t done, uint64_t total) {
+    // SDL has no taskbar progress, the window title shows it instead
+}
+
 void MRT_DebugPrint(const char *format, ...) {
     va_list args;
     va_start(args, format);
@@ -108,13 +206,111 @@ void MRT_LowerThreadPriority() {
     setpriority(PRIO_PROCESS, tid, 20);
 }
 
-void MRT_PlatformDestroy() {
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-}
-
 void MRT_Sleep(uint32_t ms) {
     usleep(ms * 1000u);
 }
+
+const void *MRT_MapFile(const char *filename, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping stays valid
+
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+    *size = (size_t) st.st_size;
+    return data;
+}
+
+void MRT_UnmapFile(const void *data, size_t size) {
+    munmap((void*) data, size);
+}
+
+// listens on localhost only, the render server is not meant to be reachable from other machines
+MRT_Socket MRT_Listen(const char *address) {
+    int s;
+    if (strncmp(address, "unix:", 5) == 0) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path))
+            return MRT_INVALID_SOCKET;
+        strcpy(addr.sun_path, address + 5);
+
+        // a socket there is left over from an earlier run, anything else is not ours to delete
+        struct stat st;
+        if (lstat(addr.sun_path, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                fprintf(stderr, "%s: address in use, the file exists and is not a socket\n", addr.sun_path);
+                return MRT_INVALID_SOCKET;
+            }
+            unlink(addr.sun_path);
+        }
+
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0)
+            return MRT_INVALID_SOCKET;
+        if (bind(s, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(s, 1) != 0) {
+            close(s);
+            return MRT_INVALID_SOCKET;
+        }
+    }
+    else {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t) strtoul(address, nullptr, 10));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s < 0)
+            return MRT_INVALID_SOCKET;
+        int reuse = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(s, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(s, 1) != 0) {
+            close(s);
+            return MRT_INVALID_SOCKET;
+        }
+    }
+    return s;
+}
+
+MRT_Socket MRT_Accept(MRT_Socket listener) {
+    int s = accept((int) listener, nullptr, nullptr);
+    if (s < 0)
+        return MRT_INVALID_SOCKET;
+    int nodelay = 1; // frame headers are small and should not wait for the next frame
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)); // fails harmlessly on Unix domain sockets
+    return s;
+}
+
+bool MRT_WaitReadable(MRT_Socket s, uint32_t timeoutMs) {
+    pollfd pfd = { (int) s, POLLIN, 0 };
+    return poll(&pfd, 1, (int) timeoutMs) > 0;
+}
+
+intptr_t MRT_Receive(MRT_Socket s, void *buffer, size_t size) {
+    return recv((int) s, buffer, size, 0);
+}
+
+bool MRT_Send(MRT_Socket s, const void *data, size_t size) {
+    const char *p = (const char*) data;
+    while (size > 0) {
+        ssize_t sent = send((int) s, p, size, MSG_NOSIGNAL); // no SIGPIPE if the client is gone
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+void MRT_CloseSocket(MRT_Socket s) {
+    close((int) s);
+}
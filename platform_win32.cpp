@@ -3,11 +3,16 @@
 #include "main.h"
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
 #include <Windows.h>
 #include <process.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <shobjidl.h>
 
+#pragma comment(lib, "Ws2_32.lib")
+
 using namespace MRT;
 
 static HDC DC;
@@ -18,6 +23,7 @@ static uint32 G_windowWidth;
 static uint32 G_windowHeight;
 static uint32 G_bufferWidth;
 static uint32 G_bufferHeight;
+static const uint32_t *G_lastBackBuffer; // redrawn on WM_PAINT, the partial updates only draw what changed
 static double freq;
 
 uint64_t MRT_GetTime() {
@@ -30,7 +36,7 @@ float MRT_TimeDelta(uint64_t start, uint64_t stop) {
     return float((stop - start) / freq);
 }
 
-void MRT_PlatformInit() {
+void MRT_PlatformInit(bool headless) {
     LARGE_INTEGER f;
     QueryPerformanceFrequency(&f);
     freq = double(f.QuadPart);
@@ -38,7 +44,7 @@ void MRT_PlatformInit() {
     DWORD dwProcessList[2];
     DWORD count = GetConsoleProcessList(dwProcessList, 2);
     
-    if (count == 1) { // we are the only process using this console, just close it
+    if (count == 1 && !headless) { // we are the only process using this console, just close it
         FreeConsole();
     }
 }
@@ -69,6 +75,16 @@ LRESULT CALLBACK MainWndProc(HWND hWindow, UINT uMsg, WPARAM wParam, LPARAM lPar
     case WM_RBUTTONDOWN:
         MouseCallback(mouseX, mouseY, MRT_NONE, MRT_DOWN);
         break;
+    case WM_MOUSEMOVE:
+        MouseCallback(mouseX, mouseY, MRT_NONE, MRT_NONE);
+        break;
+    case WM_PAINT: {
+        PAINTSTRUCT ps;
+        BeginPaint(hWindow, &ps);
+        if (G_lastBackBuffer)
+            StretchDIBits(ps.hdc, 0, 0, G_windowWidth, G_windowHeight, 0, 0, G_bufferWidth, G_bufferHeight, G_lastBackBuffer, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
+        EndPaint(hWindow, &ps);
+    } break;
     case WM_DESTROY:
     case WM_CLOSE:
         WindowCallback(MRT_CLOSE);
@@ -158,9 +174,23 @@ void MRT_ReportProgress(uint64_t done, uint64_t total) {
 }
 
 void MRT_DrawToWindow(const uint32_t* backBuffer) {
+    G_lastBackBuffer = backBuffer;
     StretchDIBits(DC, 0, 0, G_windowWidth, G_windowHeight, 0, 0, G_bufferWidth, G_bufferHeight, backBuffer, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
 }
 
+void MRT_DrawToWindow(const uint32_t* backBuffer, const MRT_Rect *rects, size_t numRects) {
+    G_lastBackBuffer = backBuffer;
+    for (size_t i = 0; i < numRects; i++) {
+        const MRT_Rect& r = rects[i];
+        // the source y axis of a bottom-up DIB points up as well, the window's points down
+        int32 x0 = int32((uint64(r.x) * G_windowWidth) / G_bufferWidth);
+        int32 x1 = int32((uint64(r.x + r.width) * G_windowWidth) / G_bufferWidth);
+        int32 y0 = int32(G_windowHeight - (uint64(r.y + r.height) * G_windowHeight) / G_bufferHeight);
+        int32 y1 = int32(G_windowHeight - (uint64(r.y) * G_windowHeight) / G_bufferHeight);
+        StretchDIBits(DC, x0, y0, x1 - x0, y1 - y0, r.x, r.y, r.width, r.height, backBuffer, &bmpInfo, DIB_RGB_COLORS, SRCCOPY);
+    }
+}
+
 void MRT_DebugPrint(const char *format, ...) {
     static char buffer[16384];
     va_list args;
@@ -195,5 +225,94 @@ void MRT_Sleep(uint32_t ms) {
     Sleep(ms);
 }
 
+const void *MRT_MapFile(const char *filename, size_t *size) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER fileSize;
+    const void *data = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+    }
+    CloseHandle(file);
+
+    if (data)
+        *size = (size_t) fileSize.QuadPart;
+    return data;
+}
+
+void MRT_UnmapFile(const void *data, size_t size) {
+    UnmapViewOfFile(data);
+}
+
+// listens on localhost only, the render server is not meant to be reachable from other machines
+MRT_Socket MRT_Listen(const char *address) {
+    static bool wsaInitialized = false;
+    if (!wsaInitialized) {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+            return MRT_INVALID_SOCKET;
+        wsaInitialized = true;
+    }
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        MRT_DebugPrint("Error: Unix domain sockets are not supported on Windows, use a TCP port.\n");
+        return MRT_INVALID_SOCKET;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u_short) strtoul(address, nullptr, 10));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return MRT_INVALID_SOCKET;
+    if (bind(s, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(s, 1) != 0) {
+        closesocket(s);
+        return MRT_INVALID_SOCKET;
+    }
+    return (MRT_Socket) s;
+}
+
+MRT_Socket MRT_Accept(MRT_Socket listener) {
+    SOCKET s = accept((SOCKET) listener, nullptr, nullptr);
+    if (s == INVALID_SOCKET)
+        return MRT_INVALID_SOCKET;
+    BOOL nodelay = TRUE; // frame headers are small and should not wait for the next frame
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*) &nodelay, sizeof(nodelay));
+    return (MRT_Socket) s;
+}
+
+bool MRT_WaitReadable(MRT_Socket s, uint32_t timeoutMs) {
+    WSAPOLLFD pfd = { (SOCKET) s, POLLRDNORM, 0 };
+    return WSAPoll(&pfd, 1, (INT) timeoutMs) > 0;
+}
+
+intptr_t MRT_Receive(MRT_Socket s, void *buffer, size_t size) {
+    return recv((SOCKET) s, (char*) buffer, (int) size, 0);
+}
+
+bool MRT_Send(MRT_Socket s, const void *data, size_t size) {
+    const char *p = (const char*) data;
+    while (size > 0) {
+        int sent = send((SOCKET) s, p, (int) std::min<size_t>(size, INT_MAX), 0);
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+void MRT_CloseSocket(MRT_Socket s) {
+    closesocket((SOCKET) s);
+}
+
 
 #endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ray.h"
+#include "platform.h"
+
+// bundle of coherent rays (neighbouring camera rays) in SoA layout, so a BVH node or primitive
+// can be tested against all of them with SSE instead of one ray at a time
+#define RAY_PACKET_SIZE 8
+#define RAY_PACKET_FULL ((1u << RAY_PACKET_SIZE) - 1)
+
+static_assert(RAY_PACKET_SIZE % 4 == 0 && RAY_PACKET_SIZE <= 32, "packets are processed in SSE chunks and addressed with a 32 bit mask");
+
+struct alignas(16) ray_packet {
+    float ox[RAY_PACKET_SIZE], oy[RAY_PACKET_SIZE], oz[RAY_PACKET_SIZE];
+    float dx[RAY_PACKET_SIZE], dy[RAY_PACKET_SIZE], dz[RAY_PACKET_SIZE];
+    float ix[RAY_PACKET_SIZE], iy[RAY_PACKET_SIZE], iz[RAY_PACKET_SIZE]; // inverse direction for the box tests
+    ray rays[RAY_PACKET_SIZE]; // the same rays for the single ray fallback and for shading
+
+    // packets only hold camera rays, the SIMD kernels don't handle isInside (rays starting inside a volume)
+    void set(uint32 i, const ray& r) {
+        MRT_Assert(r.isInside == 0, "ray_packet: rays inside a volume are not supported\n");
+        rays[i] = r;
+        ox[i] = r.origin.x;
+        oy[i] = r.origin.y;
+        oz[i] = r.origin.z;
+        dx[i] = r.dir.x;
+        dy[i] = r.dir.y;
+        dz[i] = r.dir.z;
+        ix[i] = 1.0f / r.dir.x;
+        iy[i] = 1.0f / r.dir.y;
+        iz[i] = 1.0f / r.dir.z;
+    }
+};
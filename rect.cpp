@@ -1,7 +1,31 @@
 #include "rect.h"
+#include "compiled_scene.h"
+#include "light.h"
 #include <utility>
 #include <limits>
 
+// SIMD version of the facing, plane and bounds tests shared by the rect hit() functions,
+// n is the axis of the normal (plane at n = k), a and b are the axes spanning the rect
+static uint32 rect_hit_candidates(const float *o_n, const float *d_n, const float *o_a, const float *d_a, const float *o_b, const float *d_b,
+                                  float k, float a0, float a1, float b0, float b1, float normal_sign, float tmin, const float tmax[]) {
+    uint32 candidates = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; i += 4)
+    {
+        __m128 dn = _mm_load_ps(&d_n[i]);
+        __m128 t = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(k), _mm_load_ps(&o_n[i])), dn);
+        __m128 a = _mm_add_ps(_mm_load_ps(&o_a[i]), _mm_mul_ps(t, _mm_load_ps(&d_a[i])));
+        __m128 b = _mm_add_ps(_mm_load_ps(&o_b[i]), _mm_mul_ps(t, _mm_load_ps(&d_b[i])));
+
+        __m128 facing = _mm_cmple_ps(_mm_mul_ps(dn, _mm_set1_ps(normal_sign)), _mm_setzero_ps());
+        __m128 in_t = _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tmin)), _mm_cmple_ps(t, _mm_loadu_ps(&tmax[i])));
+        __m128 in_a = _mm_and_ps(_mm_cmpge_ps(a, _mm_set1_ps(a0)), _mm_cmple_ps(a, _mm_set1_ps(a1)));
+        __m128 in_b = _mm_and_ps(_mm_cmpge_ps(b, _mm_set1_ps(b0)), _mm_cmple_ps(b, _mm_set1_ps(b1)));
+
+        candidates |= _mm_movemask_ps(_mm_and_ps(_mm_and_ps(facing, in_t), _mm_and_ps(in_a, in_b))) << i;
+    }
+    return candidates;
+}
+
 // x0 > x1 XOR y0 > y1 flips the normal
 xy_rect::xy_rect(float x0, float x1, float y0, float y1, float z, material *mat) : z(z), mat_ptr(mat) {
 
@@ -22,26 +46,12 @@ xy_rect::xy_rect(float x0, float x1, float y0, float y1, float z, material *mat)
 }
 
 bool xy_rect::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    return hit_rect<2, 0, 1>(z, x0, x1, y0, y1, normal_sign, mat_ptr, r, tmin, tmax, rec);
+}
 
-    if (dot(r.dir, Vec3(0, 0, normal_sign)) > 0.0f)
-        return false;
-
-    float t = (z - r.origin.z) / r.dir.z;
-    if (t < tmin || t > tmax)
-        return false;
-
-    float x = r.origin.x + t * r.dir.x;
-    float y = r.origin.y + t * r.dir.y;
-    if (x < x0 || x > x1 || y < y0 || y > y1)
-        return false;
-
-    rec->u = (x - x0) / (x1 - x0);
-    rec->v = (y - y0) / (y1 - y0);
-    rec->t = t;
-    rec->mat_ptr = mat_ptr;
-    rec->p = r.eval(t);
-    rec->n = Vec3(0, 0, normal_sign);
-    return true;
+uint32 xy_rect::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+    uint32 candidates = rect_hit_candidates(rp.oz, rp.dz, rp.ox, rp.dx, rp.oy, rp.dy, z, x0, x1, y0, y1, normal_sign, tmin, tmax);
+    return hit_packet_single(*this, rp, mask & candidates, tmin, tmax, rec);
 }
 
 /////////////////////////////////////////
@@ -67,43 +77,12 @@ xz_rect::xz_rect(float x0, float x1, float z0, float z1, float y, material *mat)
 }
 
 bool xz_rect::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
-
-    if (dot(r.dir, Vec3(0, normal_sign, 0)) > 0.0f)
-        return false;
-
-    float t = (y - r.origin.y) / r.dir.y;
-    if (t < tmin || t > tmax)
-        return false;
-
-    float x = r.origin.x + t * r.dir.x;
-    float z = r.origin.z + t * r.dir.z;
-    if (x < x0 || x > x1 || z < z0 || z > z1)
-        return false;
-
-    rec->u = (x - x0) / (x1 - x0);
-    rec->v = (z - z0) / (z1 - z0);
-    rec->t = t;
-    rec->mat_ptr = mat_ptr;
-    rec->p = r.eval(t);
-    rec->n = Vec3(0, normal_sign, 0);
-    return true;
-}
-
-float xz_rect::pdf_value(const Vec3& origin, const Vec3& dir, float time) const {
-    hit_record rec;
-    if (this->hit(ray(origin, dir, 0.0f), 0.001f, std::numeric_limits<float>::max(), &rec)) {
-        float area = (x1 - x0) * (z1 - z0);
-        float dist_sq = rec.t * rec.t;
-        float cosine = MRT::abs(dot(dir, rec.n));
-        return dist_sq / (cosine * area);
-    }
-    else
-        return 0;
+    return hit_rect<1, 0, 2>(y, x0, x1, z0, z1, normal_sign, mat_ptr, r, tmin, tmax, rec);
 }
 
-Vec3 xz_rect::pdf_generate(const Vec3& origin, float time) const {
-    Vec3 rand = Vec3(x0 + randf() * (x1 - x0), y, z0 + randf() * (z1 - z0));
-    return rand - origin;
+uint32 xz_rect::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+    uint32 candidates = rect_hit_candidates(rp.oy, rp.dy, rp.ox, rp.dx, rp.oz, rp.dz, y, x0, x1, z0, z1, normal_sign, tmin, tmax);
+    return hit_packet_single(*this, rp, mask & candidates, tmin, tmax, rec);
 }
 
 /////////////////////////////////////////
@@ -128,25 +107,58 @@ yz_rect::yz_rect(float y0, float y1, float z0, float z1, float x, material *mat)
 }
 
 bool yz_rect::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    return hit_rect<0, 1, 2>(x, y0, y1, z0, z1, normal_sign, mat_ptr, r, tmin, tmax, rec);
+}
+
+uint32 yz_rect::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+    uint32 candidates = rect_hit_candidates(rp.ox, rp.dx, rp.oy, rp.dy, rp.oz, rp.dz, x, y0, y1, z0, z1, normal_sign, tmin, tmax);
+    return hit_packet_single(*this, rp, mask & candidates, tmin, tmax, rec);
+}
 
-    if (dot(r.dir, Vec3(normal_sign, 0, 0)) > 0.0f)
-        return false;
+/////////////////////////////////////////
 
-    float t = (x - r.origin.x) / r.dir.x;
-    if (t < tmin || t > tmax)
-        return false;
+static void lower_rect(scene_compiler *c, compiled_prim_type type, float k, float a0, float a1, float b0, float b1,
+                       float normal_sign, material *mat_ptr, const aabb& box) {
+    compiled_prim p;
+    p.type = type;
+    p.mat_ptr = mat_ptr;
+    p.rect = { k, a0, a1, b0, b1, normal_sign };
+    p.set_box(box);
+    c->prims.push_back(p);
+}
 
-    float y = r.origin.y + t * r.dir.y;
-    float z = r.origin.z + t * r.dir.z;
-    if (y < y0 || y > y1 || z < z0 || z > z1)
-        return false;
+bool xy_rect::lower(scene_compiler *c) const {
+    aabb box;
+    bounding_box(&box, c->time0, c->time1);
+    lower_rect(c, PRIM_XY_RECT, z, x0, x1, y0, y1, normal_sign, mat_ptr, box);
+    return true;
+}
 
-    rec->u = (y - y0) / (y1 - y0);
-    rec->v = (z - z0) / (z1 - z0);
-    rec->t = t;
-    rec->mat_ptr = mat_ptr;
-    rec->p = r.eval(t);
-    rec->n = Vec3(normal_sign, 0, 0);
+bool xz_rect::lower(scene_compiler *c) const {
+    aabb box;
+    bounding_box(&box, c->time0, c->time1);
+    lower_rect(c, PRIM_XZ_RECT, y, x0, x1, z0, z1, normal_sign, mat_ptr, box);
+    return true;
+}
 
+bool yz_rect::lower(scene_compiler *c) const {
+    aabb box;
+    bounding_box(&box, c->time0, c->time1);
+    lower_rect(c, PRIM_YZ_RECT, x, y0, y1, z0, z1, normal_sign, mat_ptr, box);
     return true;
-}
\ No newline at end of file
+}
+
+void xy_rect::add_lights(light_list *lights) {
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT)
+        mat_ptr = lights->add_rect(2, z, x0, x1, y0, y1, normal_sign, mat_ptr);
+}
+
+void xz_rect::add_lights(light_list *lights) {
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT)
+        mat_ptr = lights->add_rect(1, y, x0, x1, z0, z1, normal_sign, mat_ptr);
+}
+
+void yz_rect::add_lights(light_list *lights) {
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT)
+        mat_ptr = lights->add_rect(0, x, y0, y1, z0, z1, normal_sign, mat_ptr);
+}
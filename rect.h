@@ -3,6 +3,36 @@
 #include "scene_object.h"
 #include "material.h"
 
+// shared by the rects and the compiled scene (see compiled_scene.h),
+// N is the axis of the normal (plane at N = k), A and B are the axes spanning the rect and give u and v
+template <int N, int A, int B>
+inline bool hit_rect(float k, float a0, float a1, float b0, float b1, float normal_sign, material *mat_ptr,
+                     const ray& r, float tmin, float tmax, hit_record *rec) {
+    STAT_ADD(prim_tests, 1);
+
+    if (r.dir[N] * normal_sign > 0.0f)
+        return false;
+
+    float t = (k - r.origin[N]) / r.dir[N];
+    if (t < tmin || t > tmax)
+        return false;
+
+    float a = r.origin[A] + t * r.dir[A];
+    float b = r.origin[B] + t * r.dir[B];
+    if (a < a0 || a > a1 || b < b0 || b > b1)
+        return false;
+
+    rec->u = (a - a0) / (a1 - a0);
+    rec->v = (b - b0) / (b1 - b0);
+    rec->t = t;
+    rec->mat_ptr = mat_ptr;
+    rec->p = r.eval(t);
+    Vec3 n(0.0f);
+    n[N] = normal_sign;
+    rec->n = n;
+    return true;
+}
+
 class xy_rect final : public scene_object {
 public:
     float x0, x1, y0, y1;
@@ -15,10 +45,13 @@ public:
     xy_rect(float x0, float x1, float y0, float y1, float z, material *mat);
 
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
     bool bounding_box(aabb* box, float time0, float time1) const override {
         *box = aabb(Vec3(x0, y0, z - 0.0001f), Vec3(x1, y1, z + 0.0001f)); // assumes x0 < x1, y0 < y1
         return true;
     }
+    bool lower(scene_compiler *c) const override;
+    void add_lights(light_list *lights) override;
 };
 
 /////////////////////////////////////////
@@ -35,12 +68,13 @@ public:
     xz_rect(float x0, float x1, float z0, float z1, float y, material *mat);
 
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
     bool bounding_box(aabb* box, float time0, float time1) const override {
         *box = aabb(Vec3(x0, y - 0.0001f, z0), Vec3(x1, y + 0.0001f, z1)); // assumes x0 < x1, z0 < z1
         return true;
     }
-    float pdf_value(const Vec3& origin, const Vec3& dir, float time) const override;
-    Vec3 pdf_generate(const Vec3& origin, float time) const override;
+    bool lower(scene_compiler *c) const override;
+    void add_lights(light_list *lights) override;
 };
 
 
@@ -58,8 +92,11 @@ public:
     yz_rect(float y0, float y1, float z0, float z1, float x, material *mat);
 
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
     bool bounding_box(aabb* box, float time0, float time1) const override {
         *box = aabb(Vec3(x - 0.0001f, y0, z0), Vec3(x + 0.0001f, y1, z1)); // assumes y0 < y1, z0 < z1
         return true;
     }
+    bool lower(scene_compiler *c) const override;
+    void add_lights(light_list *lights) override;
 };
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "render_server.h"
+#include "platform.h"
+
+bool render_server::start(const char *address, const MRT_Params& defaults) {
+    this->defaults = defaults;
+    this->defaults.outputFile = nullptr; // only written if the job asks for it
+    this->defaults.outputFileHDR = nullptr;
+
+    listener = MRT_Listen(address);
+    return listener != MRT_INVALID_SOCKET;
+}
+
+render_server::~render_server() {
+    if (client != MRT_INVALID_SOCKET)
+        MRT_CloseSocket(client);
+    if (listener != MRT_INVALID_SOCKET)
+        MRT_CloseSocket(listener);
+}
+
+// jobs belong to their client, nobody would receive their frames
+void render_server::disconnect() {
+    MRT_CloseSocket(client);
+    client = MRT_INVALID_SOCKET;
+    input.clear();
+    queue.clear();
+    if (activeId)
+        activeCancelled = true;
+}
+
+void render_server::poll(uint32 timeoutMs) {
+    if (client == MRT_INVALID_SOCKET) {
+        if (MRT_WaitReadable(listener, timeoutMs))
+            client = MRT_Accept(listener);
+        return;
+    }
+
+    if (!MRT_WaitReadable(client, timeoutMs))
+        return;
+
+    char buffer[4096];
+    intptr_t received = MRT_Receive(client, buffer, sizeof(buffer));
+    if (received <= 0) {
+        disconnect();
+        return;
+    }
+    input.append(buffer, (size_t) received);
+
+    size_t end;
+    while (client != MRT_INVALID_SOCKET && (end = input.find('\n')) != std::string::npos) {
+        std::string line = input.substr(0, end);
+        input.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        command(line.data());
+    }
+}
+
+// splits the line at whitespace in place, parameters can't contain spaces
+static std::vector<char*> tokenize(char *line) {
+    std::vector<char*> tokens;
+    for (char *t = strtok(line, " \t"); t; t = strtok(nullptr, " \t")) {
+        tokens.push_back(t);
+    }
+    return tokens;
+}
+
+void render_server::command(char *line) {
+    if (strncmp(line, "render", 6) == 0 && (line[6] == '\0' || line[6] == ' ' || line[6] == '\t')) {
+        auto job = std::make_unique<render_job>();
+        size_t length = strlen(line);
+        job->line = std::make_unique<char[]>(length + 1);
+        memcpy(job->line.get(), line, length + 1);
+
+        // the command takes the place of the program name, ReadParameter starts at argv[1]
+        std::vector<char*> argv = tokenize(job->line.get());
+        int argc = (int) argv.size();
+
+        job->params = defaults;
+        ParseParams(argc, argv.data(), &job->params);
+
+        job->priority = 0;
+        if (int i = CheckParameter(argc, argv.data(), "-priority"); i && i + 1 < argc)
+            job->priority = (int32) strtol(argv[i + 1], nullptr, 0);
+
+        job->stream = STREAM_LDR;
+        if (int i = CheckParameter(argc, argv.data(), "-stream"); i && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "none") == 0)
+                job->stream = STREAM_NONE;
+            else if (strcmp(argv[i + 1], "hdr") == 0)
+                job->stream = STREAM_HDR;
+            else if (strcmp(argv[i + 1], "ldr") != 0) {
+                send("error unknown stream format '%s'\n", argv[i + 1]);
+                return;
+            }
+        }
+
+        job->id = nextId++;
+        send("queued %u\n", job->id);
+        queue.push_back(std::move(job));
+        return;
+    }
+
+    std::vector<char*> args = tokenize(line);
+    if (args.empty())
+        return;
+
+    if (strcmp(args[0], "cancel") == 0 && args.size() == 2) {
+        uint32 id = strtoul(args[1], nullptr, 0);
+        if (id != 0 && id == activeId) {
+            activeCancelled = true; // the render loop stops the workers and replies
+            return;
+        }
+        for (size_t i = 0; i < queue.size(); i++) {
+            if (queue[i]->id == id) {
+                queue.erase(queue.begin() + i);
+                send("cancelled %u\n", id);
+                return;
+            }
+        }
+        send("error unknown job %s\n", args[1]);
+    }
+    else if (strcmp(args[0], "priority") == 0 && args.size() == 3) {
+        uint32 id = strtoul(args[1], nullptr, 0);
+        for (auto& job : queue) {
+            if (job->id == id) {
+                job->priority = (int32) strtol(args[2], nullptr, 0);
+                return;
+            }
+        }
+        if (id != 0 && id == activeId)
+            send("error job %u is already running\n", id);
+        else
+            send("error unknown job %s\n", args[1]);
+    }
+    else if (strcmp(args[0], "shutdown") == 0) {
+        shutdownRequested = true;
+        if (activeId)
+            activeCancelled = true;
+    }
+    else {
+        send("error unknown command '%s'\n", args[0]);
+    }
+}
+
+std::unique_ptr<render_job> render_server::nextJob() {
+    if (queue.empty())
+        return nullptr;
+
+    size_t best = 0;
+    for (size_t i = 1; i < queue.size(); i++) {
+        if (queue[i]->priority > queue[best]->priority)
+            best = i;
+    }
+    std::unique_ptr<render_job> job = std::move(queue[best]);
+    queue.erase(queue.begin() + best);
+    return job;
+}
+
+void render_server::beginJob(const render_job& job, uint32 numSamples) {
+    activeId = job.id;
+    activeCancelled = false;
+    send("started %u %u %u %u\n", job.id, job.params.bufferWidth, job.params.bufferHeight, numSamples);
+}
+
+void render_server::finishJob(const render_job& job, float seconds) {
+    if (activeCancelled)
+        send("cancelled %u\n", job.id);
+    else
+        send("done %u %.3f\n", job.id, seconds);
+    activeId = 0;
+    activeCancelled = false;
+}
+
+void render_server::send(const char *format, ...) {
+    if (client == MRT_INVALID_SOCKET)
+        return;
+
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0 || !MRT_Send(client, buffer, std::min((size_t) length, sizeof(buffer) - 1)))
+        disconnect();
+}
+
+void render_server::sendFrame(const render_job& job, uint32 samples, const uint32 *pixels, const Vec3 *linearPixels) {
+    if (client == MRT_INVALID_SOCKET || job.stream == STREAM_NONE)
+        return;
+
+    size_t count = size_t(job.params.bufferWidth) * job.params.bufferHeight;
+    const void *data;
+    size_t size;
+
+    if (job.stream == STREAM_HDR) {
+        hdrPixels.resize(count * 3);
+        for (size_t i = 0; i < count; i++) {
+            hdrPixels[3 * i + 0] = linearPixels[i].r;
+            hdrPixels[3 * i + 1] = linearPixels[i].g;
+            hdrPixels[3 * i + 2] = linearPixels[i].b;
+        }
+        data = hdrPixels.data();
+        size = hdrPixels.size() * sizeof(float);
+    }
+    else {
+        data = pixels;
+        size = count * sizeof(uint32);
+    }
+
+    send("frame %u %u %s %zu\n", job.id, samples, job.stream == STREAM_HDR ? "hdr" : "ldr", size);
+    if (client != MRT_INVALID_SOCKET && !MRT_Send(client, data, size))
+        disconnect();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+#include "cmdline_parser.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Render server (-server <address>): one client at a time sends jobs as text lines and gets progressive frames back.
+//
+// client -> server, one command per line:
+//   render [parameters]   queue a job, takes the command line parameters plus
+//                         -priority <n>             higher runs first, default 0
+//                         -stream <none|ldr|hdr>    frames to send after each sample pass, default ldr
+//   cancel <id>           drop a queued job or stop the running one
+//   priority <id> <n>     move a queued job in the queue (no reply), the running job is not preempted
+//   shutdown              stop the server
+//
+// server -> client, one reply per line:
+//   queued <id>
+//   started <id> <width> <height> <samples per pixel>
+//   frame <id> <samples done> <ldr|hdr> <size>   followed by <size> bytes of pixels, rows from bottom to top:
+//                                                ldr: tonemapped 8-bit BGRA, hdr: linear 32-bit float RGB
+//   done <id> <seconds>
+//   cancelled <id>
+//   error <message>
+//
+// Frames are sent from the accumulation buffer while the workers keep tracing, so every pixel is a valid average, but not all
+// pixels have the same sample count. The server polls a few times per second and skips frames if passes finish faster than that.
+
+enum stream_format : uint32 {
+    STREAM_NONE,
+    STREAM_LDR,
+    STREAM_HDR,
+};
+
+struct render_job {
+    uint32 id;
+    int32 priority;
+    stream_format stream;
+    MRT_Params params;
+    std::unique_ptr<char[]> line; // the string parameters point into the command line
+};
+
+class render_server {
+    MRT_Socket listener = MRT_INVALID_SOCKET;
+    MRT_Socket client = MRT_INVALID_SOCKET;
+    MRT_Params defaults;
+    std::string input; // received text up to the next line break
+    std::vector<std::unique_ptr<render_job>> queue;
+    std::vector<float> hdrPixels; // packed RGB for hdr frames
+    uint32 nextId = 1;
+    uint32 activeId = 0;
+    bool activeCancelled = false;
+    bool shutdownRequested = false;
+
+    void command(char *line);
+    void disconnect();
+public:
+    // defaults are the parameters for everything a job does not set
+    bool start(const char *address, const MRT_Params& defaults);
+    ~render_server();
+
+    // accepts a client if there is none and handles its commands, waits up to timeoutMs for something to happen
+    void poll(uint32 timeoutMs);
+    // removes the queued job with the highest priority (the oldest one of those), nullptr if the queue is empty
+    std::unique_ptr<render_job> nextJob();
+    void beginJob(const render_job& job, uint32 numSamples);
+
+    bool isShutdown() const { return shutdownRequested; }
+    bool isActiveCancelled() const { return activeCancelled; }
+
+    void send(const char *format, ...);
+    void sendFrame(const render_job& job, uint32 samples, const uint32 *pixels, const Vec3 *linearPixels);
+    // sends done or cancelled for the active job
+    void finishJob(const render_job& job, float seconds);
+};
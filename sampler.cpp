@@ -0,0 +1,142 @@
+#include "sampler.h"
+#include "pcg.h"
+#include "mrt_math.h"
+
+// The first two Sobol dimensions form a (0,2)-sequence, every sample dimension uses its own copy of it with the sample index shuffled,
+// which gives well stratified 1D and 2D projections without direction number tables for higher dimensions.
+// see "Practical Hash-based Owen Scrambling" (Burley 2020)
+
+static sampler_type G_samplerType = SAMPLER_SOBOL_OWEN;
+
+thread_local sampler_state T_sampler;
+
+void Init_Sampler(sampler_type type) {
+    G_samplerType = type;
+}
+
+// https://nullprogram.com/blog/2018/07/31/
+static uint32 hash(uint32 x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32 reverse_bits(uint32 v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+static uint32 sobol0(uint32 i) {
+    return reverse_bits(i);
+}
+
+static uint32 sobol1(uint32 i) {
+    uint32 r = 0;
+    for (uint32 v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+        if (i & 1)
+            r ^= v;
+    }
+    return r;
+}
+
+// only propagates bits from low to high, i.e. an Owen scramble of the reversed value
+static uint32 laine_karras_permutation(uint32 x, uint32 seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32 nested_uniform_scramble(uint32 x, uint32 seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+static uint32 scramble(uint32 x, uint32 seed) {
+    if (G_samplerType == SAMPLER_SOBOL_OWEN)
+        return nested_uniform_scramble(x, seed);
+    else
+        return x + seed; // Cranley-Patterson rotation
+}
+
+static float to_float(uint32 x) {
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// seed for the next dimension of the current sample, the shuffled index keeps every power of two prefix of samples a (0,m,2)-net
+static uint32 next_dimension(uint32 *index_out) {
+    uint32 seed = hash(T_sampler.seed ^ hash(T_sampler.dim++));
+    *index_out = nested_uniform_scramble(T_sampler.index, seed);
+    return seed;
+}
+
+void start_sample(uint32 pixel, uint32 index) {
+    T_sampler.seed = hash(pixel);
+    T_sampler.index = index;
+    T_sampler.dim = 0;
+}
+
+sampler_state get_sampler_state() {
+    return T_sampler;
+}
+
+void set_sampler_state(const sampler_state& s) {
+    T_sampler = s;
+}
+
+float sample_1d() {
+    if (G_samplerType == SAMPLER_RANDOM)
+        return randf();
+
+    uint32 i;
+    uint32 seed = next_dimension(&i);
+    return to_float(scramble(sobol0(i), hash(seed + 1)));
+}
+
+vec2 sample_2d() {
+    if (G_samplerType == SAMPLER_RANDOM) {
+        float x = randf();
+        return { x, randf() };
+    }
+
+    uint32 i;
+    uint32 seed = next_dimension(&i);
+    return { to_float(scramble(sobol0(i), hash(seed + 1))), to_float(scramble(sobol1(i), hash(seed + 2))) };
+}
+
+// concentric mapping, see "A Low Distortion Map Between Disk and Square" (Shirley, Chiu 1997)
+Vec3 sample_disk() {
+    vec2 u = sample_2d();
+    float a = 2.0f * u.x - 1.0f;
+    float b = 2.0f * u.y - 1.0f;
+    if (a == 0 && b == 0)
+        return Vec3(0.0f);
+
+    float r, phi;
+    if (MRT::abs(a) > MRT::abs(b)) {
+        r = a;
+        phi = (M_PI_F / 4) * (b / a);
+    }
+    else {
+        r = b;
+        phi = (M_PI_F / 2) - (M_PI_F / 4) * (a / b);
+    }
+    return Vec3(r * cosf(phi), r * sinf(phi), 0);
+}
+
+// NOTE: same mapping as random_cosine_direction()
+Vec3 sample_cosine_direction() {
+    vec2 u = sample_2d();
+    float z = MRT::sqrt(1 - u.y);
+    float phi = 2 * M_PI_F * u.x;
+    float x = cosf(phi) * MRT::sqrt(u.y);
+    float y = sinf(phi) * MRT::sqrt(u.y);
+    return Vec3(x, y, z);
+}
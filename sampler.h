@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+
+// Sample values for the integrator, indexed by pixel, sample number and dimension.
+// Each thread has one current sample, every call below consumes the next dimension of it.
+// Dimensions that are not drawn from here (material and volume sampling) use the plain RNG from pcg.h.
+
+enum sampler_type : uint32 {
+    SAMPLER_RANDOM,     // independent random numbers (pcg.h)
+    SAMPLER_SOBOL,      // shuffled Sobol (0,2)-sequence per dimension, randomly shifted per pixel
+    SAMPLER_SOBOL_OWEN, // shuffled Sobol (0,2)-sequence per dimension, Owen scrambled per pixel
+    ENUM_SAMPLERS_MAX
+};
+
+struct vec2 {
+    float x;
+    float y;
+};
+
+// position of a path in the sample space, must be saved with the path if paths are not traced one after another (packets, wavefront)
+struct sampler_state {
+    uint32 seed;  // hash of the pixel
+    uint32 index; // sample number within the pixel
+    uint32 dim;   // next dimension
+};
+
+void Init_Sampler(sampler_type type); // global, call before starting the worker threads
+
+void start_sample(uint32 pixel, uint32 index);
+sampler_state get_sampler_state();
+void set_sampler_state(const sampler_state& s);
+
+float sample_1d(); // in range [0,1)
+vec2 sample_2d();  // in range [0,1)^2
+
+// warped sample values
+Vec3 sample_disk();
+// cosine weighted around z, same as random_cosine_direction()
+Vec3 sample_cosine_direction();
@@ -5,6 +5,7 @@
 #include "vec3.h"
 #include "all_scene_objects.h"
 #include "scene.h"
+#include "light.h"
 #include "camera.h"
 #include "obj_loader.h"
 #include "mat4.h"
@@ -21,8 +22,10 @@ static scene cornell_box(float aspect);
 static scene cornell_smoke(float aspect);
 static scene book2_final(float aspect);
 static scene triangles(float aspect);
+static scene instances(int n, float aspect);
+static scene many_lights(int n, float aspect);
 
-scene select_scene(scenes choose, float aspect) {
+static scene generate_scene(scenes choose, float aspect) {
     switch (choose) {
     case SCENE_RANDOM_SPHERES:
         return random_scene(500, aspect);
@@ -42,12 +45,52 @@ scene select_scene(scenes choose, float aspect) {
         return book2_final(aspect);
     case SCENE_TRIANGLES:
         return triangles(aspect);
+    case SCENE_INSTANCES:
+        return instances(1000, aspect);
+    case SCENE_MANY_LIGHTS:
+        return many_lights(16, aspect);
     default:
         MRT_Assert(false);
         return scene();
     }
 }
 
+const char *scene_name(scenes choose) {
+    switch (choose) {
+    case SCENE_RANDOM_SPHERES:   return "random_spheres";
+    case SCENE_RANDOM_SPHERES_2: return "random_spheres_2";
+    case SCENE_TWO_SPHERES:      return "two_spheres";
+    case SCENE_PERLIN_SPHERES:   return "perlin_spheres";
+    case SCENE_EARTH:            return "earth";
+    case SCENE_CORNELL_BOX:      return "cornell_box";
+    case SCENE_CORNELL_SMOKE:    return "cornell_smoke";
+    case SCENE_BOOK2_FINAL:      return "book2_final";
+    case SCENE_TRIANGLES:        return "triangles";
+    case SCENE_INSTANCES:        return "instances";
+    case SCENE_MANY_LIGHTS:      return "many_lights";
+    default:
+        MRT_Assert(false);
+        return "unknown";
+    }
+}
+
+scene select_scene(scenes choose, float aspect) {
+    scene s = generate_scene(choose, aspect);
+    s.lights = new light_list(s.objects);
+    return s;
+}
+
+// radiance of rays that leave the scene
+Vec3 scene_background(scenes choose, const ray& r) {
+    if (choose >= SCENE_CORNELL_BOX && choose != SCENE_INSTANCES)
+        return Vec3(0.0f);
+    else {
+        // sky
+        float t = 0.5f * (r.dir.y + 1.0f);
+        return Vec3(1.0f - t) + t * Vec3(0.5f, 0.7f, 1.0f);
+    }
+}
+
 static scene random_scene(int n, float aspect) {
 
     // setup camera
@@ -310,25 +353,18 @@ static scene cornell_box(float aspect) {
 
     list[i++] = new yz_rect(555, 0, 0, 555, 555, green);
     list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    xz_rect *l = new xz_rect(343, 213, 227, 332, 554, light);
-    list[i++] = l;
+    list[i++] = new xz_rect(343, 213, 227, 332, 554, light);
     //list[i++] = new xz_rect(443, 113, 127, 432, 554, light);
     list[i++] = new xz_rect(555, 0, 0, 555, 555, white);
     list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
     list[i++] = new xy_rect(555, 0, 0, 555, 555, white);
     list[i++] = new translate(new rotate_y(new box(Vec3(0, 0, 0), Vec3(165, 330, 165), white), 15), Vec3(265, 0, 295));
     //list[i++] = new translate(new rotate_y(new box(Vec3(0, 0, 0), Vec3(165, 165, 165), white), -18), Vec3(130, 0, 65));
-    sphere *s = new sphere(Vec3(190, 90, 190), 90, glass);
-    list[i++] = s;
+    list[i++] = new sphere(Vec3(190, 90, 190), 90, glass);
 
     scene_object *objects = new object_list<scene_object>(list, i, shutter_t0, shutter_t1);
 
-    scene_object **b = new scene_object*[2];
-    b[0] = l;
-    b[1] = s;
-    scene_object *biased = new object_list<scene_object>(b, 1, shutter_t0, shutter_t1);
-
-    return scene { objects, biased, cam };
+    return scene { objects, nullptr, cam };
 }
 
 static scene cornell_smoke(float aspect) {
@@ -358,8 +394,7 @@ static scene cornell_smoke(float aspect) {
     list[i++] = new yz_rect(555, 0, 0, 555, 555, green);
     list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
     //list[i++] = new xz_rect(343, 213, 227, 332, 554, light); // smaller light, needs A LOT more samples without bias
-    xz_rect *l = new xz_rect(443, 113, 127, 432, 554, light);
-    list[i++] = l;
+    list[i++] = new xz_rect(443, 113, 127, 432, 554, light);
     list[i++] = new xz_rect(555, 0, 0, 555, 555, white);
     list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
     list[i++] = new xy_rect(555, 0, 0, 555, 555, white);
@@ -370,11 +405,7 @@ static scene cornell_smoke(float aspect) {
 
     scene_object *objects = new object_list<scene_object>(list, n, shutter_t0, shutter_t1);
 
-    scene_object **b = new scene_object*[1];
-    b[0] = l;
-    scene_object *biased = new object_list<scene_object>(b, 1, shutter_t0, shutter_t1);
-
-    return scene { objects, biased, cam };
+    return scene { objects, nullptr, cam };
 }
 
 static scene book2_final(float aspect) {
@@ -427,12 +458,10 @@ static scene book2_final(float aspect) {
 
     int l = 0;
     list[l++] = new bvh_node<box>(boxlist, b, shutter_t0, shutter_t1); // green boxes
-    xz_rect *lo = new xz_rect(423, 123, 147, 412, 554, light); // light
-    list[l++] = lo;
+    list[l++] = new xz_rect(423, 123, 147, 412, 554, light); // light
     Vec3 center(400, 400, 200);
     list[l++] = new sphere(center, 50, orange, center + Vec3(30, 0, 0), 0, 1);            // orange-brownish sphere
-    sphere *gs = new sphere(Vec3(260, 150, 45), 50, new dielectric(1.5f));                 // glass sphere
-    list[l++] = gs;
+    list[l++] = new sphere(Vec3(260, 150, 45), 50, new dielectric(1.5f));                 // glass sphere
     list[l++] = new sphere(Vec3(0, 150, 145), 50, new metal(new color_tex(Vec3(0.8f, 0.8f, 0.9f)), 0.1f));  // silver sphere
     list[l++] = new sphere(Vec3(400, 200, 400), 100, earth);                              // earth sphere
     list[l++] = new sphere(Vec3(220, 280, 300), 80, perlin);                              // perlin sphere
@@ -449,16 +478,13 @@ static scene book2_final(float aspect) {
     for (int i = 0; i < ns; i++) {
         spherelist[i] = new sphere(Vec3(165 * randf(), 165 * randf(), 165 * randf()), 10, white);
     }
-    list[l++] = new translate(new rotate_y(new bvh_node<sphere>(spherelist, ns, shutter_t0, shutter_t1), 15), Vec3(-100, 270, 395));
+    instance cloud(new bvh_node<sphere>(spherelist, ns, shutter_t0, shutter_t1), Mat4::Translate(Vec3(-100, 270, 395)) * Mat4::RotateY(RAD(15)),
+                   shutter_t0, shutter_t1);
+    list[l++] = new pod_bvh<instance>(&cloud, 1, shutter_t0, shutter_t1);
 
     scene_object *objects = new object_list<scene_object>(list, l, shutter_t0, shutter_t1);
 
-    scene_object **ba = new scene_object*[2];
-    ba[0] = lo;
-    ba[1] = gs;
-    scene_object *biased = new object_list<scene_object>(ba, 1, shutter_t0, shutter_t1);
-
-    return scene { objects, biased, cam };
+    return scene { objects, nullptr, cam };
 }
 
 static scene triangles(float aspect) {
@@ -490,8 +516,7 @@ static scene triangles(float aspect) {
     list[i++] = new yz_rect(555, 0, 0, 555, 555, green);
     list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
     //xz_rect *l = new xz_rect(343, 213, 227, 332, 554, light); // smaller light, needs A LOT more samples without bias
-    xz_rect *l = new xz_rect(443, 113, 127, 432, 554, light);
-    list[i++] = l;
+    list[i++] = new xz_rect(443, 113, 127, 432, 554, light);
     list[i++] = new xz_rect(555, 0, 0, 555, 555, white);
     list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
     list[i++] = new xy_rect(555, 0, 0, 555, 555, silver);
@@ -499,20 +524,16 @@ static scene triangles(float aspect) {
     // list[i++] = new translate(new triangle_scene_object(2 * Vec3(0, 0, 82.5f), 2 * Vec3(82.5f, 82.5f, 120), 2 * Vec3(185, 0, 0), silver), Vec3(90, 0, 165));
     // list[i++] = new translate(new triangle_scene_object(2 * Vec3(0, 0, 0), 2 * Vec3(82.5f, 82.5f, 100), 2 * Vec3(165, 0, 82.5f), silver), Vec3(185, 0, 95));
 
-    size_t tris = 0;
-    std::unique_ptr<triangle[]> bunny = readObj("../obj/bunny.obj", dia, &tris, true, Mat4::Scale(2000.0f), Vec3(195, -20, 280));
-    if (tris && bunny) {
-        list[i++] = new pod_bvh<triangle>(bunny.get(), tris, shutter_t0, shutter_t1);
+    if (mesh *bunny = loadObjMesh("../obj/bunny.obj", dia, shutter_t0, shutter_t1, true, Mat4::Scale(2000.0f), Vec3(195, -20, 280))) {
+        list[i++] = bunny;
     }
 
-    tris = 0;
-    std::unique_ptr<triangle[]> teapot = readObj("../obj/teapot3_no_vt.obj", dia, &tris, false, Mat4::Scale(250.0f), Vec3(393, 50, 108), Mat4::RotateY(RAD(30)));
-    if (tris && teapot) {
+    if (mesh *teapot = loadObjMesh("../obj/teapot3_no_vt.obj", dia, shutter_t0, shutter_t1, false, Mat4::Scale(250.0f), Vec3(393, 50, 108), Mat4::RotateY(RAD(30)))) {
         ////list[i++] = new rotate_y(new bvh_node(teapot, tris, shutter_t0, shutter_t1), 30);
-        list[i++] = new pod_bvh<triangle>(teapot.get(), tris, shutter_t0, shutter_t1);
+        list[i++] = teapot;
     }
 
-    /*   tris = 0;
+    /*   size_t tris = 0;
     std::unique_ptr<triangle[]> spider = readObj("../obj/spider_pruned.obj", dia, &tris, false, 1.3f, Vec3(385, 70, 100));
     if (tris && spider) {
     list[i++] = new pod_bvh<triangle>(spider.get(), tris, shutter_t0, shutter_t1);
@@ -520,10 +541,132 @@ static scene triangles(float aspect) {
     */
     scene_object *objects = new object_list<scene_object>(list, i, shutter_t0, shutter_t1);
 
-    // TODO: use bounding box to generate pdfs for bvh
-    scene_object **ba = new scene_object*[1];
-    ba[0] = l;
-    scene_object *biased = new object_list<scene_object>(ba, 1, shutter_t0, shutter_t1);
+    return scene { objects, nullptr, cam };
+}
 
-    return scene { objects, biased, cam };
+// field of bunnies that all share one mesh BVH through a two-level acceleration structure
+static scene instances(int n, float aspect) {
+
+    // setup camera
+    Vec3 cam_pos = { 13, 3.0f, 3.5f };
+    Vec3 lookat = { 0, 0.5f, 0 };
+    Vec3 up = { 0, 1, 0 };
+    float vfov = 30.0f;
+    float aperture = 0.05f;
+    float focus_dist = (cam_pos - lookat).length();
+    float shutter_t0 = 0.0f;
+    float shutter_t1 = 1.0f;
+
+    camera *cam = new camera(cam_pos, lookat, up, vfov, aspect, aperture, focus_dist, shutter_t0, shutter_t1);
+
+    // setup scene objects
+    scene_object **list = new scene_object*[2];
+    size_t i = 0;
+
+    texture *checker = new checker_tex(new color_tex(Vec3(0.2f, 0.3f, 0.1f)), new color_tex(Vec3(0.9f, 0.9f, 0.9f)), 10.0f);
+    list[i++] = new sphere(Vec3(0, -1000, 0), 1000, new lambertian(checker));
+
+    // the BLAS is stored close to the size of the instances, the triangle test uses an absolute epsilon
+    mesh *bunny = loadObjMesh("../obj/bunny.obj", new lambertian(new color_tex(Vec3(0.73f))), shutter_t0, shutter_t1, true, Mat4::Scale(8.0f));
+    if (bunny) {
+        aabb box;
+        bunny->bounding_box(&box, shutter_t0, shutter_t1);
+
+        std::vector<instance> bunnies;
+        bunnies.reserve(n);
+        int half_sqrt_n = int(sqrtf(float(n)) * 0.5f);
+        for (int a = -half_sqrt_n; a < half_sqrt_n; a++) {
+            for (int b = -half_sqrt_n; b < half_sqrt_n; b++) {
+                float s = 0.5f + 0.4f * randf();
+                float choose_mat = randf();
+
+                material *mat;
+                Vec3 velocity(0.0f);
+                if (choose_mat < 0.6f) {
+                    mat = new lambertian(new color_tex(Vec3(randf()*randf(), randf()*randf(), randf()*randf())));
+                    velocity = Vec3(0, 0.5f * randf(), 0); // hopping bunnies for motion blur
+                }
+                else if (choose_mat < 0.9f)
+                    mat = new metal(new color_tex(0.5f * Vec3(1 + randf(), 1 + randf(), 1 + randf())), 0.5f * randf());
+                else
+                    mat = new dielectric(1.5f);
+
+                // rest the scaled bunny on the ground
+                Vec3 pos(1.5f * (a + 0.3f * randf()), -box.min.y * s, 1.5f * (b + 0.3f * randf()));
+                Mat4 to_world = Mat4::Translate(pos) * Mat4::RotateY(RAD(360.0f * randf())) * Mat4::Scale(s);
+                bunnies.emplace_back(bunny, to_world, shutter_t0, shutter_t1, mat, velocity);
+            }
+        }
+        list[i++] = new pod_bvh<instance>(bunnies.data(), bunnies.size(), shutter_t0, shutter_t1);
+    }
+
+    scene_object *objects = new object_list<scene_object>(list, i, shutter_t0, shutter_t1);
+
+    return scene { objects, nullptr, cam };
+}
+
+// Cornell box lit by a grid of n*n small ceiling lights with random colors and a band of emissive triangles,
+// too many lights to pick one uniformly (see light.h)
+static scene many_lights(int n, float aspect) {
+
+    // setup camera
+    Vec3 cam_pos = { 278, 278, -800 };
+    Vec3 lookat = { 278, 278, 100 };
+    Vec3 up = { 0, 1, 0 };
+    float vfov = 40.0f;
+    float aperture = 0.00f;
+    float focus_dist = (cam_pos - lookat).length();
+    float shutter_t0 = 0.0f;
+    float shutter_t1 = 1.0f;
+
+    camera *cam = new camera(cam_pos, lookat, up, vfov, aspect, aperture, focus_dist, shutter_t0, shutter_t1);
+
+    // setup scene objects
+    scene_object **list = new scene_object*[n * n + 10];
+    int i = 0;
+
+    material *red = new lambertian(new color_tex(Vec3(0.65f, 0.05f, 0.05f)));
+    material *white = new lambertian(new color_tex(Vec3(0.73f, 0.73f, 0.73f)));
+    material *green = new lambertian(new color_tex(Vec3(0.12f, 0.45f, 0.15f)));
+    material *silver = new metal(new color_tex(Vec3(0.8f, 0.8f, 0.9f)), 0.2f);
+
+    list[i++] = new yz_rect(555, 0, 0, 555, 555, green);
+    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
+    list[i++] = new xz_rect(555, 0, 0, 555, 555, white);
+    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
+    list[i++] = new xy_rect(555, 0, 0, 555, 555, white);
+    list[i++] = new translate(new rotate_y(new box(Vec3(0, 0, 0), Vec3(165, 330, 165), white), 15), Vec3(265, 0, 295));
+    list[i++] = new sphere(Vec3(150, 90, 160), 90, silver);
+    list[i++] = new sphere(Vec3(400, 60, 120), 60, new dielectric(1.5f));
+
+    // ceiling lights facing down, most of them dim
+    float cell = 555.0f / n;
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            float x0 = (a + 0.3f) * cell;
+            float z0 = (b + 0.3f) * cell;
+            float intensity = 2.0f + 60.0f * randf() * randf() * randf();
+            Vec3 color = intensity * Vec3(0.5f + 0.5f * randf(), 0.5f + 0.5f * randf(), 0.5f + 0.5f * randf());
+            list[i++] = new xz_rect(x0 + 0.4f * cell, x0, z0, z0 + 0.4f * cell, 554, new diffuse_light(new color_tex(color)));
+        }
+    }
+
+    // zigzag band on the back wall facing the camera
+    const int tris = 48;
+    triangle band[tris];
+    float w = 555.0f / (tris / 2);
+    for (int t = 0; t < tris; t++) {
+        float x = (t / 2) * w;
+        Vec3 color = (t / 2) % 2 ? Vec3(1.0f, 0.1f, 0.8f) : Vec3(0.1f, 0.8f, 1.0f);
+        material *neon = new diffuse_light(new color_tex(color), 8.0f);
+        if (t % 2)
+            band[t] = triangle(Vec3(x, 380, 554), Vec3(x + w, 410, 554), Vec3(x + w, 380, 554), neon);
+        else
+            band[t] = triangle(Vec3(x, 380, 554), Vec3(x, 410, 554), Vec3(x + w, 410, 554), neon);
+    }
+    list[i++] = new pod_bvh<triangle>(band, tris, shutter_t0, shutter_t1);
+
+    scene_object *objects = new object_list<scene_object>(list, i, shutter_t0, shutter_t1);
+
+    return scene { objects, nullptr, cam };
 }
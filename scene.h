@@ -13,13 +13,19 @@ enum scenes : uint32 {
     SCENE_CORNELL_SMOKE,
     SCENE_BOOK2_FINAL,
     SCENE_TRIANGLES,
+    SCENE_INSTANCES,
+    SCENE_MANY_LIGHTS,
     ENUM_SCENES_MAX
 };
 
+class light_list;
+
 struct scene {
     scene_object *objects;
-    scene_object *biased_objects;
+    light_list *lights; // gathered from objects by select_scene()
     camera *camera;
 };
 
 scene select_scene(scenes choose, float aspect);
+const char *scene_name(scenes choose); // short identifier, e.g. for benchmark names
+Vec3 scene_background(scenes choose, const ray& r);
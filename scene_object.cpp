@@ -2,6 +2,8 @@
 #include <math.h>
 #include "scene_object.h"
 
+std::atomic<uint64> G_bvhBuildTicks;
+
 /////////////////////////
 //     TRANSLATION     //
 /////////////////////////
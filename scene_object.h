@@ -3,9 +3,22 @@
 #include "ray.h"
 #include "aabb.h"
 #include "pcg.h"
-#include <stdlib.h> // qsort
+#include "stats.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <numeric> // std::iota
 
 class material;
+class scene_object;
+class light_list;
+struct scene_compiler;
+
+// total time spent building BVHs (pod_bvh, bvh_node) in MRT_GetTime() ticks, shown with the scene generation time
+extern std::atomic<uint64> G_bvhBuildTicks;
+
+// adds obj to a compiled scene, either lowered into primitives or as it is (see compiled_scene.h)
+void lower_object(scene_compiler *c, const scene_object *obj);
 
 struct hit_record {
     float t = INFINITY;
@@ -16,17 +29,41 @@ struct hit_record {
     material *mat_ptr;
 };
 
+// intersects the rays in mask one by one, used as fallback by objects without a packet kernel
+// and by primitives to finish the rays that passed their SIMD test
+template <typename T>
+inline uint32 hit_packet_single(const T& obj, const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) {
+    uint32 hits = 0;
+    while (mask) {
+        uint32 i = MRT::tzcnt(mask);
+        mask &= mask - 1;
+
+        hit_record cur_rec; // hit() may write to the record even if it misses
+        if (obj.hit(rp.rays[i], tmin, tmax[i], &cur_rec)) {
+            rec[i] = cur_rec;
+            tmax[i] = cur_rec.t;
+            hits |= 1u << i;
+        }
+    }
+    return hits;
+}
+
 
 class scene_object {
 public:
     virtual bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const = 0;
-    virtual bool bounding_box(aabb* box, float time0, float time1) const = 0;
-    virtual float pdf_value(const Vec3& origin, const Vec3& dir, float time) const {
-        return 0;
+    // intersects the rays in mask, tmax[i] is the closest hit of ray i so far and is updated together with rec[i],
+    // returns the rays that found a closer hit
+    virtual uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+        return hit_packet_single(*this, rp, mask, tmin, tmax, rec);
     }
-    virtual Vec3 pdf_generate(const Vec3& origin, float time) const {
-        return Vec3(1, 0, 0);
+    virtual bool bounding_box(aabb* box, float time0, float time1) const = 0;
+    // adds the contents of this object to a compiled scene, objects that return false are kept as they are
+    virtual bool lower(scene_compiler *c) const {
+        return false;
     }
+    // adds the emitters the light list can sample, they switch to the material the list returns (see light.h)
+    virtual void add_lights(light_list *lights) {}
     virtual ~scene_object() {}
 };
 
@@ -40,14 +77,25 @@ public:
     T **list;
     size_t count;
     aabb box;
+    motion_aabb motion;
     bool hasBox;
 
     object_list(T* l[], size_t n, float time0, float time1);
 
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
     bool bounding_box(aabb* b, float time0, float time1) const override;
-    float pdf_value(const Vec3& origin, const Vec3& dir, float time) const override;
-    Vec3 pdf_generate(const Vec3& origin, float time) const override;
+    bool lower(scene_compiler *c) const override {
+        for (size_t i = 0; i < count; i++) {
+            lower_object(c, list[i]);
+        }
+        return true;
+    }
+    void add_lights(light_list *lights) override {
+        for (size_t i = 0; i < count; i++) {
+            list[i]->add_lights(lights);
+        }
+    }
 };
 
 template <typename T>
@@ -56,31 +104,17 @@ bool object_list<T>::bounding_box(aabb* b, float time0, float time1) const {
         return false;
     }
     else {
-        *b = box;
+        *b = motion.moving ? motion.over(time0, time1) : box;
         return true;
     }
 }
 
-template <typename T>
-float object_list<T>::pdf_value(const Vec3& origin, const Vec3& dir, float time) const {
-    float sum = 0;
-    for (size_t i = 0; i < count; i++) {
-        sum += list[i]->pdf_value(origin, dir, time);
-    }
-    return sum / count;
-}
-
-template <typename T>
-Vec3 object_list<T>::pdf_generate(const Vec3& origin, float time) const {
-    int i = int(randf() * count);
-    return list[i]->pdf_generate(origin, time);
-}
-
 template <typename T>
 bool object_list<T>::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
 
     // TODO: make this less complicated
-    if (!hasBox || box.hit(r, tmin, tmax)) {
+    if (!hasBox || (motion.moving ? motion.at(r.time) : box).hit(r, tmin, tmax)) {
+        STAT_ADD(nodes, 1);
         hit_record cur_rec;
         bool hit = false;
         float closest = tmax;
@@ -102,6 +136,20 @@ bool object_list<T>::hit(const ray& r, float tmin, float tmax, hit_record *rec)
 
 }
 
+template <typename T>
+uint32 object_list<T>::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+
+    if (hasBox) {
+        mask = box.hit_packet(rp, mask, tmin, tmax);
+    }
+
+    uint32 hits = 0;
+    for (size_t i = 0; i < count && mask; i++) {
+        hits |= list[i]->hit_packet(rp, mask, tmin, tmax, rec);
+    }
+    return hits;
+}
+
 template <typename T>
 object_list<T>::object_list(T* l[], size_t n, float time0, float time1) {
 
@@ -110,6 +158,8 @@ object_list<T>::object_list(T* l[], size_t n, float time0, float time1) {
 
     Vec3 minbb(std::numeric_limits<float>::max(),    std::numeric_limits<float>::max(),    std::numeric_limits<float>::max());
     Vec3 maxbb(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    aabb box0 = aabb::empty();
+    aabb box1 = aabb::empty();
 
     for (size_t i = 0; i < count; i++)
     {
@@ -119,6 +169,11 @@ object_list<T>::object_list(T* l[], size_t n, float time0, float time1) {
         if (cur_hasBox) {
             minbb = vmin(minbb, curbox.min);
             maxbb = vmax(maxbb, curbox.max);
+
+            list[i]->bounding_box(&curbox, time0, time0);
+            box0.grow(curbox);
+            list[i]->bounding_box(&curbox, time1, time1);
+            box1.grow(curbox);
         }
         else {
             hasBox = false;
@@ -127,6 +182,7 @@ object_list<T>::object_list(T* l[], size_t n, float time0, float time1) {
     }
 
     box = aabb(minbb, maxbb);
+    motion = motion_aabb(box0, box1, time0, time1);
     hasBox = true;
 }
 
@@ -135,21 +191,42 @@ object_list<T>::object_list(T* l[], size_t n, float time0, float time1) {
 //   BOUNDING VOLUME HIERARCHY   //
 ///////////////////////////////////
 
+// smaller subtrees of a bvh_node are built on one thread
+#define BVH_NODE_PARALLEL_MIN_OBJECTS 1024
+
 template <typename T>
 class bvh_node final : public scene_object {
 public:
     scene_object *left;
     scene_object *right;
-    aabb box;
+    aabb box;           // over the whole shutter interval, used by packets
+    motion_aabb motion; // used by single rays if the node moves
     uint8 node_order;
     
     bvh_node(T* list[], size_t n, float time0, float time1);
+private:
+    // boxes[i] is the bounding box of list[i], the top parallel_levels of the tree build their halves on two threads
+    bvh_node(T* list[], aabb boxes[], size_t n, float time0, float time1, uint32 parallel_levels);
+    void build(T* list[], aabb boxes[], size_t n, float time0, float time1, uint32 parallel_levels);
+public:
 
     bool bounding_box(aabb* b, float time0, float time1) const override {
-        *b = box;
+        *b = motion.moving ? motion.over(time0, time1) : box;
         return true;
     }
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
+    bool lower(scene_compiler *c) const override {
+        lower_object(c, left);
+        if (right != left)
+            lower_object(c, right);
+        return true;
+    }
+    void add_lights(light_list *lights) override {
+        left->add_lights(lights);
+        if (right != left)
+            right->add_lights(lights);
+    }
 
     void precompute_node_order()
     {
@@ -208,7 +285,8 @@ public:
 template <typename T>
 bool bvh_node<T>::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
 
-    if (box.hit(r, tmin, tmax)) {
+    if ((motion.moving ? motion.at(r.time) : box).hit(r, tmin, tmax)) {
+        STAT_ADD(nodes, 1);
 
         // sort left/right nodes by which one is closer to the ray, skip farther node if we hit something inside the closer node
         // from http://www.codercorner.com/blog/?p=734
@@ -243,56 +321,96 @@ bool bvh_node<T>::hit(const ray& r, float tmin, float tmax, hit_record *rec) con
     }
 }
 
-template <size_t axis, typename T>
-inline int __cdecl box_compare(const void *a, const void *b) {
-
-    aabb box_left, box_right;
-    T *a_obj = *(T**) a;
-    T *b_obj = *(T**) b;
-
-    MRT_Assert(a_obj->bounding_box(&box_left, 0, 0) && b_obj->bounding_box(&box_right, 0, 0),
-               "no bounding box in bvh_node constructor\n");
-
-    float delta = box_left.min[axis] - box_right.min[axis];
+template <typename T>
+uint32 bvh_node<T>::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
 
-    if (delta == 0.0f) { // MSVC explicitly requires this case for qsort, otherwise infinite loop can occur
+    mask = box.hit_packet(rp, mask, tmin, tmax);
+    if (!mask) {
         return 0;
     }
-    else if (delta < 0.0f) {
-        return -1;
+
+    // split the packet by which child each ray visits first (usually all rays agree, the packet is coherent)
+    uint32 left_first = 0;
+    for (uint32 m = mask; m; m &= m - 1) {
+        uint32 i = MRT::tzcnt(m);
+        if (node_order & rp.rays[i].dirMask)
+            left_first |= 1u << i;
+    }
+
+    // same early out as hit(), per ray: only the rays that missed the closer node go on to the farther one
+    uint32 hits = 0;
+    if (left_first) {
+        uint32 h = left->hit_packet(rp, left_first, tmin, tmax, rec);
+        if (right != left && (left_first & ~h))
+            h |= right->hit_packet(rp, left_first & ~h, tmin, tmax, rec);
+        hits |= h;
     }
-    else {
-        return 1;
+    uint32 right_first = mask & ~left_first;
+    if (right_first) {
+        uint32 h = right->hit_packet(rp, right_first, tmin, tmax, rec);
+        if (right != left && (right_first & ~h))
+            h |= left->hit_packet(rp, right_first & ~h, tmin, tmax, rec);
+        hits |= h;
     }
+    return hits;
 }
 
-typedef int(__cdecl *cmp_fn)(const void *a, const void *b);
-
 template <typename T>
-inline cmp_fn box_compare_dispatch(size_t axis) {
-    switch (axis) {
-    case 0: return box_compare<0, T>;
-    case 1: return box_compare<1, T>;
-    case 2: return box_compare<2, T>;
-    default:
-        return nullptr;
+bvh_node<T>::bvh_node(T* list[], size_t n, float time0, float time1) {
+
+    uint64 build_start = MRT_GetTime();
+
+    // every bounding box is computed once and reordered together with the objects
+    std::vector<aabb> boxes(n);
+    for (size_t i = 0; i < n; i++) {
+        MRT_Assert(list[i]->bounding_box(&boxes[i], time0, time1), "no bounding box in bvh_node constructor\n");
     }
+
+    uint32 parallel_levels = 0;
+    while ((1u << parallel_levels) < std::thread::hardware_concurrency())
+        parallel_levels++;
+
+    build(list, boxes.data(), n, time0, time1, parallel_levels);
+
+    G_bvhBuildTicks += MRT_GetTime() - build_start;
 }
 
 template <typename T>
-bvh_node<T>::bvh_node(T* list[], size_t n, float time0, float time1) {
+bvh_node<T>::bvh_node(T* list[], aabb boxes[], size_t n, float time0, float time1, uint32 parallel_levels) {
+    build(list, boxes, n, time0, time1, parallel_levels);
+}
 
-    // TODO: build bbox once, then separate into two each recursion without rebuilding the entire thing from scratch (pass new bbox down)
+// median split on the largest axis, the result only depends on the input order, so the parallel levels build the same tree
+template <typename T>
+void bvh_node<T>::build(T* list[], aabb boxes[], size_t n, float time0, float time1, uint32 parallel_levels) {
 
-    // create temporary list object to get bounding box of all objects (lazy coder at work!)
-    object_list<T> ol(list, n, time0, time1);
-    ol.bounding_box(&box, time0, time1);
+    box = aabb::empty();
+    for (size_t i = 0; i < n; i++) {
+        box.grow(boxes[i]);
+    }
 
     // choose split axis by picking largest extents on bb
     Vec3 dim = box.max - box.min;
     size_t axis = max_dim(dim);
 
-    qsort(list, n, sizeof(T*), box_compare_dispatch<T>(axis));
+    // only the median has to be in place, the halves don't need to be sorted
+    size_t mid = n / 2;
+    if (n > 1) {
+        std::vector<uint32> order(n);
+        std::iota(order.begin(), order.end(), 0u);
+        std::nth_element(order.begin(), order.begin() + mid, order.end(), [boxes, axis](uint32 a, uint32 b) {
+            return boxes[a].min[axis] < boxes[b].min[axis];
+        });
+
+        std::vector<T*> sorted_list(n);
+        std::vector<aabb> sorted_boxes(n);
+        for (size_t i = 0; i < n; i++) {
+            sorted_list[i] = list[order[i]];
+            sorted_boxes[i] = boxes[order[i]];
+        }
+        std::copy(sorted_list.begin(), sorted_list.end(), list);
+        std::copy(sorted_boxes.begin(), sorted_boxes.end(), boxes);
+    }
 
     if (n == 1) {
         left = right = list[0];
@@ -302,20 +420,32 @@ bvh_node<T>::bvh_node(T* list[], size_t n, float time0, float time1) {
         right = list[1];
     }
     else if (n < 11) {
-        left = new object_list<T>(list, n / 2, time0, time1);
-        right = new object_list<T>(list + (n / 2), n - (n / 2), time0, time1);
+        left = new object_list<T>(list, mid, time0, time1);
+        right = new object_list<T>(list + mid, n - mid, time0, time1);
+    }
+    else if (parallel_levels > 0 && n >= BVH_NODE_PARALLEL_MIN_OBJECTS) {
+        bvh_node *l = nullptr;
+        std::thread left_thread([&]() {
+            l = new bvh_node(list, boxes, mid, time0, time1, parallel_levels - 1);
+        });
+        right = new bvh_node(list + mid, boxes + mid, n - mid, time0, time1, parallel_levels - 1);
+        left_thread.join();
+        left = l;
     }
     else {
-        left = new bvh_node(list, n / 2, time0, time1);
-        right = new bvh_node(list + (n / 2), n - (n / 2), time0, time1);
+        left = new bvh_node(list, boxes, mid, time0, time1, 0);
+        right = new bvh_node(list + mid, boxes + mid, n - mid, time0, time1, 0);
     }
 
-    precompute_node_order();
+    // the children report their own box at a single point in time
+    aabb l0, l1, r0, r1;
+    left->bounding_box(&l0, time0, time0);
+    left->bounding_box(&l1, time1, time1);
+    right->bounding_box(&r0, time0, time0);
+    right->bounding_box(&r1, time1, time1);
+    motion = motion_aabb(surrounding_box(l0, r0), surrounding_box(l1, r1), time0, time1);
 
-    //aabb box_left, box_right;
-    //MRT_Assert(left->bounding_box(&box_left, time0, time1) && right->bounding_box(&box_right, time0, time1),
-    //           "no bounding box in bvh_node constructor\n");
-    //box = surrounding_box(box_left, box_right);
+    precompute_node_order();
 }
 
 /////////////////////////
@@ -1,48 +1,44 @@
 #include "sphere.h"
+#include "compiled_scene.h"
+#include "light.h"
 #include <math.h>
 #include <limits>
 
-// gets uv for point on unit sphere (i.e. pass in normal for p)
-inline void get_sphere_uv(const Vec3& p, float *u, float *v) {
-    float phi = atan2f(p.z, p.x);
-    float theta = asinf(p.y);
-    *u = 0.5f - phi * (1.0f / (2.0f * M_PI_F));
-    *v = 0.5f + theta * (1.0f / M_PI_F);
+bool sphere::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    return hit_sphere(center(r.time), radius, mat_ptr, r, tmin, tmax, rec);
 }
 
-bool sphere::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+// SIMD version of the front face test in hit(), the rays that hit are then finished by hit() to fill in the records
+uint32 sphere::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+
+    if (isMoving) { // every ray sees the sphere at a different position
+        return hit_packet_single(*this, rp, mask, tmin, tmax, rec);
+    }
+
+    __m128 cx = _mm_set1_ps(center0.x), cy = _mm_set1_ps(center0.y), cz = _mm_set1_ps(center0.z);
+    __m128 r2 = _mm_set1_ps(radius * radius);
+
+    uint32 candidates = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; i += 4)
+    {
+        __m128 ocx = _mm_sub_ps(_mm_load_ps(&rp.ox[i]), cx);
+        __m128 ocy = _mm_sub_ps(_mm_load_ps(&rp.oy[i]), cy);
+        __m128 ocz = _mm_sub_ps(_mm_load_ps(&rp.oz[i]), cz);
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, _mm_load_ps(&rp.dx[i])),
+                                         _mm_mul_ps(ocy, _mm_load_ps(&rp.dy[i]))),
+                                         _mm_mul_ps(ocz, _mm_load_ps(&rp.dz[i])));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), r2);
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+
+        __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), b), _mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps())));
+        __m128 hit = _mm_and_ps(_mm_cmpgt_ps(discriminant, _mm_setzero_ps()),
+                     _mm_and_ps(_mm_cmplt_ps(t, _mm_loadu_ps(&tmax[i])), _mm_cmpgt_ps(t, _mm_set1_ps(tmin))));
 
-    rec->mat_ptr = mat_ptr;
-    Vec3 cen = center(r.time);
-
-    Vec3 oc = r.origin - cen;
-    float b = dot(oc, r.dir);
-    float c = sdot(oc) - radius * radius;
-    float discriminant = b*b - c;
-
-    if (discriminant > 0) {
-        // front
-        float t = (-b - MRT::sqrt(discriminant));
-        if (t < tmax && t > tmin) {
-            rec->t = t;
-            rec->p = r.eval(t);
-            rec->n = (rec->p - cen) / radius;
-            get_sphere_uv(rec->n, &rec->u, &rec->v);
-            return true;
-        }
-        if (r.isInside) {
-            // back
-            t = (-b + MRT::sqrt(discriminant));
-            if (t < tmax && t > tmin) {
-                rec->t = t;
-                rec->p = r.eval(t);
-                rec->n = (rec->p - cen) / radius;
-                get_sphere_uv(rec->n, &rec->u, &rec->v);
-                return true;
-            }
-        }
+        candidates |= _mm_movemask_ps(hit) << i;
     }
-    return false;
+
+    return hit_packet_single(*this, rp, mask & candidates, tmin, tmax, rec);
 }
 
 bool sphere::bounding_box(aabb* box, float t0, float t1) const {
@@ -60,20 +56,32 @@ bool sphere::bounding_box(aabb* box, float t0, float t1) const {
     return true;
 }
 
-float sphere::pdf_value(const Vec3& origin, const Vec3& dir, float time) const {
-    hit_record rec;
-    if (this->hit(ray(origin, dir, time), 0.001f, std::numeric_limits<float>::max(), &rec)) {
-        float cos_theta_max = MRT::sqrt(1 - radius * radius / sdot(center(time) - origin));
-        float solid_angle = 2 * M_PI_F * (1 - cos_theta_max);
-        return 1 / solid_angle;
+bool sphere::lower(scene_compiler *c) const {
+    compiled_prim p;
+    p.type = PRIM_SPHERE;
+    p.mat_ptr = mat_ptr;
+
+    Vec3 velocity = isMoving ? Vec3((center1 - center0) / (time1 - time0)) : Vec3(0.0f);
+    for (int i = 0; i < 3; i++) {
+        p.sphere.center[i] = center0[i];
+        p.sphere.velocity[i] = velocity[i];
     }
-    else
-        return 0;
+    p.sphere.time0 = time0;
+    p.sphere.radius = radius;
+
+    aabb box;
+    bounding_box(&box, c->time0, c->time1);
+    p.set_box(box);
+
+    c->prims.push_back(p);
+    return true;
 }
 
-Vec3 sphere::pdf_generate(const Vec3& origin, float time) const {
-    Vec3 dir = center(time) - origin;
-    float dist_sq = sdot(dir);
-    onb uvw(normalize(dir));
-    return uvw * random_towards_sphere(radius, dist_sq);
-}
\ No newline at end of file
+void sphere::add_lights(light_list *lights) {
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT && radius > 0) {
+        Vec3 velocity = isMoving ? Vec3((center1 - center0) / (time1 - time0)) : Vec3(0.0f);
+        aabb box;
+        bounding_box(&box, time0, time1);
+        mat_ptr = lights->add_sphere(center0, velocity, time0, radius, box, mat_ptr);
+    }
+}
@@ -5,6 +5,51 @@
 #include "common.h"
 #include "pcg.h"
 #include <limits>
+#include <math.h>
+
+// gets uv for point on unit sphere (i.e. pass in normal for p)
+inline void get_sphere_uv(const Vec3& p, float *u, float *v) {
+    float phi = atan2f(p.z, p.x);
+    float theta = asinf(p.y);
+    *u = 0.5f - phi * (1.0f / (2.0f * M_PI_F));
+    *v = 0.5f + theta * (1.0f / M_PI_F);
+}
+
+// shared by sphere and the compiled scene (see compiled_scene.h)
+inline bool hit_sphere(const Vec3& cen, float radius, material *mat_ptr, const ray& r, float tmin, float tmax, hit_record *rec) {
+    STAT_ADD(prim_tests, 1);
+
+    rec->mat_ptr = mat_ptr;
+
+    Vec3 oc = r.origin - cen;
+    float b = dot(oc, r.dir);
+    float c = sdot(oc) - radius * radius;
+    float discriminant = b*b - c;
+
+    if (discriminant > 0) {
+        // front
+        float t = (-b - MRT::sqrt(discriminant));
+        if (t < tmax && t > tmin) {
+            rec->t = t;
+            rec->p = r.eval(t);
+            rec->n = (rec->p - cen) / radius;
+            get_sphere_uv(rec->n, &rec->u, &rec->v);
+            return true;
+        }
+        if (r.isInside) {
+            // back
+            t = (-b + MRT::sqrt(discriminant));
+            if (t < tmax && t > tmin) {
+                rec->t = t;
+                rec->p = r.eval(t);
+                rec->n = (rec->p - cen) / radius;
+                get_sphere_uv(rec->n, &rec->u, &rec->v);
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
 class sphere final : public scene_object {
 public:
@@ -31,8 +76,9 @@ public:
     }
 
     bool hit(const ray& r, float tmin, float tmax, hit_record *rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
     bool bounding_box(aabb *box, float t0, float t1) const override;
-    float pdf_value(const Vec3& origin, const Vec3& dir, float time) const override;
-    Vec3 pdf_generate(const Vec3& origin, float time) const override;
+    bool lower(scene_compiler *c) const override;
+    void add_lights(light_list *lights) override;
 };
 
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+
+#include "stats.h"
+
+// every set ever handed out, the ones of finished threads go to the free list and are reused by the next thread,
+// so their counts stay in the totals until the next reset
+static std::mutex G_statsLock;
+static std::vector<thread_stats*> G_stats;
+static std::vector<thread_stats*> G_freeStats;
+
+// gives the set of a thread back when it ends
+struct stats_owner {
+    thread_stats *stats = nullptr;
+    ~stats_owner() {
+        if (stats) {
+            std::lock_guard<std::mutex> guard(G_statsLock);
+            G_freeStats.push_back(stats);
+            t_stats = nullptr;
+        }
+    }
+};
+static thread_local stats_owner t_owner;
+
+#if MRT_STATS
+static const char *stage_names[ENUM_STAGE_MAX] = {
+    "camera",
+    "intersect",
+    "shade",
+};
+#endif
+
+uint64 thread_stats::ray_count() const {
+    uint64 n = shadow_rays.load(std::memory_order_relaxed);
+    for (uint32 i = 0; i < STATS_MAX_DEPTH; i++) {
+        n += rays[i].load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+uint64 stats_totals::ray_count() const {
+    uint64 n = shadow_rays;
+    for (uint32 i = 0; i < STATS_MAX_DEPTH; i++) {
+        n += rays[i];
+    }
+    return n;
+}
+
+thread_stats *register_thread_stats() {
+    std::lock_guard<std::mutex> guard(G_statsLock);
+    thread_stats *s;
+    if (!G_freeStats.empty()) {
+        s = G_freeStats.back();
+        G_freeStats.pop_back();
+    }
+    else {
+        s = new thread_stats(); // zeroed
+        G_stats.push_back(s);
+    }
+    t_owner.stats = s;
+    t_stats = s;
+    return s;
+}
+
+void stats_reset() {
+    std::lock_guard<std::mutex> guard(G_statsLock);
+    for (thread_stats *s : G_stats) {
+        for (auto& c : s->rays)        c.store(0, std::memory_order_relaxed);
+        for (auto& c : s->stage_ticks) c.store(0, std::memory_order_relaxed);
+        s->shadow_rays.store(0, std::memory_order_relaxed);
+        s->discarded.store(0, std::memory_order_relaxed);
+        s->nodes.store(0, std::memory_order_relaxed);
+        s->prim_tests.store(0, std::memory_order_relaxed);
+    }
+}
+
+stats_totals stats_collect() {
+    stats_totals t = {};
+    std::lock_guard<std::mutex> guard(G_statsLock);
+    for (const thread_stats *s : G_stats) {
+        for (uint32 i = 0; i < STATS_MAX_DEPTH; i++) t.rays[i]        += s->rays[i].load(std::memory_order_relaxed);
+        for (uint32 i = 0; i < ENUM_STAGE_MAX; i++)  t.stage_ticks[i] += s->stage_ticks[i].load(std::memory_order_relaxed);
+        t.shadow_rays += s->shadow_rays.load(std::memory_order_relaxed);
+        t.discarded   += s->discarded.load(std::memory_order_relaxed);
+        t.nodes       += s->nodes.load(std::memory_order_relaxed);
+        t.prim_tests  += s->prim_tests.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+// index of the last bounce with any rays, so the report does not list empty buckets
+static uint32 max_depth(const stats_totals& s) {
+    uint32 n = STATS_MAX_DEPTH;
+    while (n > 1 && s.rays[n - 1] == 0) n--;
+    return n;
+}
+
+void stats_print(const stats_totals& s, float seconds) {
+    uint64 rays = s.ray_count();
+    double perRay = rays ? 1.0 / rays : 0.0;
+
+    printf("Stats: %.3f Mrays in %.2fs (%.3f Mrays/s), %.3f M shadow rays, %llu samples discarded (NaN/inf)\n",
+           rays * 0.000001, seconds, seconds > 0 ? rays * 0.000001 / seconds : 0.0, s.shadow_rays * 0.000001,
+           (unsigned long long) s.discarded);
+
+    printf("  rays by bounce:");
+    for (uint32 i = 0; i < max_depth(s); i++) {
+        printf(" %u%s: %llu", i, (i == STATS_MAX_DEPTH - 1) ? "+" : "", (unsigned long long) s.rays[i]);
+    }
+    printf("\n");
+
+#if MRT_STATS
+    printf("  BVH nodes: %.3f M (%.1f per ray), primitive tests: %.3f M (%.1f per ray)\n",
+           s.nodes * 0.000001, s.nodes * perRay, s.prim_tests * 0.000001, s.prim_tests * perRay);
+
+    uint64 ticks = 0;
+    for (uint32 i = 0; i < ENUM_STAGE_MAX; i++) ticks += s.stage_ticks[i];
+    printf("  stages (summed over threads):");
+    for (uint32 i = 0; i < ENUM_STAGE_MAX; i++) {
+        printf(" %s %.2fs (%.0f%%)", stage_names[i], MRT_TimeDelta(0, s.stage_ticks[i]),
+               ticks ? 100.0 * s.stage_ticks[i] / ticks : 0.0);
+    }
+    printf("\n");
+#else
+    (void) perRay;
+    printf("  build with MRT_STATS=1 for BVH, primitive and stage counts\n");
+#endif
+}
+
+bool stats_write_json(const char *filename, const stats_totals& s, float seconds) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return false;
+    }
+
+    uint64 rays = s.ray_count();
+    fprintf(f, "{\n");
+    fprintf(f, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(f, "  \"rays\": %llu,\n", (unsigned long long) rays);
+    fprintf(f, "  \"mrays_per_second\": %.6f,\n", seconds > 0 ? rays * 0.000001 / seconds : 0.0);
+    fprintf(f, "  \"rays_by_bounce\": [");
+    for (uint32 i = 0; i < max_depth(s); i++) {
+        fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long) s.rays[i]);
+    }
+    fprintf(f, "],\n");
+    fprintf(f, "  \"shadow_rays\": %llu,\n", (unsigned long long) s.shadow_rays);
+#if MRT_STATS
+    fprintf(f, "  \"bvh_nodes\": %llu,\n", (unsigned long long) s.nodes);
+    fprintf(f, "  \"prim_tests\": %llu,\n", (unsigned long long) s.prim_tests);
+    fprintf(f, "  \"stage_seconds\": {");
+    for (uint32 i = 0; i < ENUM_STAGE_MAX; i++) {
+        fprintf(f, "%s\"%s\": %.6f", i ? ", " : "", stage_names[i], MRT_TimeDelta(0, s.stage_ticks[i]));
+    }
+    fprintf(f, "},\n");
+#endif
+    fprintf(f, "  \"discarded_samples\": %llu\n", (unsigned long long) s.discarded);
+    fprintf(f, "}\n");
+
+    bool ok = (ferror(f) == 0);
+    fclose(f);
+    if (ok) printf("Wrote %s\n", filename);
+    return ok;
+}
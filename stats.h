@@ -0,0 +1,99 @@
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <atomic>
+
+// Counters of the hot paths, every thread counts into its own set on its own cache lines, so counting is a plain load and
+// store without any traffic between the cores. stats_collect() sums up the sets of all threads for the report after a render.
+//
+// The counts that come at most once per ray (rays by bounce, shadow rays, discarded samples) are always on, the status line
+// takes the Mrays/s from them. The counts inside the traversal loops and the stage times are only compiled in with MRT_STATS
+// defined to 1 ("clang_build_linux.sh stats"), STAT_ADD and stage_timer are empty otherwise.
+// Node and primitive counts only cover single rays, the packet traversal of the camera rays (-packets 1) is not counted.
+
+#ifndef MRT_STATS
+#define MRT_STATS 0
+#endif
+
+static const uint32 STATS_MAX_DEPTH = 16; // longer paths are counted in the last bucket
+
+enum stats_stage : uint32 {
+    STAGE_CAMERA,    // camera ray generation
+    STAGE_INTERSECT, // closest hits of the path rays
+    STAGE_SHADE,     // path_bounce(), including the shadow rays of the direct light
+    ENUM_STAGE_MAX
+};
+
+// only the owning thread writes, the atomics keep the reads of stats_collect() from tearing
+struct alignas(64) thread_stats {
+    std::atomic<uint64> rays[STATS_MAX_DEPTH];       // path rays by the number of bounces before them, 0 are the camera rays
+    std::atomic<uint64> shadow_rays;
+    std::atomic<uint64> discarded;                   // NaN/inf samples
+    std::atomic<uint64> nodes;                       // BVH nodes and object lists entered, MRT_STATS only
+    std::atomic<uint64> prim_tests;                  // MRT_STATS only
+    std::atomic<uint64> stage_ticks[ENUM_STAGE_MAX]; // MRT_GetTime() units, MRT_STATS only
+
+    uint64 ray_count() const; // including the shadow rays
+};
+
+// sum of all threads
+struct stats_totals {
+    uint64 rays[STATS_MAX_DEPTH];
+    uint64 shadow_rays;
+    uint64 discarded;
+    uint64 nodes;
+    uint64 prim_tests;
+    uint64 stage_ticks[ENUM_STAGE_MAX];
+
+    uint64 ray_count() const;
+};
+
+// no lock prefix needed, nobody else writes to the counter
+inline void stat_add(std::atomic<uint64>& counter, uint64 n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline thread_local thread_stats *t_stats = nullptr;
+thread_stats *register_thread_stats();
+
+// the set of the calling thread, registered on first use
+inline thread_stats& get_thread_stats() {
+    thread_stats *s = t_stats;
+    return s ? *s : *register_thread_stats();
+}
+
+inline void count_rays(uint32 depth, uint64 n = 1) {
+    stat_add(get_thread_stats().rays[std::min(depth, STATS_MAX_DEPTH - 1)], n);
+}
+
+#if MRT_STATS
+#define STAT_ADD(counter, n) stat_add(get_thread_stats().counter, n)
+
+// adds the time since the last lap (or the construction) to a stage
+class stage_timer {
+    uint64 start;
+public:
+    stage_timer() : start(MRT_GetTime()) {}
+    void lap(stats_stage stage) {
+        uint64 now = MRT_GetTime();
+        STAT_ADD(stage_ticks[stage], now - start);
+        start = now;
+    }
+};
+#else
+#define STAT_ADD(counter, n) ((void) 0)
+
+class stage_timer {
+public:
+    void lap(stats_stage stage) {}
+};
+#endif
+
+// zeroes the sets of all threads, for a new render
+void stats_reset();
+stats_totals stats_collect();
+
+// report of a render that took seconds, stats_write_json() returns false if the file could not be written
+void stats_print(const stats_totals& s, float seconds);
+bool stats_write_json(const char *filename, const stats_totals& s, float seconds);
@@ -8,19 +8,19 @@ Vec3 checker_tex::sample(float u, float v, const Vec3& p) const {
 #if 1
     float sines = sinf(scale * p.x) * sinf(scale * p.y) * sinf(scale * p.z);
     if (sines < 0)
-        return odd->sample(u, v, p);
+        return sample_texture(odd, u, v, p);
     else
-        return even->sample(u, v, p);
+        return sample_texture(even, u, v, p);
 #else       
     float u_ = scale * u;
     float v_ = scale * v;
     int32 select = int32(floor(u_) + floor(v_));
 
     if (select & 1) {
-        return odd->sample(u, v, p);
+        return sample_texture(odd, u, v, p);
     }
     else
-        return even->sample(u, v, p);
+        return sample_texture(even, u, v, p);
 #endif
 }
 
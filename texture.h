@@ -2,8 +2,20 @@
 
 #include "vec3.h"
 
+// used to sample textures through a switch instead of a virtual call, see sample_texture()
+enum texture_type : uint8 {
+    TEXTURE_COLOR,
+    TEXTURE_CHECKER,
+    TEXTURE_PERLIN,
+    TEXTURE_IMAGE
+};
+
 class texture {
 public:
+    const texture_type type;
+
+    texture(texture_type type) : type(type) {}
+
     virtual Vec3 sample(float u, float v, const Vec3& p) const = 0;
     virtual ~texture() {}
 };
@@ -12,8 +24,8 @@ class color_tex final : public texture {
 public:
     Vec3 color;
 
-    color_tex() {}
-    color_tex(const Vec3& c) : color(c) {}
+    color_tex() : texture(TEXTURE_COLOR) {}
+    color_tex(const Vec3& c) : texture(TEXTURE_COLOR), color(c) {}
 
     Vec3 sample(float u, float v, const Vec3& p) const override {
         return color;
@@ -27,7 +39,7 @@ public:
     texture *odd;
     float scale;
 
-    checker_tex(texture *t0, texture *t1, float scale) : even(t0), odd(t1), scale(scale) {}
+    checker_tex(texture *t0, texture *t1, float scale) : texture(TEXTURE_CHECKER), even(t0), odd(t1), scale(scale) {}
 
     Vec3 sample(float u, float v, const Vec3& p) const override;
 
@@ -50,8 +62,8 @@ public:
     perlin_noise noise;
     float scale;
 
-    perlin_tex() : scale(1) {}
-    perlin_tex(float scale) : scale(scale) {}
+    perlin_tex() : texture(TEXTURE_PERLIN), scale(1) {}
+    perlin_tex(float scale) : texture(TEXTURE_PERLIN), scale(scale) {}
 
     Vec3 sample(float u, float v, const Vec3& p) const override {
         //return Vec3(1, 1, 1) * 0.5f * (1 + noise.noise(p*scale));
@@ -70,7 +82,19 @@ public:
     uint8 *data;
     int32 width, height;
 
-    image_tex(uint8 *pixels, int32 width, int32 height) : data(pixels), width(width), height(height) {}
+    image_tex(uint8 *pixels, int32 width, int32 height) : texture(TEXTURE_IMAGE), data(pixels), width(width), height(height) {}
     
     Vec3 sample(float u, float v, const Vec3& p) const override;
-};
\ No newline at end of file
+};
+
+
+// all texture classes are final, so the calls below are resolved statically
+inline Vec3 sample_texture(const texture *t, float u, float v, const Vec3& p) {
+    switch (t->type) {
+    case TEXTURE_COLOR:   return static_cast<const color_tex*>(t)->color;
+    case TEXTURE_CHECKER: return static_cast<const checker_tex*>(t)->sample(u, v, p);
+    case TEXTURE_PERLIN:  return static_cast<const perlin_tex*>(t)->sample(u, v, p);
+    case TEXTURE_IMAGE:   return static_cast<const image_tex*>(t)->sample(u, v, p);
+    default:              return t->sample(u, v, p);
+    }
+}
@@ -0,0 +1,428 @@
+#include <float.h>
+#include <string.h>
+
+#include "tonemap.h"
+
+// operator constants
+static const float LOGMAP_DISPLAY_MAX = 230.0f; // reference maximum display brightness in cd/m^2
+static const float LOGMAP_BIAS = 0.5145731728297583f; // logf(0.7f) / logf(0.5f), tune the numerator!
+static const float REINHARD_KEY = 0.10f;   // "key value" (middle gray)
+static const float REINHARD_SIGMA = 0.00001f;
+static const float ACES_EXPOSURE = 0.6f;
+static const float INV_GAMMA = 1.0f / MRT_GAMMA;
+
+tonemap_consts tonemap_prepare(tonemap_operator op, const tonemap_stats& stats) {
+    tonemap_consts k;
+    k.op = op;
+    float maxLum = std::max(stats.maxLum, 0.000001f); // the image may still be black
+    k.invMax = 1.0f / maxLum;
+    k.invMax2 = k.invMax * k.invMax;
+    if (op == TONEMAP_LOGMAP) {
+        k.scale = LOGMAP_DISPLAY_MAX * 0.01f / log10f(maxLum + 1.0f);
+    }
+    else if (op == TONEMAP_REINHARD) {
+        // NOTE: in the paper, 1/N is in the wrong place, producing inf/nan values
+        float logAvg = stats.count ? exp2f(float(stats.logLumSum / double(stats.count))) : 1.0f;
+        k.scale = REINHARD_KEY / logAvg;
+    }
+    else {
+        k.scale = 1.0f;
+    }
+    return k;
+}
+
+////////////////////////////
+//      SCALAR PATH       //
+////////////////////////////
+
+// polynomial fits on [1, 2) and [0, 1), max error ~2e-5 and ~4e-6, plenty for 8-bit output
+#define LOG2_POLY(p) (1.44187990f + p * (-0.70886522f + p * (0.41524556f + p * (-0.19351652f + p * 0.04526829f))))
+#define EXP2_POLY(f) (1.00000360f + f * (0.69296955f + f * (0.24162132f + f * (0.05171774f + f * 0.01368398f))))
+
+static inline float fast_log2(float x) {
+    x = std::max(x, FLT_MIN);
+    uint32 bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float e = float(int32(bits >> 23) - 127);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    float p = m - 1.0f;
+    return e + p * LOG2_POLY(p);
+}
+
+static inline float fast_exp2(float x) {
+    x = std::min(std::max(x, -126.0f), 127.0f);
+    float i = floorf(x);
+    float f = x - i;
+    uint32 bits = uint32(int32(i) + 127) << 23;
+    float s;
+    memcpy(&s, &bits, sizeof(s));
+    return s * EXP2_POLY(f);
+}
+
+static inline float aces(float x) {
+    x *= ACES_EXPOSURE;
+    return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+}
+
+static inline uint32 tonemap_pixel(const tonemap_consts& k, Vec3 c) {
+    float lum = luminance(c);
+    float r = c.r, g = c.g, b = c.b;
+
+    switch (k.op) {
+    case TONEMAP_LOGMAP: {
+        // log(lum + 1) / log(2 + 8 * (lum / max)^bias), the ratio is the same in base 2
+        float lw = fast_log2(lum + 1.0f);
+        float ld = fast_log2(2.0f + 8.0f * fast_exp2(LOGMAP_BIAS * fast_log2(lum * k.invMax)));
+        float s = k.scale * lw / (ld * (lum + 0.00001f));
+        r *= s; g *= s; b *= s;
+    } break;
+    case TONEMAP_REINHARD: {
+        float l = k.scale * lum;
+        l = l * (1.0f + l * k.invMax2) / (1.0f + l);
+        float s = l / (lum + REINHARD_SIGMA);
+        r *= s; g *= s; b *= s;
+    } break;
+    case TONEMAP_ACES:
+        r = aces(r); g = aces(g); b = aces(b);
+        // fall through
+    default:
+        r = fast_exp2(INV_GAMMA * fast_log2(std::min(r, 1.0f)));
+        g = fast_exp2(INV_GAMMA * fast_log2(std::min(g, 1.0f)));
+        b = fast_exp2(INV_GAMMA * fast_log2(std::min(b, 1.0f)));
+        break;
+    }
+
+    uint32 red   = (uint32) (std::min(std::max(r, 0.0f), 1.0f) * 255.99f);
+    uint32 green = (uint32) (std::min(std::max(g, 0.0f), 1.0f) * 255.99f);
+    uint32 blue  = (uint32) (std::min(std::max(b, 0.0f), 1.0f) * 255.99f);
+    return (red << 16) | (green << 8) | blue;
+}
+
+////////////////////////////
+//       AVX2 PATH        //
+////////////////////////////
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+static inline __m256 fast_log2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(_mm256_max_ps(x, _mm256_set1_ps(FLT_MIN)));
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+    __m256 p = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+
+    __m256 poly = _mm256_set1_ps(0.04526829f);
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, p), _mm256_set1_ps(-0.19351652f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, p), _mm256_set1_ps(0.41524556f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, p), _mm256_set1_ps(-0.70886522f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, p), _mm256_set1_ps(1.44187990f));
+    return _mm256_add_ps(e, _mm256_mul_ps(p, poly));
+}
+
+static inline __m256 fast_exp2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(127.0f));
+    __m256 i = _mm256_floor_ps(x);
+    __m256 f = _mm256_sub_ps(x, i);
+
+    __m256 poly = _mm256_set1_ps(0.01368398f);
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, f), _mm256_set1_ps(0.05171774f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, f), _mm256_set1_ps(0.24162132f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, f), _mm256_set1_ps(0.69296955f));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, f), _mm256_set1_ps(1.00000360f));
+
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(i), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(poly, _mm256_castsi256_ps(bits));
+}
+
+static inline __m256 aces(__m256 x) {
+    x = _mm256_mul_ps(x, _mm256_set1_ps(ACES_EXPOSURE));
+    __m256 num = _mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(2.51f)), _mm256_set1_ps(0.03f)));
+    __m256 den = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(2.43f)), _mm256_set1_ps(0.59f))), _mm256_set1_ps(0.14f));
+    return _mm256_div_ps(num, den);
+}
+
+static inline __m256 gamma(__m256 x) {
+    return fast_exp2(_mm256_mul_ps(_mm256_set1_ps(INV_GAMMA), fast_log2(_mm256_min_ps(x, _mm256_set1_ps(1.0f)))));
+}
+
+// loads 8 pixels as SoA, the lanes hold pixels 0 2 4 6 1 3 5 7
+static inline void load8(const Vec3 *px, __m256 *r, __m256 *g, __m256 *b) {
+    __m256 p01 = _mm256_loadu_ps(&px[0].x);
+    __m256 p23 = _mm256_loadu_ps(&px[2].x);
+    __m256 p45 = _mm256_loadu_ps(&px[4].x);
+    __m256 p67 = _mm256_loadu_ps(&px[6].x);
+
+    __m256 t0 = _mm256_unpacklo_ps(p01, p23); // r0 r2 g0 g2 | r1 r3 g1 g3
+    __m256 t1 = _mm256_unpackhi_ps(p01, p23); // b0 b2 a0 a2 | b1 b3 a1 a3
+    __m256 t2 = _mm256_unpacklo_ps(p45, p67);
+    __m256 t3 = _mm256_unpackhi_ps(p45, p67);
+
+    *r = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    *g = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    *b = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+}
+
+static inline __m256 luminance8(__m256 r, __m256 g, __m256 b) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.212655f)),
+                                       _mm256_mul_ps(g, _mm256_set1_ps(0.715158f))),
+                                       _mm256_mul_ps(b, _mm256_set1_ps(0.072187f)));
+}
+
+static inline __m256i to_byte(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(255.99f)));
+}
+
+static inline void tonemap8(const tonemap_consts& k, const Vec3 *px, uint32 *out) {
+    __m256 r, g, b;
+    load8(px, &r, &g, &b);
+    __m256 lum = luminance8(r, g, b);
+
+    switch (k.op) {
+    case TONEMAP_LOGMAP: {
+        __m256 lw = fast_log2(_mm256_add_ps(lum, _mm256_set1_ps(1.0f)));
+        __m256 pw = fast_exp2(_mm256_mul_ps(_mm256_set1_ps(LOGMAP_BIAS), fast_log2(_mm256_mul_ps(lum, _mm256_set1_ps(k.invMax)))));
+        __m256 ld = fast_log2(_mm256_add_ps(_mm256_set1_ps(2.0f), _mm256_mul_ps(_mm256_set1_ps(8.0f), pw)));
+        __m256 s = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(k.scale), lw),
+                                 _mm256_mul_ps(ld, _mm256_add_ps(lum, _mm256_set1_ps(0.00001f))));
+        r = _mm256_mul_ps(r, s); g = _mm256_mul_ps(g, s); b = _mm256_mul_ps(b, s);
+    } break;
+    case TONEMAP_REINHARD: {
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 l = _mm256_mul_ps(_mm256_set1_ps(k.scale), lum);
+        l = _mm256_div_ps(_mm256_mul_ps(l, _mm256_add_ps(one, _mm256_mul_ps(l, _mm256_set1_ps(k.invMax2)))), _mm256_add_ps(one, l));
+        __m256 s = _mm256_div_ps(l, _mm256_add_ps(lum, _mm256_set1_ps(REINHARD_SIGMA)));
+        r = _mm256_mul_ps(r, s); g = _mm256_mul_ps(g, s); b = _mm256_mul_ps(b, s);
+    } break;
+    case TONEMAP_ACES:
+        r = aces(r); g = aces(g); b = aces(b);
+        // fall through
+    default:
+        r = gamma(r); g = gamma(g); b = gamma(b);
+        break;
+    }
+
+    __m256i argb = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(to_byte(r), 16), _mm256_slli_epi32(to_byte(g), 8)), to_byte(b));
+    argb = _mm256_permutevar8x32_epi32(argb, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)); // back to pixel order
+    _mm256_storeu_si256((__m256i*) out, argb);
+}
+#endif
+
+////////////////////////////
+//         PASSES         //
+////////////////////////////
+
+bool tonemap_needs_stats(tonemap_operator op) {
+    return (op == TONEMAP_LOGMAP) || (op == TONEMAP_REINHARD);
+}
+
+void tonemap_gather(const Vec3 *pixels, size_t count, tonemap_stats *stats) {
+    size_t i = 0;
+    float maxLum = stats->maxLum;
+    double logLumSum = 0;
+
+#ifdef __AVX2__
+    __m256 vmax = _mm256_set1_ps(maxLum);
+    while (i + 8 <= count) {
+        // float sums lose precision over millions of pixels, so they go into the double every few thousand
+        __m256 vsum = _mm256_setzero_ps();
+        size_t end = std::min(count & ~size_t(7), i + 4096);
+        for (; i < end; i += 8) {
+            __m256 r, g, b;
+            load8(&pixels[i], &r, &g, &b);
+            __m256 lum = luminance8(r, g, b);
+            vmax = _mm256_max_ps(vmax, lum);
+            vsum = _mm256_add_ps(vsum, fast_log2(_mm256_add_ps(lum, _mm256_set1_ps(REINHARD_SIGMA))));
+        }
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, vsum);
+        for (float l : lanes) logLumSum += l;
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, vmax);
+    for (float l : lanes) maxLum = std::max(maxLum, l);
+#endif
+
+    for (; i < count; i++) {
+        float lum = luminance(pixels[i]);
+        maxLum = std::max(maxLum, lum);
+        logLumSum += fast_log2(lum + REINHARD_SIGMA);
+    }
+
+    stats->maxLum = maxLum;
+    stats->logLumSum += logLumSum;
+    stats->count += count;
+}
+
+void tonemap_apply(const tonemap_consts& k, const Vec3 *pixels, uint32 *out, size_t count) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + 8 <= count; i += 8) {
+        tonemap8(k, &pixels[i], &out[i]);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = tonemap_pixel(k, pixels[i]);
+    }
+}
+
+// the unchanged tiles are mapped again once the constants moved by more than this (relative)
+static const float REFRESH_TOLERANCE = 0.01f;
+
+static bool close_enough(const tonemap_consts& a, const tonemap_consts& b) {
+    return (fabsf(a.scale - b.scale) <= REFRESH_TOLERANCE * fabsf(b.scale))
+        && (fabsf(a.invMax - b.invMax) <= REFRESH_TOLERANCE * fabsf(b.invMax));
+}
+
+////////////////////////////
+//      THREAD POOL       //
+////////////////////////////
+
+tonemapper::tonemapper(uint32 numThreads) {
+    numThreads = std::max(numThreads, 1u);
+    bandStats.resize(numThreads);
+    for (uint32 i = 1; i < numThreads; i++) {
+        helpers.emplace_back(&tonemapper::helper, this, i);
+    }
+}
+
+tonemapper::~tonemapper() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : helpers) {
+        t.join();
+    }
+}
+
+void tonemapper::helper(uint32 band) {
+    uint64 seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            wake.wait(l, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+        runBand(band);
+        {
+            std::lock_guard<std::mutex> l(lock);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+}
+
+void tonemapper::runBand(uint32 band) {
+    size_t numBands = bandStats.size();
+
+    if (pass == GATHER_RANGE || pass == APPLY_RANGE) {
+        // bands start at multiples of 8 pixels, so only the last one has a scalar tail
+        size_t begin = ((count * band) / numBands) & ~size_t(7);
+        size_t end = (band + 1 == numBands) ? count : ((count * (band + 1)) / numBands) & ~size_t(7);
+
+        if (pass == GATHER_RANGE) {
+            bandStats[band] = tonemap_stats();
+            tonemap_gather(pixels + begin, end - begin, &bandStats[band]);
+        }
+        else {
+            tonemap_apply(consts, pixels + begin, out + begin, end - begin);
+        }
+        return;
+    }
+
+    for (size_t i = (count * band) / numBands; i < (count * (band + 1)) / numBands; i++) {
+        uint32 index = tileList[i];
+        const tile& t = tiles[index];
+        uint32 tileWidth = t.xMax - t.xMin;
+
+        if (pass == GATHER_TILES) {
+            tileStats[index] = tonemap_stats();
+            for (uint32 y = t.yMin; y < t.yMax; y++) {
+                tonemap_gather(pixels + t.xMin + size_t(y) * width, tileWidth, &tileStats[index]);
+            }
+        }
+        else {
+            for (uint32 y = t.yMin; y < t.yMax; y++) {
+                size_t offset = t.xMin + size_t(y) * width;
+                tonemap_apply(consts, pixels + offset, out + offset, tileWidth);
+            }
+        }
+    }
+}
+
+void tonemapper::runPass(pass_type type) {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        pass = type;
+        pending = (uint32) helpers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    runBand(0);
+
+    std::unique_lock<std::mutex> l(lock);
+    done.wait(l, [&] { return pending == 0; });
+}
+
+void tonemapper::run(tonemap_operator op, const Vec3 *pixels, uint32 *out, size_t count) {
+    this->pixels = pixels;
+    this->out = out;
+    this->count = count;
+
+    tonemap_stats stats;
+    if (tonemap_needs_stats(op)) {
+        runPass(GATHER_RANGE);
+        for (const tonemap_stats& s : bandStats) {
+            stats.merge(s);
+        }
+    }
+
+    consts = tonemap_prepare(op, stats);
+    runPass(APPLY_RANGE);
+}
+
+void tonemapper::reset(size_t numTiles) {
+    tileStats.assign(numTiles, tonemap_stats());
+    allTiles.resize(numTiles);
+    for (size_t i = 0; i < numTiles; i++) {
+        allTiles[i] = uint32(i);
+    }
+    mappedOp = ENUM_TONEMAP_MAX;
+}
+
+bool tonemapper::update(tonemap_operator op, const Vec3 *pixels, uint32 *out, uint32 width, const tile *tiles, const std::vector<uint32>& dirty) {
+    this->pixels = pixels;
+    this->out = out;
+    this->width = width;
+    this->tiles = tiles;
+    this->tileList = dirty.data();
+    this->count = dirty.size();
+
+    tonemap_stats stats;
+    if (tonemap_needs_stats(op)) {
+        if (!dirty.empty())
+            runPass(GATHER_TILES);
+        for (const tonemap_stats& s : tileStats) {
+            stats.merge(s);
+        }
+    }
+    consts = tonemap_prepare(op, stats);
+
+    bool partial = (op == mappedOp) && close_enough(consts, mappedConsts);
+    if (!partial) {
+        tileList = allTiles.data();
+        count = allTiles.size();
+        mappedOp = op;
+        mappedConsts = consts;
+    }
+    if (count)
+        runPass(APPLY_TILES);
+    return partial;
+}
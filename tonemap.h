@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common.h"
+#include "vec3.h"
+#include "work_queue.h" // tile
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tone mapping from the linear buffer to the display buffer (ARGB in register, BGRA in memory).
+// The operators use polynomial approximations of log2/exp2 instead of logf/powf, 8 pixels at a time with AVX2.
+
+enum tonemap_operator : uint32 {
+    TONEMAP_LOGMAP,   // Adaptive Logarithmic Mapping (Drago et al. 2003)
+    TONEMAP_REINHARD, // Photographic Tone Reproduction (Reinhard et al. 2002)
+    TONEMAP_ACES,     // filmic curve fit (Narkowicz 2015) with gamma correction
+    TONEMAP_GAMMA,    // clamp and gamma correct only
+    ENUM_TONEMAP_MAX
+};
+
+// image statistics the operators depend on, gathered per range and merged
+struct tonemap_stats {
+    float maxLum = 0;
+    double logLumSum = 0; // sum of log2(lum + sigma), for the log average luminance
+    size_t count = 0;
+
+    void merge(const tonemap_stats& s) {
+        maxLum = std::max(maxLum, s.maxLum);
+        logLumSum += s.logLumSum;
+        count += s.count;
+    }
+};
+
+// per image values of the operators, derived from the statistics
+struct tonemap_consts {
+    tonemap_operator op;
+    float scale;   // logmap: display scale over the log of the maximum, reinhard: key over the log average
+    float invMax;  // inverse maximum luminance
+    float invMax2; // inverse squared maximum luminance
+};
+
+// false if the operator does not need tonemap_gather()
+bool tonemap_needs_stats(tonemap_operator op);
+void tonemap_gather(const Vec3 *pixels, size_t count, tonemap_stats *stats);
+tonemap_consts tonemap_prepare(tonemap_operator op, const tonemap_stats& stats);
+void tonemap_apply(const tonemap_consts& k, const Vec3 *pixels, uint32 *out, size_t count);
+
+// Splits both passes over the whole buffer between the calling thread and a few helper threads.
+// The helpers run at normal priority, so they get ahead of the (lowered) render workers for the short time this takes.
+//
+// The window uses the incremental mode instead: only the tiles the workers marked since the last frame are gathered and mapped.
+// Every tile keeps its own statistics, so the image statistics stay exact without looking at the other tiles, but the unchanged
+// tiles keep the mapping they were converted with. All tiles are mapped again once that drifted too far from the current one.
+class tonemapper {
+    enum pass_type {
+        GATHER_RANGE,
+        APPLY_RANGE,
+        GATHER_TILES,
+        APPLY_TILES,
+    };
+
+    std::vector<std::thread> helpers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64 generation = 0; // incremented for every pass
+    uint32 pending = 0;    // helpers still working on the current pass
+    bool quit = false;
+
+    // current job
+    pass_type pass;
+    tonemap_consts consts;   // apply passes only
+    const Vec3 *pixels;
+    uint32 *out;
+    size_t count;            // ranges: pixels, tiles: entries in tileList
+    uint32 width;            // tiles only
+    const tile *tiles;       // tiles only
+    const uint32 *tileList;  // tiles only
+    std::vector<tonemap_stats> bandStats;
+
+    // incremental mode
+    std::vector<tonemap_stats> tileStats;
+    std::vector<uint32> allTiles;
+    tonemap_operator mappedOp = ENUM_TONEMAP_MAX;
+    tonemap_consts mappedConsts; // what the unchanged tiles were mapped with
+
+    void helper(uint32 band);
+    void runBand(uint32 band);
+    void runPass(pass_type type);
+public:
+    explicit tonemapper(uint32 numThreads); // including the calling thread
+    ~tonemapper();
+
+    void run(tonemap_operator op, const Vec3 *pixels, uint32 *out, size_t count);
+
+    // forgets the tile statistics, for a new render
+    void reset(size_t numTiles);
+    // maps the dirty tiles (indices into tiles), returns false if all tiles had to be mapped again
+    bool update(tonemap_operator op, const Vec3 *pixels, uint32 *out, uint32 width, const tile *tiles, const std::vector<uint32>& dirty);
+};
@@ -1,6 +1,7 @@
 #include "common.h"
 #include "triangle.h"
 #include "vec3.h"
+#include "light.h"
 
 triangle_scene_object::triangle_scene_object(const Vec3 &a, const Vec3 &b, const Vec3 &c, material *mat) : mat_ptr(mat) {
 #ifdef NEW_INTERSECT
@@ -44,9 +45,20 @@ bool triangle_scene_object::bounding_box(aabb* box, float time0, float time1) co
     return true;
 }
 
+void triangle_scene_object::add_lights(light_list *lights) {
+#ifndef NEW_INTERSECT
+    Vec3 a = m;
+    Vec3 b = m + u;
+    Vec3 c = m + v;
+#endif
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT)
+        mat_ptr = lights->add_triangle(a, b, c, mat_ptr);
+}
+
 #define TRI_EPS 0.00001f
 
 bool triangle_scene_object::hit(const ray& r, float tmin, float tmax, hit_record *rec) const {
+    STAT_ADD(prim_tests, 1);
 #ifndef NEW_INTERSECT
     Vec3 pvec = cross(r.dir, v);
     float det = dot(u, pvec);
@@ -217,9 +229,20 @@ bool triangle::bounding_box(aabb* box, float time0, float time1) const {
     return true;
 }
 
+void triangle::add_lights(light_list *lights) {
+#ifndef NEW_INTERSECT
+    Vec3 a = m;
+    Vec3 b = m + u;
+    Vec3 c = m + v;
+#endif
+    if (mat_ptr->type == MATERIAL_DIFFUSE_LIGHT)
+        mat_ptr = lights->add_triangle(a, b, c, mat_ptr);
+}
+
 #define TRI_EPS 0.00001f
 
 bool triangle::hit(const ray& r, float tmin, float tmax, hit_record* rec) const {
+    STAT_ADD(prim_tests, 1);
 #ifndef NEW_INTERSECT
     Vec3 pvec = cross(r.dir, v);
     float det = dot(u, pvec);
@@ -345,4 +368,54 @@ bool triangle::hit(const ray& r, float tmin, float tmax, hit_record* rec) const
     rec->mat_ptr = mat_ptr;
     return true;
 #endif
-}
\ No newline at end of file
+}
+
+// SIMD version of the test in triangle::hit() (4 rays against one triangle), returns the rays in mask that hit
+uint32 triangle_packet_test(const Vec3& m, const Vec3& u, const Vec3& v, const ray_packet& rp, uint32 mask, float tmin, const float tmax[]) {
+    __m128 ux = _mm_set1_ps(u.x), uy = _mm_set1_ps(u.y), uz = _mm_set1_ps(u.z);
+    __m128 vx = _mm_set1_ps(v.x), vy = _mm_set1_ps(v.y), vz = _mm_set1_ps(v.z);
+
+    uint32 candidates = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; i += 4)
+    {
+        if (!((mask >> i) & 0xF)) continue;
+
+        __m128 dx = _mm_load_ps(&rp.dx[i]), dy = _mm_load_ps(&rp.dy[i]), dz = _mm_load_ps(&rp.dz[i]);
+
+        // pvec = cross(dir, v)
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, vz), _mm_mul_ps(dz, vy));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, vx), _mm_mul_ps(dx, vz));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, vy), _mm_mul_ps(dy, vx));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, px), _mm_mul_ps(uy, py)), _mm_mul_ps(uz, pz));
+
+        // tvec = origin - m
+        __m128 tx = _mm_sub_ps(_mm_load_ps(&rp.ox[i]), _mm_set1_ps(m.x));
+        __m128 ty = _mm_sub_ps(_mm_load_ps(&rp.oy[i]), _mm_set1_ps(m.y));
+        __m128 tz = _mm_sub_ps(_mm_load_ps(&rp.oz[i]), _mm_set1_ps(m.z));
+        __m128 uu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz));
+
+        // qvec = cross(tvec, u)
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, uz), _mm_mul_ps(tz, uy));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, ux), _mm_mul_ps(tx, uz));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, uy), _mm_mul_ps(ty, ux));
+        __m128 vv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz));
+        __m128 t  = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, qx), _mm_mul_ps(vy, qy)), _mm_mul_ps(vz, qz)), det);
+
+        // packets never start inside a volume, so backfaces are always culled
+        __m128 hit = _mm_cmpge_ps(det, _mm_set1_ps(TRI_EPS));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(uu, _mm_setzero_ps()), _mm_cmple_ps(uu, det)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(vv, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(uu, vv), det)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tmin)), _mm_cmple_ps(t, _mm_loadu_ps(&tmax[i]))));
+
+        candidates |= _mm_movemask_ps(hit) << i;
+    }
+    return mask & candidates;
+}
+
+// the rays that pass the SIMD test are then finished by hit() to fill in the records
+uint32 triangle::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const {
+#ifndef NEW_INTERSECT
+    mask = triangle_packet_test(m, u, v, rp, mask, tmin, tmax);
+#endif
+    return hit_packet_single(*this, rp, mask, tmin, tmax, rec);
+}
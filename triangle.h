@@ -3,8 +3,12 @@
 #include "scene_object.h"
 #include "vec3.h"
 #include <memory>
+#include <cstring>
 #include <vector>
 #include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #ifdef NEW_INTERSECT
 //#define BACKFACE_CULLING
@@ -26,7 +30,9 @@ struct triangle {
     triangle(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& an, const Vec3& bn, const Vec3& cn, material* mat);
 
     bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const;
     bool bounding_box(aabb* box, float time0, float time1) const;
+    void add_lights(light_list *lights); // see scene_object::add_lights()
 
     Vec3 get_centroid() const {
         return (m + (m + u) + (m + v)) * (1.0f / 3.0f);
@@ -41,41 +47,114 @@ struct triangle {
     }
 };
 
+// Moeller-Trumbore test of up to RAY_PACKET_SIZE rays against the triangle m, m+u, m+v (backfaces culled), returns the rays in mask that hit
+uint32 triangle_packet_test(const Vec3& m, const Vec3& u, const Vec3& v, const ray_packet& rp, uint32 mask, float tmin, const float tmax[]);
+
 // the following code is based on https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
+// and https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/ (binned SAH)
 
 struct pod_bvh_node {
     aabb box;
-    uint32 left;
-    //uint32 right; // implicit, is always left+1
-    uint32 prim_offset;
-    uint32 prim_count;
-    uint8 node_order;
+    uint32 left_first; // leaf: first primitive, interior: left child (right child is always left+1)
+    uint32 prim_count; // 0 for interior nodes
     bool is_leaf() const {
         return prim_count != 0;
     }
 };
 
+enum bvh_build_mode {
+    BVH_BUILD_MIDPOINT, // split at the middle of the largest extent, fast to build but slow to trace
+    BVH_BUILD_SAH,      // binned surface area heuristic
+};
+
+#define BVH_SAH_BINS 16
+#define BVH_MAX_DEPTH 64 // traversal stack size, the builder makes leaves below this depth
+
+// the top of the tree is split by one thread, subtrees below this size are then built in parallel
+#define BVH_PARALLEL_MIN_PRIMS 4096
+// nodes above this size bin their primitives on all threads
+#define BVH_PARALLEL_BINNING_MIN_PRIMS 65536
+
+// primitives that can report their box at a point in time, BVHs over them interpolate the node bounds by the ray time if any of them moves
+template<typename T>
+concept bvh_motion_prim = requires(const T& prim, aabb* box, float time) { prim.add_to_box(box, time); };
+
+template<typename T>
+concept bvh_light_prim = requires(T& prim, light_list* lights) { prim.add_lights(lights); };
+
 template<typename T>
 class pod_bvh final : public scene_object {
     std::unique_ptr<T[]> prims;
     std::unique_ptr<pod_bvh_node[]> nodes;
     std::unique_ptr<Vec3[]> centroids;
+    std::unique_ptr<aabb[]> motion_boxes; // boxes at time0 and time1 of every node, null if nothing moves
+    float time0;
+    float inv_duration;
     uint32 prim_count;
     uint32 node_count;
     uint32 root_node = 0;
+
+    template<typename, int> friend class wide_bvh; // collapses the binary tree
 public:
-    pod_bvh(T list[], size_t n, float time0, float time1);
+    pod_bvh(T list[], size_t n, float time0, float time1, bvh_build_mode mode = BVH_BUILD_SAH);
     bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const override;
-    bool hit(uint32 node_index, const ray& r, float tmin, float tmax, hit_record* rec) const;
     bool bounding_box(aabb* box, float time0, float time1) const override;
+    void add_lights(light_list *lights) override {
+        if constexpr (bvh_light_prim<T>) {
+            for (uint32 i = 0; i < prim_count; i++) {
+                prims[i].add_lights(lights);
+            }
+        }
+    }
+    uint32 get_node_count() const { return node_count; }
+private:
+    struct build_entry {
+        uint32 node_index;
+        uint32 depth;
+    };
+    struct sah_bins {
+        aabb box[3][BVH_SAH_BINS];
+        uint32 count[3][BVH_SAH_BINS];
+    };
+
     void update_node_box(uint32 node_index);
-    void subdivide(uint32 node_index);
-    void precompute_node_order(uint32 node_index);
+    void build(bvh_build_mode mode);
+    void build_subtree(build_entry root, bvh_build_mode mode, std::atomic<uint32>* next_node);
+    bool split_node(build_entry cur, bvh_build_mode mode, uint32 num_threads, std::atomic<uint32>* next_node, std::vector<build_entry>* stack);
+    void reorder_nodes();
+    void build_motion_boxes(float time0, float time1);
+    template<bool MOTION>
+    bool traverse(const ray& r, float tmin, float tmax, hit_record* rec) const;
+    float find_midpoint_split(const pod_bvh_node& node, int* axis, float* split_pos) const;
+    float find_sah_split(const pod_bvh_node& node, uint32 num_threads, int* axis, float* split_pos) const;
+    void bin_prims(uint32 first, uint32 count, const aabb& centroid_box, sah_bins* bins) const;
+    uint32 partition(const pod_bvh_node& node, int axis, float split_pos);
 };
 
+// runs job(i) for i in [0, count) on up to num_threads threads, including the calling thread
+template<typename F>
+inline void bvh_parallel_for(uint32 count, uint32 num_threads, const F& job)
+{
+    std::atomic<uint32> next(0);
+    auto worker = [&]() {
+        for (uint32 i = next++; i < count; i = next++) {
+            job(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32 i = 1; i < std::min(count, num_threads); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
 
 template<typename T>
-inline pod_bvh<T>::pod_bvh(T list[], size_t n, float time0, float time1)
+inline pod_bvh<T>::pod_bvh(T list[], size_t n, float time0, float time1, bvh_build_mode mode)
 {
     prim_count = (uint32)n;
     
@@ -85,240 +164,454 @@ inline pod_bvh<T>::pod_bvh(T list[], size_t n, float time0, float time1)
     memcpy(prims.get(), list, n * sizeof(T)); // TODO: we can eliminate this copy later
     centroids = std::make_unique_for_overwrite<Vec3[]>(n);
 
-    for (int i = 0; i < n; i++) {
+    for (size_t i = 0; i < n; i++) {
         centroids[i] = list[i].get_centroid();
     }
 
+    uint64 build_start = MRT_GetTime();
+
     node_count = 1;
     auto& root = nodes[root_node];
-    root.left = 0;
-    //root.right = 0;
-    root.prim_offset = 0;
+    root.left_first = 0;
     root.prim_count = prim_count;
     update_node_box(root_node);
 
-    subdivide(root_node);
+    build(mode);
+    build_motion_boxes(time0, time1);
+
+    centroids.reset(); // only needed for the build
+    G_bvhBuildTicks += MRT_GetTime() - build_start;
 }
 
+// The top of the tree is split on this thread (with parallel binning for big nodes), the subtrees below BVH_PARALLEL_MIN_PRIMS
+// are then built in parallel. Split decisions only depend on the primitives of a node, so the tree is the same as a serial build,
+// only the node indices depend on the thread timing until reorder_nodes() puts them into serial order.
 template<typename T>
-inline void pod_bvh<T>::subdivide(uint32 node_index)
+inline void pod_bvh<T>::build(bvh_build_mode mode)
 {
-    auto& node = nodes[node_index];
-    if (node.prim_count <= 2) return;
+    uint32 num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<uint32> next_node(node_count);
 
-    // split pos is largest extent
-    Vec3 extent2 = node.box.max - node.box.min;
-    int axis = 0;
-    if (extent2.y > extent2.x) axis = 1;
-    if (extent2.z > extent2[axis]) axis = 2;
-    float splitPos = node.box.min[axis] + extent2[axis] * 0.5f;
+    std::vector<build_entry> tasks;
+    std::vector<build_entry> stack;
+    stack.push_back({ root_node, 0 });
 
-    // partition list by split pos
-    int i = node.prim_offset;
-    int j = i + node.prim_count - 1;
-    while (i <= j)
+    while (!stack.empty())
     {
-        if (centroids[i][axis] < splitPos)
-            i++;
-        else {
-            std::swap(prims[i], prims[j]);
-            std::swap(centroids[i], centroids[j]);
-            j--;
-        }
+        build_entry cur = stack.back();
+        stack.pop_back();
+
+        if (num_threads == 1 || nodes[cur.node_index].prim_count < BVH_PARALLEL_MIN_PRIMS)
+            tasks.push_back(cur);
+        else
+            split_node(cur, mode, num_threads, &next_node, &stack);
     }
 
-    int left_count = i - node.prim_offset;
-    if (left_count == 0 || left_count == (int)node.prim_count) return;
+    // largest subtrees first for better load balance
+    std::sort(tasks.begin(), tasks.end(), [this](const build_entry& a, const build_entry& b) {
+        return nodes[a.node_index].prim_count > nodes[b.node_index].prim_count;
+    });
+    bvh_parallel_for((uint32) tasks.size(), num_threads, [&](uint32 i) {
+        build_subtree(tasks[i], mode, &next_node);
+    });
+
+    node_count = next_node;
+    if (num_threads > 1)
+        reorder_nodes();
+}
+
+// builds depth-first with an explicit work stack instead of recursion, children are always allocated in pairs
+template<typename T>
+inline void pod_bvh<T>::build_subtree(build_entry root, bvh_build_mode mode, std::atomic<uint32>* next_node)
+{
+    std::vector<build_entry> stack;
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        build_entry cur = stack.back();
+        stack.pop_back();
+        split_node(cur, mode, 1, next_node, &stack);
+    }
+}
+
+// pushes the children onto the stack if the node was split
+template<typename T>
+inline bool pod_bvh<T>::split_node(build_entry cur, bvh_build_mode mode, uint32 num_threads, std::atomic<uint32>* next_node, std::vector<build_entry>* stack)
+{
+    auto& node = nodes[cur.node_index];
+    if (node.prim_count <= 1 || cur.depth >= BVH_MAX_DEPTH - 1) return false;
+
+    int axis;
+    float split_pos;
+    if (mode == BVH_BUILD_SAH) {
+        float split_cost = find_sah_split(node, num_threads, &axis, &split_pos);
+        float leaf_cost = node.prim_count * node.box.half_area();
+        if (split_cost >= leaf_cost) return false; // splitting does not pay off, keep as leaf
+    }
+    else {
+        if (node.prim_count <= 2) return false;
+        find_midpoint_split(node, &axis, &split_pos);
+    }
+
+    uint32 left_count = partition(node, axis, split_pos);
+    if (left_count == 0 || left_count == node.prim_count) return false;
 
     // create child nodes
-    int left_child_index = node_count++;
-    int right_child_index = node_count++;
-    nodes[left_child_index].prim_offset = node.prim_offset;
+    uint32 left_child_index = next_node->fetch_add(2, std::memory_order_relaxed);
+    uint32 right_child_index = left_child_index + 1;
+    nodes[left_child_index].left_first = node.left_first;
     nodes[left_child_index].prim_count = left_count;
-    nodes[right_child_index].prim_offset = i;
+    nodes[right_child_index].left_first = node.left_first + left_count;
     nodes[right_child_index].prim_count = node.prim_count - left_count;
     update_node_box(left_child_index);
     update_node_box(right_child_index);
 
     // finalize parent node
-    node.left = left_child_index;
-    //node.right = right_child_index; // always left+1
+    node.left_first = left_child_index;
     node.prim_count = 0;
-    precompute_node_order(node_index);
 
-    // recurse
-    subdivide(left_child_index);
-    subdivide(right_child_index);
+    stack->push_back({ right_child_index, cur.depth + 1 });
+    stack->push_back({ left_child_index,  cur.depth + 1 });
+    return true;
 }
 
+// a serial build allocates the children of a node when it is split and then continues with the left child,
+// walking the tree in the same order gives every node the index it would have gotten there
 template<typename T>
-inline void pod_bvh<T>::update_node_box(uint32 node_index)
+inline void pod_bvh<T>::reorder_nodes()
 {
-    auto& node = nodes[node_index];
+    struct reorder_entry {
+        uint32 old_index;
+        uint32 new_index;
+    };
+    std::vector<reorder_entry> stack;
+
+    auto ordered = std::make_unique_for_overwrite<pod_bvh_node[]>(node_count);
+    ordered[0] = nodes[root_node];
+    uint32 count = 1;
+    stack.push_back({ root_node, 0 });
+
+    while (!stack.empty())
+    {
+        reorder_entry cur = stack.back();
+        stack.pop_back();
 
-    constexpr float maxf = std::numeric_limits<float>::max();
-    constexpr float minf = std::numeric_limits<float>::min();
-    node.box = aabb(Vec3(maxf, maxf, maxf), Vec3(minf, minf, minf));
+        pod_bvh_node& node = ordered[cur.new_index];
+        if (node.is_leaf()) continue;
 
-    for (size_t i = 0; i < node.prim_count; i++)
-    {
-        const T& leaf_prim = prims[node.prim_offset + i];
-        leaf_prim.add_to_box(&node.box);
+        uint32 old_left = node.left_first;
+        uint32 new_left = count;
+        count += 2;
+        ordered[new_left] = nodes[old_left];
+        ordered[new_left + 1] = nodes[old_left + 1];
+        node.left_first = new_left;
+
+        stack.push_back({ old_left + 1, new_left + 1 });
+        stack.push_back({ old_left, new_left });
     }
-}
 
+    nodes = std::move(ordered);
+    root_node = 0;
+}
 
 template<typename T>
-inline bool pod_bvh<T>::hit(uint32 node_index, const ray& r, float tmin, float tmax, hit_record* rec) const
+inline float pod_bvh<T>::find_midpoint_split(const pod_bvh_node& node, int* axis, float* split_pos) const
 {
-    const auto& node = nodes[node_index];
+    // split pos is largest extent
+    Vec3 extent2 = node.box.max - node.box.min;
+    int a = 0;
+    if (extent2.y > extent2.x) a = 1;
+    if (extent2.z > extent2[a]) a = 2;
+    *axis = a;
+    *split_pos = node.box.min[a] + extent2[a] * 0.5f;
+    return 0.0f;
+}
 
-    if (!node.box.hit(r, tmin, tmax)) return false;
+// adds the primitives [first, first + count) to the bins of all axes that have an extent
+template<typename T>
+inline void pod_bvh<T>::bin_prims(uint32 first, uint32 count, const aabb& centroid_box, sah_bins* bins) const
+{
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < BVH_SAH_BINS; b++) {
+            bins->box[a][b] = aabb::empty();
+            bins->count[a][b] = 0;
+        }
+    }
 
-    bool has_hit = false;
-    if (node.is_leaf())
+    for (int a = 0; a < 3; a++)
     {
-        for (uint32 i = 0; i < node.prim_count; i++) {
-            if (prims[node.prim_offset + i].hit(r, tmin, tmax, rec)) {
-                has_hit = true;
-                tmax = rec->t;
-            }
+        float bounds_min = centroid_box.min[a];
+        float bounds_max = centroid_box.max[a];
+        if (bounds_min == bounds_max) continue;
+
+        float scale = BVH_SAH_BINS / (bounds_max - bounds_min);
+        for (uint32 p = first; p < first + count; p++) {
+            int b = std::min(BVH_SAH_BINS - 1, int((centroids[p][a] - bounds_min) * scale));
+            bins->count[a][b]++;
+            prims[p].add_to_box(&bins->box[a][b]);
         }
     }
+}
+
+// evaluates BVH_SAH_BINS-1 candidate planes per axis over the centroid bounds, returns the cost of the best split
+// big nodes compute the bounds and bins in slices on num_threads threads, merging them gives exactly the same bins
+template<typename T>
+inline float pod_bvh<T>::find_sah_split(const pod_bvh_node& node, uint32 num_threads, int* axis, float* split_pos) const
+{
+    uint32 slices = (node.prim_count >= BVH_PARALLEL_BINNING_MIN_PRIMS) ? num_threads : 1;
+    auto slice_first = [&](uint32 i) { return node.left_first + uint32(uint64(node.prim_count) * i / slices); };
+
+    std::vector<aabb> slice_boxes(slices, aabb::empty());
+    auto centroid_slice = [&](uint32 i) {
+        for (uint32 p = slice_first(i); p < slice_first(i + 1); p++) {
+            slice_boxes[i].grow(centroids[p]);
+        }
+    };
+    if (slices > 1)
+        bvh_parallel_for(slices, num_threads, centroid_slice);
     else
+        centroid_slice(0);
+
+    aabb centroid_box = aabb::empty();
+    for (const aabb& b : slice_boxes) {
+        centroid_box.grow(b);
+    }
+
+    sah_bins bins;
+    if (slices > 1) {
+        std::vector<sah_bins> slice_bins(slices);
+        bvh_parallel_for(slices, num_threads, [&](uint32 i) {
+            bin_prims(slice_first(i), slice_first(i + 1) - slice_first(i), centroid_box, &slice_bins[i]);
+        });
+
+        bins = slice_bins[0];
+        for (uint32 i = 1; i < slices; i++) {
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < BVH_SAH_BINS; b++) {
+                    bins.box[a][b].grow(slice_bins[i].box[a][b]);
+                    bins.count[a][b] += slice_bins[i].count[a][b];
+                }
+            }
+        }
+    }
+    else {
+        bin_prims(node.left_first, node.prim_count, centroid_box, &bins);
+    }
+
+    float best_cost = std::numeric_limits<float>::max();
+    *axis = 0;
+    *split_pos = 0.0f;
+
+    for (int a = 0; a < 3; a++)
     {
-        // sort left/right nodes by which one is closer to the ray, skip farther node if we hit something inside the closer node
-        // from http://www.codercorner.com/blog/?p=734
-        uint32 closer = 0;
-        uint32 farther = 0;
-
-        if (node.node_order & r.dirMask) {
-            closer = node.left;
-            farther = node.left + 1;
+        float bounds_min = centroid_box.min[a];
+        float bounds_max = centroid_box.max[a];
+        if (bounds_min == bounds_max) continue; // all centroids on one plane, can't split along this axis
+
+        // sweep from both sides to get the area and count left/right of every plane
+        float left_area[BVH_SAH_BINS - 1], right_area[BVH_SAH_BINS - 1];
+        uint32 left_count[BVH_SAH_BINS - 1], right_count[BVH_SAH_BINS - 1];
+        aabb left_box = aabb::empty();
+        aabb right_box = aabb::empty();
+        uint32 left_sum = 0, right_sum = 0;
+
+        for (int i = 0; i < BVH_SAH_BINS - 1; i++) {
+            left_sum += bins.count[a][i];
+            left_count[i] = left_sum;
+            left_box.grow(bins.box[a][i]);
+            left_area[i] = left_sum ? left_box.half_area() : 0.0f;
+
+            right_sum += bins.count[a][BVH_SAH_BINS - 1 - i];
+            right_count[BVH_SAH_BINS - 2 - i] = right_sum;
+            right_box.grow(bins.box[a][BVH_SAH_BINS - 1 - i]);
+            right_area[BVH_SAH_BINS - 2 - i] = right_sum ? right_box.half_area() : 0.0f;
         }
-        else {
-            closer = node.left + 1;
-            farther = node.left;
+
+        float bin_width = (bounds_max - bounds_min) / BVH_SAH_BINS;
+        for (int i = 0; i < BVH_SAH_BINS - 1; i++) {
+            float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                *axis = a;
+                *split_pos = bounds_min + bin_width * (i + 1);
+            }
         }
+    }
+    return best_cost;
+}
 
-        bool hit_closer = hit(closer, r, tmin, tmax, rec);
-        if (hit_closer)
-            return true;
+// partitions the node's primitives by centroid, returns the number of primitives left of the split
+template<typename T>
+inline uint32 pod_bvh<T>::partition(const pod_bvh_node& node, int axis, float split_pos)
+{
+    int i = node.left_first;
+    int j = i + node.prim_count - 1;
+    while (i <= j)
+    {
+        if (centroids[i][axis] < split_pos)
+            i++;
+        else {
+            std::swap(prims[i], prims[j]);
+            std::swap(centroids[i], centroids[j]);
+            j--;
+        }
+    }
+    return i - node.left_first;
+}
 
-        bool hit_farther = hit(farther, r, tmin, tmax, rec);
+template<typename T>
+inline void pod_bvh<T>::update_node_box(uint32 node_index)
+{
+    auto& node = nodes[node_index];
+    node.box = aabb::empty();
 
-        return hit_closer || hit_farther;
+    for (size_t i = 0; i < node.prim_count; i++)
+    {
+        const T& leaf_prim = prims[node.left_first + i];
+        leaf_prim.add_to_box(&node.box);
     }
-    return has_hit;
 }
 
-// TODO: is this okay?
-static thread_local std::vector<const pod_bvh_node*> traversal_stack;
+// The tree is built over the boxes of the whole shutter interval, moving primitives then get the node boxes at both ends of it.
+// Children always come after their parent, so one backwards pass over the nodes refits them bottom up.
+template<typename T>
+inline void pod_bvh<T>::build_motion_boxes(float time0, float time1)
+{
+    if constexpr (bvh_motion_prim<T>) {
+        if (!(time1 > time0))
+            return;
+
+        auto boxes = std::make_unique_for_overwrite<aabb[]>(node_count * 2);
+        bool moving = false;
+
+        for (uint32 i = node_count; i-- > 0;) {
+            const pod_bvh_node& node = nodes[i];
+            aabb box0 = aabb::empty();
+            aabb box1 = aabb::empty();
+
+            if (node.is_leaf()) {
+                for (uint32 j = 0; j < node.prim_count; j++) {
+                    prims[node.left_first + j].add_to_box(&box0, time0);
+                    prims[node.left_first + j].add_to_box(&box1, time1);
+                }
+                moving |= !same_box(box0, box1);
+            }
+            else {
+                box0 = surrounding_box(boxes[2 * node.left_first],     boxes[2 * node.left_first + 2]);
+                box1 = surrounding_box(boxes[2 * node.left_first + 1], boxes[2 * node.left_first + 3]);
+            }
+            boxes[2 * i] = box0;
+            boxes[2 * i + 1] = box1;
+        }
+
+        if (moving) {
+            motion_boxes = std::move(boxes);
+            this->time0 = time0;
+            this->inv_duration = 1.0f / (time1 - time0);
+        }
+    }
+}
 
 template<typename T>
 inline bool pod_bvh<T>::hit(const ray& r, float tmin, float tmax, hit_record* rec) const
 {
-    return hit(root_node, r, tmin, tmax, rec);
-
-    // TODO: the following is slightly slower than recursion, investigate
-
-    //traversal_stack.clear();
-    //traversal_stack.push_back(&nodes[root_node]);
-
-    //bool has_hit = false;
-
-    //do
-    //{
-    //    const pod_bvh_node* curnode = traversal_stack.back();
-    //    traversal_stack.pop_back();
-
-    //    if (!curnode->box.hit(r, tmin, tmax))
-    //        continue;
-
-    //    if (curnode->is_leaf())
-    //    {
-    //        for (size_t i = 0; i < curnode->prim_count; i++)
-    //        {
-    //            if (prims[curnode->prim_offset + i].hit(r, tmin, tmax, rec)) {
-    //                has_hit = true;
-    //                tmax = rec->t;
-    //            }
-    //        }
-    //        if (has_hit)
-    //            return true;
-    //    }
-    //    else {
-    //        // sort left/right nodes by which one is closer to the ray, skip farther node if we hit something inside the closer node
-    //        // from http://www.codercorner.com/blog/?p=734
-    //        const pod_bvh_node* closer = nullptr;
-    //        const pod_bvh_node* farther = nullptr;
-
-    //        if (curnode->node_order & r.dirMask) {
-    //            closer = &nodes[curnode->left];
-    //            farther = &nodes[curnode->left + 1];
-    //        }
-    //        else {
-    //            closer = &nodes[curnode->left + 1];
-    //            farther = &nodes[curnode->left];
-    //        }
-
-    //        traversal_stack.push_back(farther);
-    //        traversal_stack.push_back(closer);
-    //    }
-
-    //} while (!traversal_stack.empty());
-
-    //return has_hit;
+    if (motion_boxes)
+        return traverse<true>(r, tmin, tmax, rec);
+    else
+        return traverse<false>(r, tmin, tmax, rec);
 }
 
 template<typename T>
-inline bool pod_bvh<T>::bounding_box(aabb* box, float time0, float time1) const
+template<bool MOTION>
+inline bool pod_bvh<T>::traverse(const ray& r, float tmin, float tmax, hit_record* rec) const
 {
-    *box = nodes[0].box;
-    return true;
+    constexpr float miss = std::numeric_limits<float>::max();
+    const Vec3 invDir = 1.0f / r.dir;
+    const float f = MOTION ? (r.time - time0) * inv_duration : 0.0f;
+
+    auto node_dist = [&](const pod_bvh_node* node) {
+        if constexpr (MOTION) {
+            const aabb* box = &motion_boxes[2 * (node - nodes.get())];
+            return lerp_box(box[0], box[1], f).hit_dist(r.origin, invDir, tmin, tmax);
+        }
+        else {
+            return node->box.hit_dist(r.origin, invDir, tmin, tmax);
+        }
+    };
+
+    const pod_bvh_node* node = &nodes[root_node];
+    if (node_dist(node) == miss)
+        return false;
+
+    // every stack entry remembers where the ray entered the node, so we can skip it once we found a closer hit
+    struct stack_entry {
+        const pod_bvh_node* node;
+        float dist;
+    } stack[BVH_MAX_DEPTH];
+    uint32 stack_ptr = 0;
+
+    bool has_hit = false;
+
+    for (;;)
+    {
+        STAT_ADD(nodes, 1);
+        if (node->is_leaf())
+        {
+            for (uint32 i = 0; i < node->prim_count; i++) {
+                if (prims[node->left_first + i].hit(r, tmin, tmax, rec)) {
+                    has_hit = true;
+                    tmax = rec->t;
+                }
+            }
+        }
+        else
+        {
+            // visit the closer child first, push the farther one
+            const pod_bvh_node* child0 = &nodes[node->left_first];
+            const pod_bvh_node* child1 = &nodes[node->left_first + 1];
+            float dist0 = node_dist(child0);
+            float dist1 = node_dist(child1);
+
+            if (dist1 < dist0) {
+                std::swap(dist0, dist1);
+                std::swap(child0, child1);
+            }
+
+            if (dist0 != miss) {
+                if (dist1 != miss) {
+                    stack[stack_ptr++] = { child1, dist1 };
+                }
+                node = child0;
+                continue;
+            }
+        }
+
+        // pop the next node that is still closer than the closest hit so far
+        for (;;) {
+            if (stack_ptr == 0)
+                return has_hit;
+            stack_ptr--;
+            if (stack[stack_ptr].dist <= tmax) {
+                node = stack[stack_ptr].node;
+                break;
+            }
+        }
+    }
 }
 
-// http://www.codercorner.com/blog/?p=734
 template<typename T>
-inline void pod_bvh<T>::precompute_node_order(uint32 node_index)
+inline bool pod_bvh<T>::bounding_box(aabb* box, float time0, float time1) const
 {
-    auto& node = nodes[node_index];
-
-    const aabb& lbox = nodes[node.left].box;
-    const aabb& rbox = nodes[node.left+1].box;
-
-    const Vec3& C0 = lbox.center();
-    const Vec3& C1 = rbox.center();
-
-    const Vec3 DirPPP = Vec3(1.0f, 1.0f, 1.0f).normalize();
-    const Vec3 DirPPN = Vec3(1.0f, 1.0f, -1.0f).normalize();
-    const Vec3 DirPNP = Vec3(1.0f, -1.0f, 1.0f).normalize();
-    const Vec3 DirPNN = Vec3(1.0f, -1.0f, -1.0f).normalize();
-    const Vec3 DirNPP = Vec3(-1.0f, 1.0f, 1.0f).normalize();
-    const Vec3 DirNPN = Vec3(-1.0f, 1.0f, -1.0f).normalize();
-    const Vec3 DirNNP = Vec3(-1.0f, -1.0f, 1.0f).normalize();
-    const Vec3 DirNNN = Vec3(-1.0f, -1.0f, -1.0f).normalize();
-
-    bool bPPP = dot(Vec3(C0 - C1), DirPPP) < 0.0f;
-    bool bPPN = dot(Vec3(C0 - C1), DirPPN) < 0.0f;
-    bool bPNP = dot(Vec3(C0 - C1), DirPNP) < 0.0f;
-    bool bPNN = dot(Vec3(C0 - C1), DirPNN) < 0.0f;
-    bool bNPP = dot(Vec3(C0 - C1), DirNPP) < 0.0f;
-    bool bNPN = dot(Vec3(C0 - C1), DirNPN) < 0.0f;
-    bool bNNP = dot(Vec3(C0 - C1), DirNNP) < 0.0f;
-    bool bNNN = dot(Vec3(C0 - C1), DirNNN) < 0.0f;
-
-    uint8 Code = 0;
-    Code |= (!bPPP << 7); // Bit 0: PPP
-    Code |= (!bPPN << 6); // Bit 1: PPN
-    Code |= (!bPNP << 5); // Bit 2: PNP
-    Code |= (!bPNN << 4); // Bit 3: PNN
-    Code |= (!bNPP << 3); // Bit 4: NPP
-    Code |= (!bNPN << 2); // Bit 5: NPN
-    Code |= (!bNNP << 1); // Bit 6: NNP
-    Code |= (!bNNN << 0); // Bit 7: NNN
-
-    node.node_order = Code;
+    if (motion_boxes) {
+        float f0 = (time0 - this->time0) * inv_duration;
+        float f1 = (time1 - this->time0) * inv_duration;
+        *box = surrounding_box(lerp_box(motion_boxes[0], motion_boxes[1], f0), lerp_box(motion_boxes[0], motion_boxes[1], f1));
+    }
+    else {
+        *box = nodes[0].box;
+    }
+    return true;
 }
 
 
@@ -338,4 +631,5 @@ public:
 
     bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const;
     bool bounding_box(aabb* box, float time0, float time1) const;
+    void add_lights(light_list *lights) override;
 };
@@ -0,0 +1,93 @@
+#include <limits>
+
+#include "wavefront.h"
+#include "material.h"
+#include "camera.h"
+#include "cmdline_parser.h"
+#include "stats.h"
+
+void wavefront_tracer::trace_tile(const tile& t, const scene& scene, uint32 sample, Vec3 *colors) {
+
+    stage_timer clock;
+    generate(t, scene, sample);
+    clock.lap(STAGE_CAMERA);
+
+    // every bounce adds one to the depth of all paths that continue, so all paths in the queue have the same depth
+    for (uint32 bounce = 0; !paths.empty(); bounce++) {
+        count_rays(bounce, paths.size());
+        intersect(scene);
+        clock.lap(STAGE_INTERSECT);
+        shade(scene, colors);
+        clock.lap(STAGE_SHADE);
+        std::swap(paths, next_paths);
+    }
+}
+
+// camera rays for every pixel of the tile
+void wavefront_tracer::generate(const tile& t, const scene& scene, uint32 sample) {
+    MRT_Params *p = getParams();
+
+    paths.clear();
+    uint32 pixel = 0;
+    for (uint32 y = t.yMin; y < t.yMax; y++) {
+        for (uint32 x = t.xMin; x < t.xMax; x++) {
+            start_sample(x + y * p->bufferWidth, sample);
+            vec2 offset = sample_2d();
+            float u = (x + offset.x) / (float) p->bufferWidth;
+            float v = (y + offset.y) / (float) p->bufferHeight;
+
+            path_state path(scene.camera->get_ray(u, v), pixel++);
+            path.sampler = get_sampler_state();
+            paths.push_back(path);
+        }
+    }
+}
+
+void wavefront_tracer::intersect(const scene& scene) {
+    hits.resize(paths.size());
+    has_hit.resize(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        has_hit[i] = scene.objects->hit(paths[i].r, 0.001f, std::numeric_limits<float>::max(), &hits[i]);
+    }
+}
+
+// one path_bounce() per path in the order of the material types, the shadow rays are traced right away
+void wavefront_tracer::shade(const scene& scene, Vec3 *colors) {
+
+    // counting sort by material type so the same scatter code runs back to back, paths that left the scene are finished right away
+    uint32 offsets[MATERIAL_TYPE_COUNT + 1] = {};
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (has_hit[i]) {
+            offsets[hits[i].mat_ptr->type + 1]++;
+        }
+        else {
+            path_state& path = paths[i];
+            path_bounce(&path, false, hits[i], scene);
+            colors[path.pixel] = path.radiance;
+        }
+    }
+    for (uint32 m = 0; m < MATERIAL_TYPE_COUNT; m++) {
+        offsets[m + 1] += offsets[m];
+    }
+    shade_order.resize(offsets[MATERIAL_TYPE_COUNT]);
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (has_hit[i]) {
+            shade_order[offsets[hits[i].mat_ptr->type]++] = (uint32) i;
+        }
+    }
+
+    next_paths.clear();
+    for (uint32 i : shade_order) {
+        path_state& path = paths[i];
+
+        set_sampler_state(path.sampler);
+        if (path_bounce(&path, true, hits[i], scene)) {
+            path.sampler = get_sampler_state();
+            next_paths.push_back(path);
+        }
+        else {
+            colors[path.pixel] = path.radiance;
+        }
+    }
+}
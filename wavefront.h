@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "scene.h"
+#include "scene_object.h"
+#include "work_queue.h"
+#include "sampler.h"
+#include "path.h"
+#include <vector>
+
+// Alternative to trace(), which follows one path to its end, that advances all paths of a tile one bounce at a time,
+// each stage (generate, intersect, shade) runs over the whole queue before the next one starts
+// and the shade stage processes the paths grouped by material type.
+// see "Megakernels Considered Harmful: Wavefront Path Tracing on GPUs" (Laine et al. 2013)
+//
+// one instance per worker thread, the queues are reused between tiles
+class wavefront_tracer {
+    std::vector<path_state> paths;      // paths alive in the current bounce
+    std::vector<path_state> next_paths; // paths continuing into the next bounce
+    std::vector<hit_record> hits;
+    std::vector<uint8> has_hit;
+    std::vector<uint32> shade_order;    // indices into paths, sorted by material type
+public:
+    // traces sample number sample of every pixel of the tile and writes the colors in tile row order
+    void trace_tile(const tile& t, const scene& scene, uint32 sample, Vec3 *colors);
+private:
+    void generate(const tile& t, const scene& scene, uint32 sample);
+    void intersect(const scene& scene);
+    void shade(const scene& scene, Vec3 *colors);
+};
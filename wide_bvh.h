@@ -0,0 +1,341 @@
+#pragma once
+
+#include "triangle.h"
+#include <vector>
+
+// 4-wide (QBVH) and 8-wide (OBVH) BVH, built by collapsing the binary SAH pod_bvh.
+// Child bounds are stored in SoA layout so one node tests all its children against the ray at once,
+// with SSE for 4 children and AVX for 8 (two SSE halves if AVX is not available).
+// see "Shallow Bounding Volume Hierarchies for Fast SIMD Ray Tracing of Incoherent Rays" (Dammertz et al. 2008)
+
+#ifdef __AVX__
+#define BVH_WIDTH 8
+#else
+#define BVH_WIDTH 4
+#endif
+
+template<int N>
+struct alignas(32) wide_bvh_node {
+    float min_x[N], max_x[N];
+    float min_y[N], max_y[N];
+    float min_z[N], max_z[N];
+    uint32 child[N];    // interior child: node index, leaf child: first primitive
+    uint32 count[N];    // 0 for interior children, primitive count for leaf children
+    uint32 child_count; // used slots, always packed at the front
+};
+
+template<typename T, int N>
+class wide_bvh final : public scene_object {
+    static_assert(N == 4 || N == 8, "wide_bvh supports 4 and 8 wide nodes");
+
+    std::unique_ptr<T[]> prims;
+    std::vector<wide_bvh_node<N>> nodes;
+    aabb bounds;
+public:
+    wide_bvh(T list[], size_t n, float time0, float time1);
+    // restores a tree that was built before (see get_nodes() and get_prims())
+    wide_bvh(std::vector<wide_bvh_node<N>> nodes, std::unique_ptr<T[]> prims, const aabb& bounds)
+        : prims(std::move(prims)), nodes(std::move(nodes)), bounds(bounds) {}
+    bool hit(const ray& r, float tmin, float tmax, hit_record* rec) const override;
+    uint32 hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const override;
+    bool bounding_box(aabb* box, float time0, float time1) const override;
+    uint32 get_node_count() const { return (uint32)nodes.size(); }
+    const std::vector<wide_bvh_node<N>>& get_nodes() const { return nodes; }
+    const T* get_prims() const { return prims.get(); } // in leaf order
+private:
+    void collapse(const pod_bvh<T>& bvh);
+    uint32 intersect_children(const wide_bvh_node<N>& node, const Vec3& origin, const Vec3& invDir, float tmin, float tmax, float dist[N]) const;
+};
+
+
+template<typename T, int N>
+inline wide_bvh<T, N>::wide_bvh(T list[], size_t n, float time0, float time1)
+{
+    pod_bvh<T> bvh(list, n, time0, time1, BVH_BUILD_SAH);
+    collapse(bvh);
+    bvh.bounding_box(&bounds, time0, time1);
+    prims = std::move(bvh.prims); // leaves keep the primitive order of the binary tree
+}
+
+// every wide node pulls up grandchildren of its binary node until it has N children,
+// always opening the interior child with the largest surface area first
+template<typename T, int N>
+inline void wide_bvh<T, N>::collapse(const pod_bvh<T>& bvh)
+{
+    struct collapse_entry {
+        uint32 binary_node;
+        uint32 wide_node;
+    };
+    std::vector<collapse_entry> stack;
+
+    nodes.reserve(bvh.node_count / 2 + 1);
+    nodes.emplace_back();
+    stack.push_back({ bvh.root_node, 0 });
+
+    while (!stack.empty())
+    {
+        collapse_entry cur = stack.back();
+        stack.pop_back();
+
+        uint32 children[N];
+        uint32 child_count = 0;
+
+        const pod_bvh_node& binary = bvh.nodes[cur.binary_node];
+        if (binary.is_leaf()) {
+            children[child_count++] = cur.binary_node; // only happens for a root that is a leaf
+        }
+        else {
+            children[child_count++] = binary.left_first;
+            children[child_count++] = binary.left_first + 1;
+        }
+
+        while (child_count < N)
+        {
+            int largest = -1;
+            float largest_area = -1.0f;
+            for (uint32 i = 0; i < child_count; i++) {
+                const pod_bvh_node& c = bvh.nodes[children[i]];
+                if (!c.is_leaf() && c.box.half_area() > largest_area) {
+                    largest = i;
+                    largest_area = c.box.half_area();
+                }
+            }
+            if (largest < 0) break; // only leaves left
+
+            uint32 left = bvh.nodes[children[largest]].left_first;
+            children[largest] = left;
+            children[child_count++] = left + 1;
+        }
+
+        wide_bvh_node<N> node = {};
+        node.child_count = child_count;
+        for (uint32 i = 0; i < child_count; i++)
+        {
+            const pod_bvh_node& c = bvh.nodes[children[i]];
+            node.min_x[i] = c.box.min.x;
+            node.min_y[i] = c.box.min.y;
+            node.min_z[i] = c.box.min.z;
+            node.max_x[i] = c.box.max.x;
+            node.max_y[i] = c.box.max.y;
+            node.max_z[i] = c.box.max.z;
+
+            if (c.is_leaf()) {
+                node.child[i] = c.left_first;
+                node.count[i] = c.prim_count;
+            }
+            else {
+                node.child[i] = (uint32)nodes.size();
+                node.count[i] = 0;
+                nodes.emplace_back();
+                stack.push_back({ children[i], node.child[i] });
+            }
+        }
+        nodes[cur.wide_node] = node; // nodes may have been reallocated above, so no reference is kept
+    }
+}
+
+// returns a bit mask of the children hit by the ray and writes their entry distances
+template<typename T, int N>
+inline uint32 wide_bvh<T, N>::intersect_children(const wide_bvh_node<N>& node, const Vec3& origin, const Vec3& invDir, float tmin, float tmax, float dist[N]) const
+{
+    uint32 mask = 0;
+
+#ifdef __AVX__
+    if constexpr (N == 8) {
+        __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+        __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+
+        __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_x), ox), ix);
+        __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_x), ox), ix);
+        __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_y), oy), iy);
+        __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_y), oy), iy);
+        __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_z), oz), iz);
+        __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_z), oz), iz);
+
+        __m256 tnear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                     _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(tmin)));
+        __m256 tfar  = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                     _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tmax)));
+
+        // <= so that flat boxes can still be hit, same as aabb::hit_dist()
+        mask = _mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ));
+        _mm256_storeu_ps(dist, tnear);
+    }
+    else
+#endif
+    {
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+
+        for (int i = 0; i < N; i += 4)
+        {
+            __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.min_x[i]), ox), ix);
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.max_x[i]), ox), ix);
+            __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.min_y[i]), oy), iy);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.max_y[i]), oy), iy);
+            __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.min_z[i]), oz), iz);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.max_z[i]), oz), iz);
+
+            __m128 tnear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                      _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tmin)));
+            __m128 tfar  = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                      _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tmax)));
+
+            mask |= _mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) << i;
+            _mm_storeu_ps(&dist[i], tnear);
+        }
+    }
+
+    return mask & ((1u << node.child_count) - 1); // unused slots are never hit
+}
+
+template<typename T, int N>
+inline bool wide_bvh<T, N>::hit(const ray& r, float tmin, float tmax, hit_record* rec) const
+{
+    const Vec3 invDir = 1.0f / r.dir;
+
+    // every stack entry remembers where the ray entered the node, so we can skip it once we found a closer hit
+    struct stack_entry {
+        uint32 node;
+        float dist;
+    } stack[BVH_MAX_DEPTH * (N - 1)];
+    uint32 stack_ptr = 0;
+
+    bool has_hit = false;
+    uint32 node_index = 0;
+
+    for (;;)
+    {
+        const wide_bvh_node<N>& node = nodes[node_index];
+        STAT_ADD(nodes, 1);
+
+        float dist[N];
+        uint32 mask = intersect_children(node, r.origin, invDir, tmin, tmax, dist);
+
+        // sort the children that were hit front to back
+        uint32 order[N];
+        uint32 hits = 0;
+        while (mask) {
+            uint32 c = MRT::tzcnt(mask);
+            mask &= mask - 1;
+
+            uint32 j = hits++;
+            for (; j > 0 && dist[order[j - 1]] > dist[c]; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = c;
+        }
+
+        // intersect leaves right away and collect the interior children, still sorted
+        uint32 next[N];
+        uint32 next_count = 0;
+        for (uint32 i = 0; i < hits; i++) {
+            uint32 c = order[i];
+            if (dist[c] > tmax) break; // everything after this is farther away than the closest hit
+
+            if (node.count[c]) {
+                for (uint32 p = 0; p < node.count[c]; p++) {
+                    if (prims[node.child[c] + p].hit(r, tmin, tmax, rec)) {
+                        has_hit = true;
+                        tmax = rec->t;
+                    }
+                }
+            }
+            else {
+                next[next_count++] = c;
+            }
+        }
+
+        if (next_count) {
+            // continue with the closest child, push the others farthest first
+            for (uint32 i = next_count - 1; i > 0; i--) {
+                stack[stack_ptr++] = { node.child[next[i]], dist[next[i]] };
+            }
+            node_index = node.child[next[0]];
+            continue;
+        }
+
+        // pop the next node that is still closer than the closest hit so far
+        for (;;) {
+            if (stack_ptr == 0)
+                return has_hit;
+            stack_ptr--;
+            if (stack[stack_ptr].dist <= tmax) {
+                node_index = stack[stack_ptr].node;
+                break;
+            }
+        }
+    }
+}
+
+// the whole packet walks down the tree together, every child is visited by the rays of the packet that hit its box
+template<typename T, int N>
+inline uint32 wide_bvh<T, N>::hit_packet(const ray_packet& rp, uint32 mask, float tmin, float tmax[], hit_record rec[]) const
+{
+    struct stack_entry {
+        uint32 node;
+        uint32 mask; // active rays
+    } stack[BVH_MAX_DEPTH * (N - 1)];
+    uint32 stack_ptr = 0;
+
+    uint32 hits = 0;
+    uint32 node_index = 0;
+
+    for (;;)
+    {
+        const wide_bvh_node<N>& node = nodes[node_index];
+
+        // test every child against the packet, sorted front to back by the closest ray
+        float dist[N];
+        uint32 child_mask[N];
+        uint32 order[N];
+        uint32 count = 0;
+        for (uint32 c = 0; c < node.child_count; c++) {
+            aabb box(Vec3(node.min_x[c], node.min_y[c], node.min_z[c]), Vec3(node.max_x[c], node.max_y[c], node.max_z[c]));
+            child_mask[c] = box.hit_packet(rp, mask, tmin, tmax, &dist[c]);
+            if (!child_mask[c]) continue;
+
+            uint32 j = count++;
+            for (; j > 0 && dist[order[j - 1]] > dist[c]; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = c;
+        }
+
+        uint32 next[N];
+        uint32 next_count = 0;
+        for (uint32 i = 0; i < count; i++) {
+            uint32 c = order[i];
+            if (node.count[c]) {
+                for (uint32 p = 0; p < node.count[c]; p++) {
+                    hits |= prims[node.child[c] + p].hit_packet(rp, child_mask[c], tmin, tmax, rec);
+                }
+            }
+            else {
+                next[next_count++] = c;
+            }
+        }
+
+        if (next_count) {
+            for (uint32 i = next_count - 1; i > 0; i--) {
+                stack[stack_ptr++] = { node.child[next[i]], child_mask[next[i]] };
+            }
+            node_index = node.child[next[0]];
+            mask = child_mask[next[0]];
+            continue;
+        }
+
+        if (stack_ptr == 0)
+            return hits;
+        stack_ptr--;
+        node_index = stack[stack_ptr].node;
+        mask = stack[stack_ptr].mask;
+    }
+}
+
+template<typename T, int N>
+inline bool wide_bvh<T, N>::bounding_box(aabb* box, float time0, float time1) const
+{
+    *box = bounds;
+    return true;
+}
@@ -1,3 +1,5 @@
+#include <thread>
+
 #include "work_queue.h"
 
 
@@ -61,7 +63,7 @@ static void deInterleave(uint32 d, uint32 *x, uint32 *y) {
 
 ///
 
-work_queue::work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads) : numThreads(numThreads), counter(0) {
+work_queue::work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads, bool coherentOrder) : numThreads(numThreads), counter(0) {
     uint32 xCount = (bufferWidth + (tileSize - 1u)) / tileSize;
     uint32 yCount = (bufferHeight + (tileSize - 1u)) / tileSize;
     numTiles = (xCount * yCount);
@@ -96,9 +98,8 @@ work_queue::work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize,
 
     uint32 po2size = MRT::nextPo2(std::max(xCount, yCount));
 
-#if INVERT
+    bool invert = INVERT && !coherentOrder;
     uint32 log2size = MRT::log2U32(po2size);
-#endif
     
     uint32 index = 0;
     for (uint32 d = 0; d < po2size*po2size; d++) {
@@ -110,11 +111,11 @@ work_queue::work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize,
         deInterleave(d, &x, &y);
 #endif
 
-#if INVERT
-        // from http://www.tomgibara.com/computer-vision/minimizing-spatial-cohesion
-        x = reverseU32(x) >> (32u - log2size);
-        y = reverseU32(y) >> (32u - log2size);
-#endif
+        if (invert) {
+            // from http://www.tomgibara.com/computer-vision/minimizing-spatial-cohesion
+            x = reverseU32(x) >> (32u - log2size);
+            y = reverseU32(y) >> (32u - log2size);
+        }
 
         if ((x < xCount) && (y < yCount)) {
             worklistFinal[index++] = worklist[x + y * xCount];
@@ -125,12 +126,14 @@ work_queue::work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize,
     free(worklist);
     worklist = worklistFinal;
 #endif
+
+    dirtyTiles = new std::atomic<uint64>[(numTiles + 63) / 64]();
 }
 
 
 //////////////////////////////////////////////////////////////////////////////////
 
-tile* work_queue_seq::getWork(uint32* curSample_out) {
+tile* work_queue_seq::getWork(uint32 threadId, uint32* curSample_out) {
     uint64 cur = counter.fetch_add(1, std::memory_order_relaxed);
 
     if (cur >= numTiles)
@@ -150,12 +153,12 @@ float work_queue_seq::getPercentDone() {
 
 //////////////////////////////////////////////////////////////////////////////////
 
-// TODO: Possible race condition since one thread can round trip faster than the other and work on the same tile.
+// TODO: Possible race condition since one thread can round trip faster than the other and work on the same tile (use work_queue_stealing).
 //       Unlikely and small effect with small tiles, but worth considering. Keep track of which index each thread is on and skip that one for later somehow?
 //       Could increment a "repeat tile" counter for each thread if another thread encounters the same tile, but that will *probably* not eliminate 
 //       all possible race conditions, just make them extremely unlikely.
 
-tile* work_queue_dynamic::getWork(uint32* curSample_out) {
+tile* work_queue_dynamic::getWork(uint32 threadId, uint32* curSample_out) {
     uint64 cur = counter.fetch_add(1, std::memory_order_relaxed); // get current counter, advance
     if (cur >= (numTiles * numSamples)) // no more work to be done
         return nullptr;
@@ -172,4 +175,116 @@ float work_queue_dynamic::getPercentDone() {
         return 100.0f; // ensure this is exact
     else
         return (c * 100) / float(numTiles * numSamples);
-}
\ No newline at end of file
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+work_queue_stealing::work_queue_stealing(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads, uint32 numSamples)
+                                        : work_queue(bufferWidth, bufferHeight, tileSize, numThreads, true),
+                                          exhaustedTiles(0), numSamples(numSamples) {
+
+    deques = new work_deque[numThreads];
+    tileSamples = (uint32*) calloc(numTiles, sizeof(*tileSamples));
+
+    // contiguous parts of the curve, so each thread starts on its own region of the image
+    for (uint32 i = 0; i < numThreads; i++) {
+        uint64 first = (numTiles * i) / numThreads;
+        uint64 last = (numTiles * (i + 1)) / numThreads;
+        for (uint64 t = first; t < last; t++) {
+            deques[i].tiles.push_back(uint32(t));
+        }
+    }
+}
+
+work_queue_stealing::~work_queue_stealing() {
+    delete[] deques;
+    free(tileSamples);
+}
+
+// moves half of the first non-empty deque after our own into our deque and returns one of the stolen tiles
+uint32 work_queue_stealing::steal(uint32 threadId) {
+    work_deque& own = deques[threadId];
+
+    for (uint32 i = 1; i < numThreads; i++) {
+        work_deque& victim = deques[(threadId + i) % numThreads];
+
+        std::scoped_lock guard(own.lock, victim.lock);
+        size_t n = (victim.tiles.size() + 1) / 2;
+        if (n == 0)
+            continue;
+
+        // take from the back, the owner pops from the front
+        uint32 result = victim.tiles.back();
+        victim.tiles.pop_back();
+        for (size_t k = 1; k < n; k++) {
+            own.tiles.push_front(victim.tiles.back());
+            victim.tiles.pop_back();
+        }
+        return result;
+    }
+    return NO_TILE;
+}
+
+tile* work_queue_stealing::getWork(uint32 threadId, uint32* curSample_out) {
+    work_deque& own = deques[threadId];
+    uint32 cur = NO_TILE;
+
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+
+        // calling getWork again means we are done with the previous tile, requeue it if it still has samples left
+        if (own.held != NO_TILE) {
+            own.completed.fetch_add(1, std::memory_order_relaxed);
+            if (tileSamples[own.held] < numSamples)
+                own.tiles.push_back(own.held);
+            own.held = NO_TILE;
+        }
+
+        if (!own.tiles.empty()) {
+            cur = own.tiles.front();
+            own.tiles.pop_front();
+        }
+    }
+
+    while (cur == NO_TILE) {
+        // the last tiles may still be held by other threads, wait until they are requeued so we can steal them
+        if (exhaustedTiles.load(std::memory_order_acquire) == numTiles)
+            return nullptr;
+
+        cur = steal(threadId);
+        if (cur == NO_TILE)
+            std::this_thread::yield();
+    }
+
+    own.held = cur;
+    uint32 sample = tileSamples[cur]++;
+    if (sample + 1 == numSamples)
+        exhaustedTiles.fetch_add(1, std::memory_order_release);
+
+    *curSample_out = sample;
+    return &worklist[cur];
+}
+
+void work_queue_stealing::retireTile(uint32 threadId) {
+    work_deque& own = deques[threadId];
+    uint32 cur = own.held;
+    if (cur == NO_TILE || tileSamples[cur] >= numSamples)
+        return;
+
+    // count the skipped samples as done so the progress still ends at 100%, the current one is counted by the next getWork
+    own.completed.fetch_add(numSamples - tileSamples[cur], std::memory_order_relaxed);
+    tileSamples[cur] = numSamples;
+    exhaustedTiles.fetch_add(1, std::memory_order_release);
+}
+
+float work_queue_stealing::getPercentDone() {
+    // unlike the other queues, work is counted when it is finished
+    uint64 c = 0;
+    for (uint32 i = 0; i < numThreads; i++) {
+        c += deques[i].completed.load(std::memory_order_relaxed);
+    }
+    if (c >= numTiles * numSamples)
+        return 100.0f; // ensure this is exact
+    else
+        return (c * 100) / float(numTiles * numSamples);
+}
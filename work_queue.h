@@ -4,6 +4,8 @@
 #include "mrt_math.h"
 #include <atomic>
 #include <algorithm>
+#include <deque>
+#include <mutex>
 
 struct tile {
     uint32 xMin;
@@ -18,13 +20,36 @@ public:
     uint64 numTiles;
     uint32 numThreads;
     std::atomic<uint64> counter;
+    std::atomic<uint64> *dirtyTiles; // one bit per worklist entry, see markDirty()
 
-    work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads);
+    // coherentOrder keeps neighbouring tiles next to each other in the worklist instead of spreading them out
+    work_queue(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads, bool coherentOrder = false);
 
-    virtual tile* getWork(uint32* curSample_out) = 0;
+    // threadId is in [0, numThreads), each thread must only use its own id
+    virtual tile* getWork(uint32 threadId, uint32* curSample_out) = 0;
     virtual float getPercentDone() = 0;
+    // skips the remaining samples of the tile last returned to this thread (adaptive sampling), only supported by work_queue_stealing
+    virtual void retireTile(uint32 threadId) {}
     virtual ~work_queue() {
         free(worklist);
+        delete[] dirtyTiles;
+    }
+
+    // workers mark a tile after writing to it, the display only converts the tiles that changed since it last looked
+    void markDirty(const tile *t) {
+        size_t i = t - worklist;
+        dirtyTiles[i / 64].fetch_or(1ull << (i % 64), std::memory_order_release);
+    }
+    // calls f with the worklist index of every tile that was marked since the last call
+    template<typename F>
+    void takeDirty(F f) {
+        for (size_t w = 0; w < (numTiles + 63) / 64; w++) {
+            uint64 bits = dirtyTiles[w].load(std::memory_order_relaxed) ? dirtyTiles[w].exchange(0, std::memory_order_acquire) : 0;
+            while (bits) {
+                f(uint32(w * 64 + MRT::tzcnt(bits)));
+                bits &= bits - 1;
+            }
+        }
     }
 };
 
@@ -33,7 +58,7 @@ public:
     work_queue_seq(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads)
                   : work_queue(bufferWidth, bufferHeight, tileSize, numThreads) {}
 
-    tile* getWork(uint32* curSample_out);
+    tile* getWork(uint32 threadId, uint32* curSample_out);
     float getPercentDone();
 };
 
@@ -45,6 +70,35 @@ public:
                       : work_queue(bufferWidth, bufferHeight, tileSize, numThreads),
                         numSamples(numSamples) {}
 
-    tile* getWork(uint32* curSample_out);
+    tile* getWork(uint32 threadId, uint32* curSample_out);
+    float getPercentDone();
+};
+
+// Every thread starts with its own contiguous part of the Hilbert curve and cycles through its tiles one sample at a time,
+// threads that run out of tiles steal half of another thread's deque. A tile is never in a deque while it is being traced,
+// so the same tile is never traced by two threads at once (which can happen with work_queue_dynamic).
+class work_queue_stealing final : public work_queue {
+    static constexpr uint32 NO_TILE = ~0u;
+
+    struct alignas(64) work_deque {
+        std::mutex lock;
+        std::deque<uint32> tiles;         // indices into worklist
+        std::atomic<uint64> completed{0}; // finished tile/sample pairs, for the progress display
+        uint32 held = NO_TILE;            // tile currently traced by the owner, only touched by the owner
+    };
+
+    work_deque *deques;
+    uint32 *tileSamples; // next sample index per tile, owned by whichever thread holds the tile
+    std::atomic<uint64> exhaustedTiles; // tiles that have handed out all of their samples
+
+    uint32 steal(uint32 threadId);
+public:
+    uint32 numSamples;
+
+    work_queue_stealing(uint32 bufferWidth, uint32 bufferHeight, uint32 tileSize, uint32 numThreads, uint32 numSamples);
+    ~work_queue_stealing();
+
+    tile* getWork(uint32 threadId, uint32* curSample_out);
     float getPercentDone();
+    void retireTile(uint32 threadId);
 };
\ No newline at end of file